@@ -0,0 +1,100 @@
+import { DataSymbol, FunctionSymbol, IRBinOpcode, IRCmpOpcode, IRCode, IROpcode, RWOpcodeFlags, Section } from './ir';
+import { expandCode } from './expand';
+
+/*
+ * Benchmark of the compact function code (IRCode) against the expanded IRInstruction objects
+ * on a synthetic program with 1M instructions. Run it with:
+ *
+ *     node --expose-gc --import tsx bench-ir.ts
+ *
+ * Heap size is measured only if the "--expose-gc" option is given.
+ */
+
+const INSTRUCTION_COUNT = 1000000;
+const FUNCTION_SIZE = 1000;
+const BLOCK_SIZE = 10;
+
+const section: Section = {
+    id: 1, index: 1, name: '.text', link: undefined, reloc: undefined, prev: undefined,
+    size: 12 * INSTRUCTION_COUNT, data: undefined, addr: 0, entsize: 0, flags: 0, info: 0, type: 1,
+    known: true,
+};
+
+const variable = new DataSymbol('variable', section, 0, 4);
+
+function writeInstruction(view: DataView, index: number, opcode: IROpcode, op2: number, reg: number, srcReg: number, value: number, value2: number) {
+    let offset = 12 * index;
+    view.setUint8(offset, opcode);
+    view.setUint8(offset + 1, op2);
+    view.setUint8(offset + 2, reg);
+    view.setUint8(offset + 3, srcReg);
+    view.setUint32(offset + 4, value, true);
+    view.setUint32(offset + 8, value2, true);
+}
+
+/*
+ * Each block of the function is: label definition, a few arithmetic instructions,
+ * memory read with a relocation and a conditional jump to the beginning of the block.
+ */
+function generateProgram(): Uint8Array {
+    let data = new Uint8Array(12 * INSTRUCTION_COUNT);
+    let view = new DataView(data.buffer);
+    for (let index = 0; index < INSTRUCTION_COUNT; index++) {
+        let funcIndex = index % FUNCTION_SIZE;
+        let label = Math.floor(funcIndex / BLOCK_SIZE);
+        if (funcIndex === FUNCTION_SIZE - 1) {
+            writeInstruction(view, index, IROpcode.INSTR_RETURN, 0, 0, 0, 0, 0);
+            continue;
+        }
+        switch (funcIndex % BLOCK_SIZE) {
+            case 0:
+                writeInstruction(view, index, IROpcode.INSTR_LABEL_RELATIVE, 0, 0, 0, label, 0);
+                break;
+            case 1:
+                writeInstruction(view, index, IROpcode.INSTR_MOV_CONST, 0, 0, 0, index, 0);
+                break;
+            case 2:
+                writeInstruction(view, index, IROpcode.INSTR_READ_CONST, RWOpcodeFlags.BITS32, 1, 0, 0, 0);
+                break;
+            case BLOCK_SIZE - 1:
+                writeInstruction(view, index, IROpcode.INSTR_JUMP_COND_LABEL, IRCmpOpcode.CMP_OP_NE, 0, 0, label, 0);
+                break;
+            default:
+                writeInstruction(view, index, IROpcode.INSTR_BIN_OP, IRBinOpcode.BIN_OP_ADD, 0, 1, 0, 0);
+                break;
+        }
+    }
+    return data;
+}
+
+function decodeProgram(data: Uint8Array): FunctionSymbol[] {
+    let functions: FunctionSymbol[] = [];
+    for (let offset = 0; offset < data.length; offset += 12 * FUNCTION_SIZE) {
+        let symbol = new FunctionSymbol(`func${functions.length}`, section, offset, 12 * FUNCTION_SIZE);
+        symbol.code = IRCode.decode(data, offset, FUNCTION_SIZE);
+        for (let i = 2; i < FUNCTION_SIZE; i += BLOCK_SIZE) {
+            symbol.code.relocations.set(i, variable);
+        }
+        functions.push(symbol);
+    }
+    return functions;
+}
+
+function measure<T>(name: string, action: () => T): T {
+    let gc = (globalThis as any).gc as (() => void) | undefined;
+    gc?.();
+    let heapBefore = process.memoryUsage().heapUsed;
+    let start = performance.now();
+    let result = action();
+    let time = performance.now() - start;
+    gc?.();
+    let heap = gc ? `${((process.memoryUsage().heapUsed - heapBefore) / 1048576).toFixed(1)} MB` : '-';
+    console.log(`${name.padEnd(8)} ${time.toFixed(0).padStart(6)} ms ${heap.padStart(10)}`);
+    return result;
+}
+
+let data = generateProgram();
+console.log(`${INSTRUCTION_COUNT} instructions in ${INSTRUCTION_COUNT / FUNCTION_SIZE} functions`);
+console.log(`${'step'.padEnd(8)} ${'time'.padStart(9)} ${'heap'.padStart(10)}`);
+let functions = measure('decode', () => decodeProgram(data));
+measure('expand', () => functions.forEach(expandCode));
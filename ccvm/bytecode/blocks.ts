@@ -0,0 +1,223 @@
+import { FunctionSymbol, IRInstruction, IROpcode, ValueFunction } from './ir';
+import { replaceObjectContent } from './utils';
+
+/*
+ * Profile-guided basic blocks reordering.
+ *
+ * The compiler marks conditional jumps with a hint when the code was compiled with
+ * "-fprofile-use". Blocks are placed in chains following the likely successor, so the hot
+ * path falls through and each taken jump is a rare event. Conditions are inverted when
+ * the jump target is placed just after the jump, explicit jumps are added when a fallthrough
+ * block was moved away. A jump back to a small, hinted loop header is replaced by a copy
+ * of the header, so the loop is tested at the bottom.
+ *
+ * Functions without any hint are left untouched.
+ */
+
+const MAX_DUPLICATED_HEADER_SIZE = 6;
+
+interface Block {
+    instructions: IRInstruction[];
+    fallthrough?: Block;
+    target?: Block;
+    // Original condition and hint of the ending conditional jump, the jump itself may be inverted
+    condition?: number;
+    hint?: number;
+}
+
+export function reorderBlocks(symbol: FunctionSymbol): void {
+    let ir = symbol.ir;
+    if (!ir || !ir.find(instr => instr.opcode === IROpcode.INSTR_JUMP_COND_INSTR && instr.hint)) {
+        return;
+    }
+    let blocks = splitBlocks(symbol, ir);
+    if (!blocks) {
+        return;
+    }
+    let order = layoutBlocks(blocks);
+    let orderIndex = new Map<Block, number>(order.map((block, index) => [block, index]));
+    let result: IRInstruction[] = [];
+
+    for (let [index, block] of order.entries()) {
+        let next: Block | undefined = order[index + 1];
+        let last = block.instructions[block.instructions.length - 1];
+        result.push(...block.instructions);
+        if (last.opcode === IROpcode.INSTR_JUMP_INSTR) {
+            let header = block.target!;
+            if (header === next) {
+                replaceObjectContent<IRInstruction>(last, { opcode: IROpcode.INSTR_EMPTY });
+            } else if (orderIndex.get(header)! < index && canDuplicateHeader(header)) {
+                duplicateHeader(result, last, header, next);
+            }
+        } else if (last.opcode === IROpcode.INSTR_JUMP_COND_INSTR) {
+            fixConditionalJump(result, last, block.fallthrough!, block.target!, next);
+        } else if (block.fallthrough && block.fallthrough !== next) {
+            result.push({ opcode: IROpcode.INSTR_JUMP_INSTR, instruction: block.fallthrough.instructions[0] });
+        }
+    }
+
+    symbol.ir = result;
+}
+
+function isTerminator(instr: IRInstruction): boolean {
+    switch (instr.opcode) {
+        case IROpcode.INSTR_JUMP_INSTR:
+        case IROpcode.INSTR_JUMP_CONST:
+        case IROpcode.INSTR_JUMP_REG:
+        case IROpcode.INSTR_RETURN:
+            return true;
+        default:
+            return false;
+    }
+}
+
+function splitBlocks(symbol: FunctionSymbol, ir: IRInstruction[]): Block[] | undefined {
+    let leaders = new Set<IRInstruction>([ir[0]]);
+    for (let inner of symbol.innerSymbols ?? []) {
+        if (inner.instruction) leaders.add(inner.instruction);
+    }
+    for (let [i, instr] of ir.entries()) {
+        if (instr.opcode === IROpcode.INSTR_JUMP_INSTR || instr.opcode === IROpcode.INSTR_JUMP_COND_INSTR) {
+            leaders.add(instr.instruction);
+        }
+        if ((isTerminator(instr) || instr.opcode === IROpcode.INSTR_JUMP_COND_INSTR) && i + 1 < ir.length) {
+            leaders.add(ir[i + 1]);
+        }
+    }
+
+    let blocks: Block[] = [];
+    let blockByLeader = new Map<IRInstruction, Block>();
+    for (let instr of ir) {
+        if (leaders.has(instr)) {
+            let block: Block = { instructions: [] };
+            blocks.push(block);
+            blockByLeader.set(instr, block);
+        }
+        blocks[blocks.length - 1].instructions.push(instr);
+    }
+
+    for (let [i, block] of blocks.entries()) {
+        let last = block.instructions[block.instructions.length - 1];
+        if (last.opcode === IROpcode.INSTR_JUMP_INSTR || last.opcode === IROpcode.INSTR_JUMP_COND_INSTR) {
+            block.target = blockByLeader.get(last.instruction);
+            if (!block.target) return undefined; // Jump outside the function, leave it as it is
+        }
+        if (last.opcode === IROpcode.INSTR_JUMP_COND_INSTR) {
+            block.condition = last.condition;
+            block.hint = last.hint ?? 0;
+        }
+        if (!isTerminator(last)) {
+            block.fallthrough = blocks[i + 1];
+            if (!block.fallthrough) return undefined; // Falls off the function end, leave it as it is
+        }
+    }
+
+    return blocks;
+}
+
+function layoutBlocks(blocks: Block[]): Block[] {
+    let fallthroughTargets = new Set<Block>();
+    for (let block of blocks) {
+        if (block.fallthrough) fallthroughTargets.add(block.fallthrough);
+    }
+    let placed = new Set<Block>();
+    let order: Block[] = [];
+    // Entry block stays first, the remaining chains start from the first not placed block
+    for (let seed of blocks) {
+        let block: Block | undefined = seed;
+        while (block && !placed.has(block)) {
+            order.push(block);
+            placed.add(block);
+            block = likelySuccessor(block, fallthroughTargets);
+        }
+    }
+    return order;
+}
+
+function likelySuccessor(block: Block, fallthroughTargets: Set<Block>): Block | undefined {
+    if (block.hint !== undefined && block.hint > 0) {
+        return block.target;
+    } else if (block.fallthrough) {
+        return block.fallthrough;
+    } else if (block.target && !fallthroughTargets.has(block.target)) {
+        // Unconditional jump to a block that is not a fallthrough of any other block
+        return block.target;
+    }
+    return undefined;
+}
+
+function fixConditionalJump(result: IRInstruction[], jump: IRInstruction, fallthrough: Block, target: Block, next: Block | undefined) {
+    if (jump.opcode !== IROpcode.INSTR_JUMP_COND_INSTR || fallthrough === next) {
+        return;
+    } else if (target === next) {
+        jump.condition ^= 1;
+        jump.instruction = fallthrough.instructions[0];
+        jump.hint = -(jump.hint ?? 0);
+    } else {
+        result.push({ opcode: IROpcode.INSTR_JUMP_INSTR, instruction: fallthrough.instructions[0] });
+    }
+}
+
+function canDuplicateHeader(header: Block): boolean {
+    if (!header.hint) return false;
+    let size = 0;
+    for (let instr of header.instructions) {
+        switch (instr.opcode) {
+            case IROpcode.INSTR_EMPTY:
+                break;
+            case IROpcode.INSTR_MOV_REG:
+            case IROpcode.INSTR_MOV_CONST:
+            case IROpcode.INSTR_READ_CONST:
+            case IROpcode.INSTR_READ_REG:
+            case IROpcode.INSTR_READ_REG_OFFSET:
+            case IROpcode.INSTR_READ_REG_INDEX:
+            case IROpcode.INSTR_BIN_OP:
+            case IROpcode.INSTR_BIN_OP_CONST:
+            case IROpcode.INSTR_SETCC:
+            case IROpcode.INSTR_SELECT:
+            case IROpcode.INSTR_BIN_OP64:
+            case IROpcode.INSTR_BIN_OP64_CONST:
+            case IROpcode.INSTR_BFX:
+            case IROpcode.INSTR_BFI:
+            case IROpcode.INSTR_COUNT:
+            case IROpcode.INSTR_JUMP_COND_INSTR:
+                size++;
+                break;
+            default:
+                return false;
+        }
+    }
+    return size <= MAX_DUPLICATED_HEADER_SIZE;
+}
+
+function duplicateHeader(result: IRInstruction[], jump: IRInstruction, header: Block, next: Block | undefined) {
+    let copies = header.instructions
+        .slice(0, header.instructions.length - 1)
+        .filter(instr => instr.opcode !== IROpcode.INSTR_EMPTY)
+        .map(cloneInstruction);
+    let condJump: IRInstruction = {
+        opcode: IROpcode.INSTR_JUMP_COND_INSTR,
+        instruction: header.target!.instructions[0],
+        condition: header.condition!,
+        hint: header.hint,
+    };
+    copies.push(condJump);
+    // The jump may be a target of other jumps, so it is replaced in place by the first instruction
+    replaceObjectContent<IRInstruction>(jump, copies[0]);
+    if (copies[0] === condJump) condJump = jump;
+    result.push(...copies.slice(1));
+    fixConditionalJump(result, condJump, header.fallthrough!, header.target!, next);
+}
+
+function cloneInstruction(instr: IRInstruction): IRInstruction {
+    let copy: any = { ...instr };
+    for (let [key, value] of Object.entries(copy)) {
+        if (value instanceof ValueFunction) {
+            copy[key] = new ValueFunction(value.value, value.relocation);
+        }
+    }
+    if (instr.references) {
+        copy.references = [...instr.references];
+    }
+    return copy;
+}
@@ -0,0 +1,69 @@
+import { DataSymbol, FunctionSymbol, InnerSymbol, IRInstruction, IROpcode, RWOpcodeFlags, ValueFunction, WithIRSymbol } from './ir';
+import { warning } from './utils';
+
+/*
+ * Verification of memory accesses marked by the compiler as in bounds (RWOpcodeFlags.SAFE).
+ * The VM may execute them without bounds check, so the linker removes the flag, with a warning,
+ * from each access that it cannot prove:
+ *
+ *   BP relative:      inside locals (size from the prologue PUSH_BLOCK) or inside
+ *                     parameters area, i.e. after return address and saved BP, with
+ *                     the size the compiler stored in the prologue,
+ *   symbol relative:  inside the data symbol.
+ *
+ * The frame is in the stack, because PUSH_BLOCK checks the stack limit.
+ */
+
+const FRAME_HEADER_SIZE = 8;
+
+export function verifySafeAccesses(outputSymbols: WithIRSymbol[]): void {
+    for (let symbol of outputSymbols) {
+        if (!(symbol instanceof FunctionSymbol) || !symbol.used || !symbol.ir) continue;
+        let frameSize = getFrameSize(symbol.ir);
+        for (let instr of symbol.ir) {
+            if (instr.opcode !== IROpcode.INSTR_READ_CONST && instr.opcode !== IROpcode.INSTR_WRITE_CONST) continue;
+            if (!(instr.op & RWOpcodeFlags.SAFE)) continue;
+            let size = 1 << (instr.op & RWOpcodeFlags.BITS_MASK);
+            let ok = (instr.op & RWOpcodeFlags.BP)
+                ? isFrameAccess(instr.value, size, frameSize, symbol.paramsSize)
+                : isSymbolAccess(instr.value, size);
+            if (!ok) {
+                warning(`Cannot prove that memory access in "${symbol.name}" is in bounds, bounds check will be used.`);
+                instr.op &= ~RWOpcodeFlags.SAFE;
+            }
+        }
+    }
+}
+
+function getFrameSize(ir: IRInstruction[]): number {
+    // Prologue is the first instruction, the parser removes it if there are no locals
+    let first = ir.find(instr => instr.opcode !== IROpcode.INSTR_EMPTY);
+    if (first?.opcode === IROpcode.INSTR_PUSH_BLOCK_CONST && first.optional) {
+        return first.value.getValue();
+    }
+    return 0;
+}
+
+function isFrameAccess(value: ValueFunction, size: number, frameSize: number, paramsSize: number): boolean {
+    let offset = value.value | 0;
+    if (value.relocation) {
+        return false;
+    } else if (offset < 0) {
+        return offset >= -frameSize && offset + size <= 0;
+    } else {
+        return offset >= FRAME_HEADER_SIZE && offset + size <= FRAME_HEADER_SIZE + paramsSize;
+    }
+}
+
+function isSymbolAccess(value: ValueFunction, size: number): boolean {
+    let offset = value.value | 0;
+    let target = value.relocation;
+    if (target instanceof InnerSymbol) {
+        offset += target.parentOffset;
+        target = target.parentSymbol;
+    }
+    if (!(target instanceof DataSymbol)) {
+        return false;
+    }
+    return offset >= 0 && offset + size <= target.size;
+}
@@ -0,0 +1,59 @@
+
+/*
+ * Test coverage counters ("-ftest-coverage") of a guest program.
+ *
+ * Decodes content of the ".tcov" section passed to the host by "__ccvm_store_profile()"
+ * with kind 2 when the guest program exits. For section layout see lib/tcov.c.
+ */
+
+export interface CoverageBlock {
+    fileName: string;
+    functionName: string;
+    firstLine: number;
+    lastLine: number;
+    count: number;
+}
+
+export function decodeCoverage(data: Uint8Array): CoverageBlock[] {
+    let blocks: CoverageBlock[] = [];
+    let view = new DataView(data.buffer, data.byteOffset, data.byteLength);
+    let offset = 4;
+
+    let readString = (): string => {
+        let end = data.indexOf(0, offset);
+        if (end < 0) throw new Error('Corrupted coverage data.');
+        let str = new TextDecoder().decode(data.subarray(offset, end));
+        offset = end + 1;
+        return str;
+    };
+
+    let readUint64 = (): number => {
+        if (offset + 8 > data.length) throw new Error('Corrupted coverage data.');
+        let value = Number(view.getBigUint64(offset, true));
+        offset += 8;
+        return value;
+    };
+
+    while (data[offset]) {
+        let fileName = readString();
+        while (data[offset]) {
+            let functionName = readString();
+            offset += -offset & 7;
+            readUint64(); // function start line
+            while (data[offset]) {
+                let lines = readUint64();
+                let count = readUint64();
+                blocks.push({
+                    fileName, functionName,
+                    firstLine: Math.floor(lines / 0x100) % 0x10000000,
+                    lastLine: Math.floor(lines / 0x1000000000),
+                    count,
+                });
+            }
+            offset++;
+        }
+        offset++;
+    }
+
+    return blocks;
+}
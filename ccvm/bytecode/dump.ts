@@ -1,4 +1,4 @@
-import { AbsoluteSymbol, collectAliasedLabels, DataSymbol, FunctionInnerSymbol, FunctionSymbol, ImportSymbol, InnerSymbol, InvalidSymbol, IRBinOpcode, IRCmpOpcode, IRInstruction, IROpcode, Label, RWOpcodeFlags, SymbolBase, UndefinedSymbol, ValueFunction, WithIRSymbol } from "./ir";
+import { AbsoluteSymbol, collectAliasedLabels, DataSymbol, FunctionInnerSymbol, FunctionSymbol, ImportSymbol, InnerSymbol, InvalidSymbol, IRBinOpcode, IRCmpOpcode, IRCode, IRInstruction, IROpcode, Label, RWOpcodeFlags, SymbolBase, UndefinedSymbol, ValueFunction, WithIRSymbol } from "./ir";
 import { assertUnreachable } from "./utils";
 
 const map = new Map<any, string>();
@@ -57,37 +57,52 @@ export function dumpIR(ir: IRInstruction[] | undefined, ind: string) {
 
             case IROpcode.INSTR_WRITE_CONST:       // reg <= [value]
             case IROpcode.INSTR_READ_CONST: {      // reg => [value]
-                let type = (instr.op & RWOpcodeFlags.SIGNED) ? 'int' : 'uint';
-                switch (instr.op & RWOpcodeFlags.BITS_MASK) {
-                    case RWOpcodeFlags.BITS8: type += '8'; break;
-                    case RWOpcodeFlags.BITS16: type += '16'; break;
-                    case RWOpcodeFlags.BITS32: type += '32'; break;
-                    case RWOpcodeFlags.BITS64: type += '64'; break;
-                }
-                let reg = `R${instr.reg}`;
-                let mem = `${type}[${getValueStr(instr.value, true, !!(instr.op & RWOpcodeFlags.BP))}]`;
-                if (instr.opcode === IROpcode.INSTR_WRITE_CONST) {
-                    line += ` ${mem} = ${reg}`;
-                } else {
-                    line += ` ${reg} = ${mem}`;
-                }
+                let mem = `${getTypeStr(instr.op)}[${getValueStr(instr.value, true, !!(instr.op & RWOpcodeFlags.BP))}]`;
+                if (instr.op & RWOpcodeFlags.SAFE) mem += ' (safe)';
+                line += getAccessStr(instr.opcode === IROpcode.INSTR_WRITE_CONST, instr.reg, mem);
                 break;
             }
 
             case IROpcode.INSTR_WRITE_REG:        // reg => [addrReg]
-                line += ` [R${instr.addrReg}] = R${instr.reg}`;
+            case IROpcode.INSTR_READ_REG: {       // reg <= [addrReg]
+                let mem = `${getTypeStr(instr.op)}[R${instr.addrReg}]`;
+                line += getAccessStr(instr.opcode === IROpcode.INSTR_WRITE_REG, instr.reg, mem);
+                break;
+            }
+
+            case IROpcode.INSTR_WRITE_REG_OFFSET: // reg => [addrReg + value]
+            case IROpcode.INSTR_READ_REG_OFFSET: { // reg <= [addrReg + value]
+                let mem = `${getTypeStr(instr.op)}[R${instr.addrReg} + ${getValueStr(instr.value, true)}]`.replace('+ -', '- ');
+                line += getAccessStr(instr.opcode === IROpcode.INSTR_WRITE_REG_OFFSET, instr.reg, mem);
+                break;
+            }
+
+            case IROpcode.INSTR_WRITE_REG_INDEX:  // reg => [addrReg + (indexReg << scale)]
+            case IROpcode.INSTR_READ_REG_INDEX: { // reg <= [addrReg + (indexReg << scale)]
+                let scale = (instr.op & RWOpcodeFlags.SCALE_MASK) >> RWOpcodeFlags.SCALE_SHIFT;
+                let mem = `${getTypeStr(instr.op)}[R${instr.addrReg} + R${instr.indexReg} * ${1 << scale}]`;
+                line += getAccessStr(instr.opcode === IROpcode.INSTR_WRITE_REG_INDEX, instr.reg, mem);
+                break;
+            }
+
+            case IROpcode.INSTR_SETCC:            // reg = condition ? 1 : 0
+                line += ` R${instr.reg} = ${getCondStr(instr.condition)}`;
                 break;
 
-            case IROpcode.INSTR_READ_REG:         // reg <= [addrReg]
-                line += ` R${instr.reg} = [R${instr.addrReg}]`;
+            case IROpcode.INSTR_SELECT:           // dstReg = condition ? srcReg : dstReg
+                line += ` R${instr.dstReg} = ${getCondStr(instr.condition)} ? R${instr.srcReg} : R${instr.dstReg}`;
                 break;
 
             case IROpcode.INSTR_JUMP_COND_LABEL:  // label, op2 = condition
-                line += ` IF ${getCondStr(instr.condition)} ${getLabelStr(instr.label)}`;
+                line += ` IF ${getCondStr(instr.condition)} ${getLabelStr(instr.label)}${getHintStr(instr.hint)}`;
                 break;
 
             case IROpcode.INSTR_JUMP_COND_INSTR:
-                line += ` IF ${getCondStr(instr.condition)} ${getID(instr.instruction)}`;
+                line += ` IF ${getCondStr(instr.condition)} ${getID(instr.instruction)}${getHintStr(instr.hint)}`;
+                break;
+
+            case IROpcode.INSTR_COUNT:
+                line += ` uint${(instr.op & RWOpcodeFlags.BITS_MASK) === RWOpcodeFlags.BITS64 ? 64 : 32}[${getValueStr(instr.value)}]++`;
                 break;
 
             case IROpcode.INSTR_JUMP_CONST:       // address
@@ -153,6 +168,34 @@ export function dumpIR(ir: IRInstruction[] | undefined, ind: string) {
                 }
                 break;
 
+            case IROpcode.INSTR_BIN_OP64:         // Rd:Xd = Rd:Xd ?? Rs:Xs
+                if (instr.op === IRBinOpcode.BIN_OP_CMP) {
+                    line += ` R${instr.dstReg}:X${instr.dstReg} ${binOpName(instr.op)} R${instr.srcReg}:X${instr.srcReg}`;
+                } else if (instr.op === IRBinOpcode.BIN_OP_SHL || instr.op === IRBinOpcode.BIN_OP_SHR || instr.op === IRBinOpcode.BIN_OP_SAR) {
+                    line += ` R${instr.dstReg}:X${instr.dstReg} = R${instr.dstReg}:X${instr.dstReg} ${binOpName(instr.op)} R${instr.srcReg}`;
+                } else {
+                    line += ` R${instr.dstReg}:X${instr.dstReg} = R${instr.dstReg}:X${instr.dstReg} ${binOpName(instr.op)} R${instr.srcReg}:X${instr.srcReg}`;
+                }
+                break;
+
+            case IROpcode.INSTR_BIN_OP64_CONST: { // Rd:Xd = Rd:Xd ?? (valueHigh << 32 | value)
+                let value = `0x${instr.valueHigh.toString(16).padStart(8, '0')}${instr.valueLow.toString(16).padStart(8, '0')}`;
+                if (instr.op === IRBinOpcode.BIN_OP_CMP) {
+                    line += ` R${instr.reg}:X${instr.reg} ${binOpName(instr.op)} ${value}`;
+                } else {
+                    line += ` R${instr.reg}:X${instr.reg} = R${instr.reg}:X${instr.reg} ${binOpName(instr.op)} ${value}`;
+                }
+                break;
+            }
+
+            case IROpcode.INSTR_BFX:              // reg = bitSize bits of reg at bit value
+                line += ` R${instr.reg} = ${instr.signed ? '(signed) ' : ''}R${instr.reg}[${instr.position + instr.size - 1}:${instr.position}]`;
+                break;
+
+            case IROpcode.INSTR_BFI:              // bitSize bits of dstReg at bit value = srcReg
+                line += ` R${instr.dstReg}[${instr.position + instr.size - 1}:${instr.position}] = R${instr.srcReg}`;
+                break;
+
             case IROpcode.INSTR_RETURN:           // value = cleanup words
                 break;
 
@@ -186,6 +229,7 @@ export function dumpIR(ir: IRInstruction[] | undefined, ind: string) {
                 break;
 
             case IROpcode.INSTR_HOST:
+            case IROpcode.INSTR_CALL_HOST:
                 line += ` ${getValueStr(instr.value)}`;
                 break;
 
@@ -197,10 +241,34 @@ export function dumpIR(ir: IRInstruction[] | undefined, ind: string) {
             comment += ', references ' + instr.references.map(ref => getID(ref)).join(', ');
         }
 
+        if (instr.line) {
+            comment += `, ${instr.line.file}:${instr.line.line}`;
+        }
+
         console.log(ind, line, '#', comment);
     }
 }
 
+/*
+ * Raw dump of the compact code, used for functions that were not expanded, i.e. removed ones.
+ */
+export function dumpCode(code: IRCode, ind: string) {
+    if (code.length === 0) {
+        console.log(ind, '# Empty');
+    }
+    for (let i = 0; i < code.length; i++) {
+        let line = `0x${i.toString(16).padStart(4, '0')} ${IROpcode[code.opcode[i]]?.substring(6) ?? code.opcode[i]}`
+            + ` op2=0x${code.op2[i].toString(16)} R${code.reg[i]} R${code.srcReg[i]}`
+            + ` 0x${code.value[i].toString(16)} 0x${code.value2[i].toString(16)}`;
+        let comment: string[] = [];
+        let relocation = code.relocations.get(i);
+        if (relocation) comment.push(`value + ${getID(relocation)}`);
+        let source = code.lines.get(i);
+        if (source) comment.push(`${source.file}:${source.line}`);
+        console.log(ind, line, ...(comment.length ? ['#', comment.join(', ')] : []));
+    }
+}
+
 export function dumpIRFromSymbols(symbols: SymbolBase[], commentUnused: boolean = false): void {
     for (let symbol of symbols) {
         let prefix = (commentUnused && (symbol instanceof WithIRSymbol) && !symbol.used) ? '# ' : '';
@@ -228,7 +296,9 @@ export function dumpIRFromSymbols(symbols: SymbolBase[], commentUnused: boolean
         } else {
             console.log(`${prefix}    # UNKNOWN KIND OF SYMBOL`);
         }
-        if (symbol instanceof WithIRSymbol) {
+        if (symbol instanceof WithIRSymbol && symbol.code) {
+            dumpCode(symbol.code, `${prefix}   `);
+        } else if (symbol instanceof WithIRSymbol) {
             dumpIR(symbol.ir, `${prefix}   `);
         }
         console.log();
@@ -251,6 +321,8 @@ function binOpName(op: number): string {
         case IRBinOpcode.BIN_OP_SAR: return '(signed) >>';
         case IRBinOpcode.BIN_OP_DIV: return '(signed) /';
         case IRBinOpcode.BIN_OP_UDIV: return '(unsigned) /';
+        case IRBinOpcode.BIN_OP_MOD: return '(signed) %';
+        case IRBinOpcode.BIN_OP_UMOD: return '(unsigned) %';
         case IRBinOpcode.BIN_OP_CMP: return '(compare) ?';
         default: return `(?0x${op.toString(16)}?)`;
     }
@@ -270,6 +342,20 @@ function getValueStr(value: ValueFunction, signed: boolean = false, bp: boolean
     return parts.length ? parts.join(' + ').replace('+ -', '- ') : '0';
 }
 
+function getTypeStr(op: number): string {
+    let type = (op & RWOpcodeFlags.SIGNED) ? 'int' : 'uint';
+    switch (op & RWOpcodeFlags.BITS_MASK) {
+        case RWOpcodeFlags.BITS8: return type + '8';
+        case RWOpcodeFlags.BITS16: return type + '16';
+        case RWOpcodeFlags.BITS32: return type + '32';
+        default: return type + '64';
+    }
+}
+
+function getAccessStr(write: boolean, reg: number, mem: string): string {
+    return write ? ` ${mem} = R${reg}` : ` R${reg} = ${mem}`;
+}
+
 function getLabelStr(label: Label) {
     let all = collectAliasedLabels(label);
     let parts: string[] = [];
@@ -282,6 +368,11 @@ function getLabelStr(label: Label) {
     return parts.join(', ');
 }
 
+function getHintStr(hint: number | undefined) {
+    if (!hint) return '';
+    return hint > 0 ? ' (likely)' : ' (unlikely)';
+}
+
 function getCondStr(op: number) {
     switch (op) {
         case IRCmpOpcode.CMP_OP_ULT: return '(unsigned) <';
@@ -0,0 +1,312 @@
+import { collectAliasedLabels, FunctionSymbol, IRCode, IRInstruction, IROpcode, Label, SourceLine, SymbolBase, ValueFunction } from './ir';
+import { replaceObjectContent } from './utils';
+
+/*
+ * Expands the compact function code (IRCode) into IRInstruction objects. It is done only for
+ * functions that are used, after the unused ones are removed. Labels are resolved, so the
+ * jumps point directly to the instructions, and the source lines are assigned.
+ */
+export function expandCode(symbol: FunctionSymbol): void {
+    if (symbol.code) {
+        new CodeExpander().expand(symbol, symbol.code);
+        symbol.code = undefined;
+    }
+}
+
+class CodeExpander {
+
+    private labels: Label[] = [];
+
+    public expand(symbol: FunctionSymbol, code: IRCode) {
+        let ir: IRInstruction[] = [];
+        let line: SourceLine | undefined = undefined;
+        // The prologue may be removed below, keep the parameters size it carries
+        if (code.length > 0 && code.opcode[0] === IROpcode.INSTR_PUSH_BLOCK_LABEL && code.op2[0]) {
+            symbol.paramsSize = code.value2[0];
+        }
+        for (let index = 0; index < code.length; index++) {
+            let instr = this.generateInstruction(code, index);
+            line = code.lines.get(index) ?? line;
+            if (line) instr.line = line;
+            ir.push(instr);
+        }
+        for (let inner of symbol.innerSymbols ?? []) {
+            inner.instruction = ir[inner.parentOffset / 12];
+        }
+        this.resolveLabelsInIR(ir);
+        symbol.ir = ir;
+    }
+
+    private generateInstruction(code: IRCode, index: number): IRInstruction {
+        let opcode = code.opcode[index];
+        let op2 = code.op2[index];
+        let reg = code.reg[index];
+        let dstReg = reg;
+        let srcReg = code.srcReg[index];
+        let addrReg = srcReg;
+        let uintValue = code.value[index];
+        let uintValue2 = code.value2[index];
+        let relocation = code.relocations.get(index);
+        let value: ValueFunction;
+        let references: SymbolBase[] | undefined = undefined;
+
+        if (relocation) {
+            value = new ValueFunction(uintValue, relocation);
+            references = [relocation];
+        } else {
+            value = new ValueFunction(uintValue);
+        }
+
+        switch (opcode) {
+
+            case IROpcode.INSTR_MOV_REG:          // dstReg = srcReg
+                this.noRelocation(relocation);
+                return { opcode, references, dstReg, srcReg };
+
+            case IROpcode.INSTR_PUSH_BLOCK_REG:          // dstReg = BLOCK of srcReg bytes
+                this.noRelocation(relocation);
+                return { opcode, references, dstReg, srcReg };
+
+            case IROpcode.INSTR_NOOP:
+                if (uintValue === 0 && !relocation) {
+                    // Instruction removed by the compiler after it was generated
+                    return { opcode: IROpcode.INSTR_EMPTY };
+                }
+                return { opcode, references, value };
+
+            case IROpcode.INSTR_MOV_CONST:        // reg = value
+                return { opcode, references, reg, value };
+
+            case IROpcode.INSTR_LABEL_RELATIVE: {   // label, address_offset
+                this.noRelocation(relocation);
+                let label = this.getLabel(uintValue);
+                let address = (uintValue2 + 12 * index) & 0xFFFFFFFF;
+                if (address % 12 !== 0) throw new Error(`Invalid label address ${address}`);
+                if (address < 0) throw new Error('Label offset out of range');
+                if (address > 12 * code.length) throw new Error('Label offset out of range');
+                label.instructionOffset = address / 12;
+                return { opcode, references, label, value: address };
+            }
+
+            case IROpcode.INSTR_LABEL_ABSOLUTE: {   // label, address_offset
+                this.noRelocation(relocation);
+                let label = this.getLabel(uintValue);
+                label.absoluteValue = uintValue2;
+                return { opcode, references, label, value: uintValue2 };
+            }
+
+            case IROpcode.INSTR_WRITE_CONST:      // reg => [value]
+            case IROpcode.INSTR_READ_CONST:       // reg <= [value]
+                return { opcode, references, reg, value, op: op2 }
+
+            case IROpcode.INSTR_WRITE_REG:        // reg => [addrReg]
+            case IROpcode.INSTR_READ_REG:         // reg <= [addrReg]
+                this.noRelocation(relocation);
+                return { opcode, references, reg, addrReg, op: op2 };
+
+            case IROpcode.INSTR_WRITE_REG_OFFSET: // reg => [addrReg + value]
+            case IROpcode.INSTR_READ_REG_OFFSET:  // reg <= [addrReg + value]
+                this.noRelocation(relocation);
+                return { opcode, references, reg, addrReg, value, op: op2 };
+
+            case IROpcode.INSTR_WRITE_REG_INDEX:  // reg => [addrReg + (indexReg << scale)]
+            case IROpcode.INSTR_READ_REG_INDEX:   // reg <= [addrReg + (indexReg << scale)]
+                this.noRelocation(relocation);
+                return { opcode, references, reg, addrReg, indexReg: uintValue, op: op2 };
+
+            case IROpcode.INSTR_SETCC:            // reg = condition ? 1 : 0
+                this.noRelocation(relocation);
+                return { opcode, references, reg, condition: op2 };
+
+            case IROpcode.INSTR_SELECT:           // dstReg = condition ? srcReg : dstReg
+                this.noRelocation(relocation);
+                return { opcode, references, dstReg, srcReg, condition: op2 };
+
+            case IROpcode.INSTR_BIN_OP64:         // Rd:Xd = Rd:Xd ?? Rs:Xs
+                this.noRelocation(relocation);
+                return { opcode, references, dstReg, srcReg, op: op2 };
+
+            case IROpcode.INSTR_BIN_OP64_CONST:   // Rd:Xd = Rd:Xd ?? (valueHigh << 32 | value)
+                this.noRelocation(relocation);
+                return { opcode, references, reg, valueLow: uintValue, valueHigh: uintValue2, op: op2 };
+
+            case IROpcode.INSTR_BFX:              // reg = bitSize bits of reg at bit value
+                this.noRelocation(relocation);
+                return { opcode, references, reg, position: uintValue, size: uintValue2, signed: op2 !== 0 };
+
+            case IROpcode.INSTR_BFI:              // bitSize bits of dstReg at bit value = srcReg
+                this.noRelocation(relocation);
+                return { opcode, references, dstReg, srcReg, position: uintValue, size: uintValue2 };
+
+            case IROpcode.INSTR_JUMP_COND_LABEL:  // label, op2 = condition, hint
+                this.noRelocation(relocation);
+                return { opcode, references, label: this.getLabel(uintValue), condition: op2, hint: uintValue2 | 0 };
+
+            case IROpcode.INSTR_JUMP_CONST:       // address
+            case IROpcode.INSTR_CALL_CONST:       // address
+                return { opcode, references, value };
+
+            case IROpcode.INSTR_JUMP_LABEL:       // label
+                this.noRelocation(relocation);
+                return { opcode, references, label: this.getLabel(uintValue) };
+
+            case IROpcode.INSTR_JUMP_REG:         // reg
+            case IROpcode.INSTR_CALL_REG:         // reg
+                this.noRelocation(relocation);
+                return { opcode, references, reg };
+
+            case IROpcode.INSTR_PUSH:             // reg, op2 = 1..4 bytes
+                this.noRelocation(relocation);
+                return { opcode, references, reg, bytes: op2 as any };
+
+            case IROpcode.INSTR_POP:             // reg, op2 = 1..4 bytes
+                this.noRelocation(relocation);
+                return { opcode, references, reg, bytes: op2 as any };
+
+            case IROpcode.INSTR_PUSH_BLOCK_CONST: // reg, value = block size
+                return { opcode, references, reg, value, optional: op2 !== 0 };
+
+            case IROpcode.INSTR_PUSH_BLOCK_LABEL: // reg, label = label containing block size
+                this.noRelocation(relocation);
+                return { opcode, references, reg, label: this.getLabel(uintValue), optional: op2 !== 0 };
+
+            case IROpcode.INSTR_BIN_OP:           // srcReg, dstReg, op2 = operator
+                this.noRelocation(relocation);
+                return { opcode, references, dstReg, srcReg, op: op2 };
+
+            case IROpcode.INSTR_BIN_OP_CONST:
+                return { opcode, references, reg, value, op: op2 };
+
+            case IROpcode.INSTR_RETURN:           //
+                return { opcode, references }
+
+            case IROpcode.INSTR_HOST:           //
+                return { opcode, references, value }
+
+            case IROpcode.INSTR_CALL_HOST:      // value = host function index
+                return { opcode, references, value }
+
+            case IROpcode.INSTR_POP_BLOCK_CONST:           //
+                return { opcode, references, value }
+
+            case IROpcode.INSTR_COUNT:            // [value]++, op2 = counter size
+                return { opcode, references, value, op: op2 };
+
+            case IROpcode.INSTR_LABEL_ALIAS: {      // labelAlias = label
+                this.noRelocation(relocation);
+                let label1 = this.getLabel(uintValue);
+                let label2 = this.getLabel(uintValue2);
+                if (!label1.aliases) label1.aliases = [];
+                if (!label2.aliases) label2.aliases = [];
+                label1.aliases.push(label2);
+                label2.aliases.push(label1);
+                return { opcode, references, label1, label2 };
+            }
+
+            case IROpcode.INSTR_DATA: {
+                this.noRelocation(relocation);
+                let v = new DataView(new ArrayBuffer(8));
+                v.setUint32(0, uintValue, true);
+                v.setUint32(4, uintValue2, true);
+                return { opcode, references, data: new Uint8Array(v.buffer, 0, Math.min(8, op2)) };
+            }
+
+            case IROpcode.INSTR_WORD:
+                return { opcode, references, value };
+
+            case IROpcode.INSTR_FILL:
+                this.noRelocation(relocation);
+                return { opcode, references, size: uintValue };
+
+            default:
+                throw new Error(`Unknown IR opcode ${opcode}`);
+        }
+    }
+
+    private getLabel(labelIndex: number): Label {
+        if (!this.labels[labelIndex]) {
+            this.labels[labelIndex] = {};
+        }
+        return this.labels[labelIndex];
+    }
+
+    private noRelocation(relocation: SymbolBase | undefined) {
+        if (relocation) throw new Error('Relocation in instruction not supporting relocations.');
+    }
+
+    private resolveLabelsInIR(ir: IRInstruction[]) {
+        for (let instr of ir) {
+
+            switch (instr.opcode) {
+
+                case IROpcode.INSTR_JUMP_LABEL:
+                    instr.label = this.resolveLabel(ir, instr.label);
+                    if (instr.label.instruction === undefined) throw new Error('Absolute label address not allowed in JUMP instructions');
+                    replaceObjectContent<IRInstruction>(instr, {
+                        opcode: IROpcode.INSTR_JUMP_INSTR,
+                        instruction: instr.label.instruction,
+                    });
+                    break;
+
+                case IROpcode.INSTR_JUMP_COND_LABEL:
+                    instr.label = this.resolveLabel(ir, instr.label);
+                    if (instr.label.instruction === undefined) throw new Error('Absolute label address not allowed in JUMP instructions');
+                    replaceObjectContent<IRInstruction>(instr, {
+                        opcode: IROpcode.INSTR_JUMP_COND_INSTR,
+                        instruction: instr.label.instruction,
+                        condition: instr.condition,
+                        hint: instr.hint,
+                    });
+                    break;
+
+                case IROpcode.INSTR_PUSH_BLOCK_LABEL:
+                    instr.label = this.resolveLabel(ir, instr.label);
+                    if (instr.label.absoluteValue === undefined) throw new Error('Relative label address not allowed in PUSH_BLOCK instruction');
+                    if (instr.optional && instr.label.absoluteValue === 0) {
+                        replaceObjectContent<IRInstruction>(instr, {
+                            opcode: IROpcode.INSTR_EMPTY
+                        });
+                    } else {
+                        replaceObjectContent<IRInstruction>(instr, {
+                            opcode: IROpcode.INSTR_PUSH_BLOCK_CONST,
+                            optional: instr.optional,
+                            reg: instr.reg,
+                            value: new ValueFunction(instr.label.absoluteValue),
+                        });
+                    }
+                    break;
+
+                case IROpcode.INSTR_LABEL_RELATIVE:
+                case IROpcode.INSTR_LABEL_ABSOLUTE:
+                case IROpcode.INSTR_LABEL_ALIAS:
+                    replaceObjectContent<IRInstruction>(instr, {
+                        opcode: IROpcode.INSTR_EMPTY,
+                    });
+                    break;
+            }
+        }
+    }
+
+    private resolveLabel(ir: IRInstruction[], label: Label): Label {
+        let all = collectAliasedLabels(label);
+        let definitions = all.filter(label =>
+            label.instruction !== undefined
+            || label.instructionOffset !== undefined
+            || label.absoluteValue !== undefined
+        );
+        let main = definitions[0];
+        if (definitions.length < 1) {
+            throw new Error('Undefined label.');
+        } else if (definitions.length > 1) {
+            throw new Error('Multiple definitions of the same label.');
+        } else if (main.absoluteValue !== undefined || main.instruction !== undefined) {
+            return main;
+        } else if (main.instructionOffset! < 0 || main.instructionOffset! >= ir.length) {
+            throw new Error('Invalid label instruction offset.');
+        } else {
+            main.instruction = ir[main.instructionOffset!];
+            delete main.instructionOffset;
+            return main;
+        }
+    }
+}
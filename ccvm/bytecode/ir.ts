@@ -10,7 +10,7 @@ export enum IROpcode {
     INSTR_READ_CONST,       // reg <= [value]
     INSTR_WRITE_REG,        // reg => [addrReg]
     INSTR_READ_REG,         // reg <= [addrReg]
-    INSTR_JUMP_COND_LABEL,  // label, op2 = condition
+    INSTR_JUMP_COND_LABEL,  // label, op2 = condition, hint = taken (> 0) or not taken (< 0) is likely
     INSTR_JUMP_CONST,       // address
     INSTR_CALL_CONST,       // address
     INSTR_JUMP_LABEL,       // label
@@ -18,7 +18,7 @@ export enum IROpcode {
     INSTR_CALL_REG,         // reg
     INSTR_PUSH,             // reg, op2 = 1..4 bytes
     INSTR_PUSH_BLOCK_CONST, // reg, op2 = optional, value = block size
-    INSTR_PUSH_BLOCK_LABEL, // reg, op2 = optional, label = label containing block size
+    INSTR_PUSH_BLOCK_LABEL, // reg, op2 = optional, label = label containing block size, value2 = parameters size
     INSTR_BIN_OP,           // srcReg, dstReg, op2 = operator
     INSTR_RETURN,           //
     INSTR_LABEL_ALIAS,      // labelAlias = label
@@ -28,6 +28,18 @@ export enum IROpcode {
     INSTR_BIN_OP_CONST,     // reg = reg ?? value
     INSTR_NOOP,             // value = bytes
     INSTR_PUSH_BLOCK_REG,   // dstReg = block size srcReg
+    INSTR_COUNT,            // [value]++, op2 = 2 (32-bit) or 3 (64-bit) counter, flags preserved
+    INSTR_WRITE_REG_OFFSET, // reg => [addrReg + value]
+    INSTR_READ_REG_OFFSET,  // reg <= [addrReg + value]
+    INSTR_WRITE_REG_INDEX,  // reg => [addrReg + (indexReg << scale)], scale in op2
+    INSTR_READ_REG_INDEX,   // reg <= [addrReg + (indexReg << scale)], scale in op2
+    INSTR_SETCC,            // reg = condition ? 1 : 0, op2 = condition
+    INSTR_SELECT,           // dstReg = condition ? srcReg : dstReg, op2 = condition
+    INSTR_BIN_OP64,         // Rd:Xd = Rd:Xd ?? Rs:Xs, d = dstReg, s = srcReg, op2 = operator, shift count is Rs only
+    INSTR_BIN_OP64_CONST,   // Rd:Xd = Rd:Xd ?? (valueHigh << 32 | value), d = reg, op2 = operator
+    INSTR_CALL_HOST,        // value = host function index, arguments start at SP
+    INSTR_BFX,              // reg = bitSize bits of reg at bit value, op2 = 1 if sign extended
+    INSTR_BFI,              // bitSize bits of dstReg at bit value = low bits of srcReg
 
     INSTR_JUMP_COND_INSTR,
     INSTR_JUMP_INSTR,
@@ -56,6 +68,8 @@ export enum IRBinOpcode {
     BIN_OP_SAR = 0x3E,
     BIN_OP_DIV = 0x2F,
     BIN_OP_UDIV = 0x83,
+    BIN_OP_MOD = 0x25,  // 64-bit operations only
+    BIN_OP_UMOD = 0x84, // 64-bit operations only
     BIN_OP_CMP = 0xFF,
 };
 
@@ -82,11 +96,14 @@ export enum IRCmpOpcode {
 export enum RWOpcodeFlags {
     SIGNED = 0x80,
     BP = 0x40,
+    SAFE = 0x20, // Access proven to be in bounds, READ_CONST and WRITE_CONST only, see bounds.ts
     BITS_MASK = 0x03,
     BITS8 = 0x00,
     BITS16 = 0x01,
     BITS32 = 0x02,
     BITS64 = 0x03,
+    SCALE_MASK = 0x0C,
+    SCALE_SHIFT = 2,
 };
 
 export class ValueFunction {
@@ -103,6 +120,11 @@ export class ValueFunction {
     }
 }
 
+export interface SourceLine {
+    file: string;
+    line: number;
+}
+
 export interface Label {
     instruction?: IRInstruction;
     instructionOffset?: number;
@@ -115,6 +137,7 @@ interface IRInstructionBase {
     opcode: IROpcode;
     references?: SymbolBase[];
     addr?: number; // TODO: Clean it up
+    line?: SourceLine; // Source line that generated this instruction, shared by consecutive instructions
 };
 
 interface IREmptyInstruction extends IRInstructionBase {
@@ -134,6 +157,50 @@ interface IRTwoRegOpInstruction extends IRInstructionBase {
     op: number; // TODO: Split into two interfaces and use enums in op
 }
 
+interface IRTwoRegOp64Instruction extends IRInstructionBase {
+    opcode: IROpcode.INSTR_BIN_OP64;
+    dstReg: number;
+    srcReg: number;
+    op: IRBinOpcode;
+}
+
+interface IRConstOp64Instruction extends IRInstructionBase {
+    opcode: IROpcode.INSTR_BIN_OP64_CONST;
+    reg: number;
+    valueLow: number;
+    valueHigh: number;
+    op: IRBinOpcode;
+}
+
+interface IRBitFieldExtractInstruction extends IRInstructionBase {
+    opcode: IROpcode.INSTR_BFX;
+    reg: number;
+    position: number;
+    size: number;
+    signed: boolean;
+}
+
+interface IRBitFieldInsertInstruction extends IRInstructionBase {
+    opcode: IROpcode.INSTR_BFI;
+    dstReg: number;
+    srcReg: number;
+    position: number;
+    size: number;
+}
+
+interface IRSetCCInstruction extends IRInstructionBase {
+    opcode: IROpcode.INSTR_SETCC;
+    reg: number;
+    condition: number;
+}
+
+interface IRSelectInstruction extends IRInstructionBase {
+    opcode: IROpcode.INSTR_SELECT;
+    dstReg: number;
+    srcReg: number;
+    condition: number;
+}
+
 interface IRConstRWInstruction extends IRInstructionBase {
     opcode: IROpcode.INSTR_READ_CONST | IROpcode.INSTR_WRITE_CONST | IROpcode.INSTR_BIN_OP_CONST;
     reg: number;
@@ -142,14 +209,37 @@ interface IRConstRWInstruction extends IRInstructionBase {
 }
 
 interface IRWithValueInstruction extends IRInstructionBase {
-    opcode: IROpcode.INSTR_WORD | IROpcode.INSTR_CALL_CONST | IROpcode.INSTR_JUMP_CONST | IROpcode.INSTR_HOST | IROpcode.INSTR_POP_BLOCK_CONST | IROpcode.INSTR_NOOP;
+    opcode: IROpcode.INSTR_WORD | IROpcode.INSTR_CALL_CONST | IROpcode.INSTR_JUMP_CONST | IROpcode.INSTR_HOST | IROpcode.INSTR_CALL_HOST | IROpcode.INSTR_POP_BLOCK_CONST | IROpcode.INSTR_NOOP;
+    value: ValueFunction;
+}
+
+interface IRCountInstruction extends IRInstructionBase {
+    opcode: IROpcode.INSTR_COUNT;
     value: ValueFunction;
+    op: number;
 }
 
 interface IRRegRWInstruction extends IRInstructionBase {
     opcode: IROpcode.INSTR_READ_REG | IROpcode.INSTR_WRITE_REG;
     reg: number;
     addrReg: number;
+    op: number;
+}
+
+interface IRRegOffsetRWInstruction extends IRInstructionBase {
+    opcode: IROpcode.INSTR_READ_REG_OFFSET | IROpcode.INSTR_WRITE_REG_OFFSET;
+    reg: number;
+    addrReg: number;
+    value: ValueFunction;
+    op: number;
+}
+
+interface IRRegIndexRWInstruction extends IRInstructionBase {
+    opcode: IROpcode.INSTR_READ_REG_INDEX | IROpcode.INSTR_WRITE_REG_INDEX;
+    reg: number;
+    addrReg: number;
+    indexReg: number;
+    op: number; // Access size and scale, see RWOpcodeFlags
 }
 
 interface IRRegInstruction extends IRInstructionBase {
@@ -202,12 +292,14 @@ interface IRLabelCondInstruction extends IRInstructionBase {
     opcode: IROpcode.INSTR_JUMP_COND_LABEL;
     label: Label;
     condition: number;
+    hint?: number;
 };
 
 interface IRLabelCondInstrInstruction extends IRInstructionBase {
     opcode: IROpcode.INSTR_JUMP_COND_INSTR;
     instruction: IRInstruction;
     condition: number;
+    hint?: number;
 };
 
 interface IRLabelValueInstruction extends IRInstructionBase {
@@ -237,7 +329,9 @@ export type IRInstruction = IRTwoRegOpInstruction | IRPushBlockLabelInstruction
     | IRRegRWInstruction | IRTwoRegInstruction | IRRegValueInstruction | IREmptyInstruction
     | IRWithValueInstruction | IRDataInstruction | IRFillInstruction | IRLabelValueInstruction
     | IRAliasInstruction | IRPushBlockConstInstruction | IRLabelCondInstrInstruction
-    | IRJumpInstrInstruction | IRMarkerInstruction
+    | IRJumpInstrInstruction | IRMarkerInstruction | IRCountInstruction
+    | IRRegOffsetRWInstruction | IRRegIndexRWInstruction | IRSetCCInstruction | IRSelectInstruction
+    | IRTwoRegOp64Instruction | IRConstOp64Instruction | IRBitFieldExtractInstruction | IRBitFieldInsertInstruction
     ;
 
 
@@ -279,7 +373,9 @@ export class ImportSymbol extends SymbolBase {
 export class WithIRSymbol extends SymbolBase {
     public innerSymbols?: InnerSymbol[];
     public ir?: IRInstruction[];
+    public code?: IRCode; // Compact code, before it is expanded to ir
     public used: boolean = false;
+    public outputAddress?: number;
     public constructor(
         name: string,
         public section: Section,
@@ -292,6 +388,7 @@ export class WithIRSymbol extends SymbolBase {
 
 export class FunctionSymbol extends WithIRSymbol {
     declare public innerSymbols?: FunctionInnerSymbol[];
+    public paramsSize: number = 0; // Bytes of parameters after the frame header, from the prologue
 }
 
 export class DataSymbol extends WithIRSymbol {
@@ -342,6 +439,67 @@ export interface ExportEntry {
 // #endregion
 
 
+// #region Compact code
+
+/*
+ * Function code in the struct-of-arrays form, one entry per 12-byte instruction as generated
+ * by the compiler. Relocations and source lines are kept in sparse side tables. Functions stay
+ * in this form until they are known to be used, only then they are expanded to IRInstruction
+ * objects, see expand.ts. This keeps the heap small and the GC quiet for large programs,
+ * where most of the library code is never used.
+ */
+export class IRCode {
+
+    public readonly opcode: Uint8Array;
+    public readonly op2: Uint8Array;
+    public readonly reg: Uint8Array;    // also dstReg
+    public readonly srcReg: Uint8Array; // also addrReg
+    public readonly value: Uint32Array;
+    public readonly value2: Uint32Array;
+    public readonly relocations = new Map<number, SymbolBase>(); // instruction index => symbol added to value
+    public readonly lines = new Map<number, SourceLine>(); // instruction index => line starting there
+
+    /**
+     * @param source if given, the columns are views of 'length' instructions of 'source'
+     *               starting at 'begin', relocations and lines are not shared.
+     */
+    public constructor(
+        public readonly length: number,
+        source?: IRCode,
+        begin: number = 0,
+    ) {
+        let end = begin + length;
+        this.opcode = source ? source.opcode.subarray(begin, end) : new Uint8Array(length);
+        this.op2 = source ? source.op2.subarray(begin, end) : new Uint8Array(length);
+        this.reg = source ? source.reg.subarray(begin, end) : new Uint8Array(length);
+        this.srcReg = source ? source.srcReg.subarray(begin, end) : new Uint8Array(length);
+        this.value = source ? source.value.subarray(begin, end) : new Uint32Array(length);
+        this.value2 = source ? source.value2.subarray(begin, end) : new Uint32Array(length);
+    }
+
+    public subcode(begin: number, length: number): IRCode {
+        if (begin < 0 || begin + length > this.length) throw new Error('Code range out of bounds');
+        return new IRCode(length, this, begin);
+    }
+
+    public static decode(data: Uint8Array, offset: number, length: number): IRCode {
+        let code = new IRCode(length);
+        let view = new DataView(data.buffer, data.byteOffset, data.byteLength);
+        for (let i = 0; i < length; i++, offset += 12) {
+            code.opcode[i] = data[offset];
+            code.op2[i] = data[offset + 1];
+            code.reg[i] = data[offset + 2];
+            code.srcReg[i] = data[offset + 3];
+            code.value[i] = view.getUint32(offset + 4, true);
+            code.value2[i] = view.getUint32(offset + 8, true);
+        }
+        return code;
+    }
+}
+
+// #endregion
+
+
 // #region Section
 
 export enum RelocationType {
@@ -355,14 +513,15 @@ export interface Relocation {
 }
 
 export interface Section {
-    id: string;
+    id: number;
     index: number;
     name: string;
-    link: string | undefined;
-    reloc: string | undefined;
-    prev: string | undefined;
+    link: number | undefined;
+    reloc: number | undefined;
+    prev: number | undefined;
     size: number;
     data: Uint8Array | undefined;
+    code?: IRCode; // decoded contents of a code section, 'data' is released then
     addr: number;
     entsize: number;
     flags: number;
@@ -386,6 +545,8 @@ export const predefinedSymbols = {
     __ccvm_section_data_end__: false,
     __ccvm_section_bss_begin__: false,
     __ccvm_section_bss_end__: false,
+    __ccvm_section_profile_begin__: false,
+    __ccvm_section_profile_end__: false,
     __ccvm_section_stack_begin__: false,
     __ccvm_section_stack_end__: false,
     __ccvm_section_heap_begin__: false,
@@ -428,4 +589,15 @@ export function collectAliasedLabels(label: Label) {
     return [...all];
 }
 
+export function* getReferences(symbol: WithIRSymbol): Generator<SymbolBase> {
+    if (symbol.code) {
+        yield* symbol.code.relocations.values();
+    }
+    for (let instr of symbol.ir ?? []) {
+        if (instr.references) {
+            yield* instr.references;
+        }
+    }
+}
+
 // #endregion
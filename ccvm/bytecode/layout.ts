@@ -0,0 +1,116 @@
+import { AbsoluteSymbol, FunctionInnerSymbol, InnerSymbol, IRInstruction, IROpcode, SymbolBase, ValueFunction, WithIRSymbol } from './ir';
+
+/*
+ * Address assignment, "temporary output without shrinking" stage from ../doc/linking.md.
+ *
+ * Each instruction occupies 12 bytes, so the addresses are final only until the shrinking
+ * stage is implemented. Output address is stored in "outputAddress" of each used symbol
+ * and in "addr" of each instruction.
+ */
+
+export const DATA_MEMORY_BEGIN = 0x00000000;
+export const PROGRAM_MEMORY_BEGIN = 0x40000000;
+export const INSTRUCTION_SIZE = 12;
+
+export interface LayoutOptions {
+    stackSize: number;
+    heapSize: number;
+}
+
+export function assignAddresses(outputSymbols: WithIRSymbol[], options: LayoutOptions): void {
+    let address = DATA_MEMORY_BEGIN;
+    let dataBegin = 0;
+    let dataEnd = 0;
+    for (let symbol of outputSymbols) {
+        if (!symbol.used && (symbol.ir?.length || symbol.code)) continue; // Removed from the output
+        address = alignUp(address, getSymbolAlignment(symbol));
+        symbol.outputAddress = address;
+        for (let instr of symbol.ir ?? []) {
+            if (instr.opcode === IROpcode.INSTR_MARKER) {
+                switch (instr.marker) {
+                    case 'dataBegin':
+                        dataBegin = address;
+                        break;
+                    case 'dataEnd':
+                        dataEnd = address;
+                        break;
+                    case 'program':
+                        address = PROGRAM_MEMORY_BEGIN;
+                        break;
+                }
+            }
+            instr.addr = address;
+            address += getInstructionSize(instr, options, dataEnd - dataBegin);
+        }
+    }
+}
+
+/*
+ * Output address of a symbol after assignAddresses(). Undefined if the symbol is not placed
+ * in the output (removed, imported or undefined). Code labels follow their instruction,
+ * the functions may be reordered after parsing.
+ */
+export function getOutputAddress(symbol: SymbolBase): number | undefined {
+    if (symbol instanceof WithIRSymbol) {
+        return symbol.outputAddress;
+    } else if (symbol instanceof FunctionInnerSymbol) {
+        return symbol.instruction?.addr;
+    } else if (symbol instanceof InnerSymbol) {
+        let parent = symbol.parentSymbol.outputAddress;
+        return parent === undefined ? undefined : parent + symbol.parentOffset;
+    } else if (symbol instanceof AbsoluteSymbol) {
+        return symbol.address;
+    }
+    return undefined;
+}
+
+/* Final value with the relocation resolved, undefined if its symbol has no output address. */
+export function getOutputValue(value: ValueFunction): number | undefined {
+    if (value.relocation === undefined) {
+        return value.value;
+    }
+    let address = getOutputAddress(value.relocation);
+    return address === undefined ? undefined : (value.value + address) >>> 0;
+}
+
+function getInstructionSize(instr: IRInstruction, options: LayoutOptions, dataSize: number): number {
+    switch (instr.opcode) {
+        case IROpcode.INSTR_EMPTY:
+        case IROpcode.INSTR_LABEL_RELATIVE:
+        case IROpcode.INSTR_LABEL_ABSOLUTE:
+        case IROpcode.INSTR_LABEL_ALIAS:
+            return 0;
+        case IROpcode.INSTR_DATA:
+            return instr.data.length;
+        case IROpcode.INSTR_WORD:
+            return 4;
+        case IROpcode.INSTR_FILL:
+            return instr.size;
+        case IROpcode.INSTR_MARKER:
+            switch (instr.marker) {
+                case 'heap': return options.heapSize;
+                case 'stack': return options.stackSize;
+                case 'dataLoad': return dataSize;
+                default: return 0;
+            }
+        default:
+            return INSTRUCTION_SIZE;
+    }
+}
+
+function getSymbolAlignment(symbol: WithIRSymbol): number {
+    if (!symbol.ir?.length) {
+        return 1; // Section boundary symbols stay just after the previous symbol
+    } else if (symbol.ir.some(instr => instr.opcode === IROpcode.INSTR_MARKER)) {
+        return 4;
+    }
+    switch (symbol.addr & 3) {
+        case 0: return 4;
+        case 2: return 2;
+        default: return 1;
+    }
+}
+
+function alignUp(address: number, alignment: number): number {
+    return Math.ceil(address / alignment) * alignment;
+}
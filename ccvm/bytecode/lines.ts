@@ -0,0 +1,118 @@
+import * as fs from 'node:fs';
+import { FunctionSymbol, IROpcode, SourceLine, WithIRSymbol } from './ir';
+import { INSTRUCTION_SIZE } from './layout';
+import { Dict, newDict } from './utils';
+
+/*
+ * Program counter to source line table, written next to the output image for sampling
+ * profilers and debuggers, see ../doc/profiling.md. Lookup library for the host: ../host/ccvm-lines.h.
+ *
+ * All values are 32-bit little-endian words:
+ *
+ *   header:    "CCVMLINE", version, line entries count, function entries count, strings size
+ *   line:      address, file name offset, line number
+ *   function:  begin address, end address (exclusive), function name offset
+ *   strings:   zero-terminated strings, offsets are relative to the beginning of this part
+ *
+ * Line entries are sorted by address, each covers the range up to the next entry.
+ * Line number 0 means that there is no source information for the range.
+ * Function entries are sorted by address and they do not overlap.
+ */
+
+const MAGIC = 'CCVMLINE';
+const VERSION = 1;
+const HEADER_SIZE = 24;
+const ENTRY_SIZE = 12;
+
+interface LineEntry {
+    address: number;
+    file: number;
+    line: number;
+}
+
+interface FunctionEntry {
+    begin: number;
+    end: number;
+    name: number;
+}
+
+class StringTable {
+    private offsets: Dict<number> = newDict();
+    private parts: Uint8Array[] = [];
+    public size = 0;
+
+    public add(str: string): number {
+        if (this.offsets[str] === undefined) {
+            let bytes = new TextEncoder().encode(str + '\0');
+            this.offsets[str] = this.size;
+            this.parts.push(bytes);
+            this.size += bytes.length;
+        }
+        return this.offsets[str];
+    }
+
+    public write(output: Uint8Array, offset: number) {
+        for (let part of this.parts) {
+            output.set(part, offset);
+            offset += part.length;
+        }
+    }
+}
+
+export function writeLineTable(fileName: string, outputSymbols: WithIRSymbol[]): void {
+    let strings = new StringTable();
+    let noFile = strings.add('');
+    let lines: LineEntry[] = [];
+    let functions: FunctionEntry[] = [];
+
+    let addLine = (address: number, line: SourceLine | undefined) => {
+        let file = line ? strings.add(line.file) : noFile;
+        let lineNumber = line?.line ?? 0;
+        let last = lines[lines.length - 1];
+        if (last && last.address === address) {
+            lines.pop();
+            last = lines[lines.length - 1];
+        }
+        if (!last || last.file !== file || last.line !== lineNumber) {
+            lines.push({ address, file, line: lineNumber });
+        }
+    };
+
+    for (let symbol of outputSymbols) {
+        if (!(symbol instanceof FunctionSymbol) || !symbol.used || symbol.outputAddress === undefined) continue;
+        let end = symbol.outputAddress;
+        for (let instr of symbol.ir ?? []) {
+            if (instr.opcode === IROpcode.INSTR_EMPTY || instr.addr === undefined) continue;
+            addLine(instr.addr, instr.line);
+            end = instr.addr + INSTRUCTION_SIZE;
+        }
+        if (end > symbol.outputAddress) {
+            functions.push({ begin: symbol.outputAddress, end, name: strings.add(symbol.name) });
+            addLine(end, undefined);
+        }
+    }
+
+    let size = HEADER_SIZE + ENTRY_SIZE * (lines.length + functions.length) + strings.size;
+    let output = new Uint8Array(size);
+    let view = new DataView(output.buffer);
+    output.set(new TextEncoder().encode(MAGIC), 0);
+    view.setUint32(8, VERSION, true);
+    view.setUint32(12, lines.length, true);
+    view.setUint32(16, functions.length, true);
+    view.setUint32(20, strings.size, true);
+    let offset = HEADER_SIZE;
+    for (let entry of lines) {
+        view.setUint32(offset, entry.address, true);
+        view.setUint32(offset + 4, entry.file, true);
+        view.setUint32(offset + 8, entry.line, true);
+        offset += ENTRY_SIZE;
+    }
+    for (let entry of functions) {
+        view.setUint32(offset, entry.begin, true);
+        view.setUint32(offset + 4, entry.end, true);
+        view.setUint32(offset + 8, entry.name, true);
+        offset += ENTRY_SIZE;
+    }
+    strings.write(output, offset);
+    fs.writeFileSync(fileName, output);
+}
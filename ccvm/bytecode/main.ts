@@ -1,6 +1,13 @@
 import { dumpIRFromSymbols } from "./dump";
-import { AbsoluteSymbol, DataSymbol, ExportEntry, FunctionInnerSymbol, FunctionSymbol, ImportSymbol, InnerSymbol, IRInstruction, IRMarkerInstruction, IROpcode, PredefinedSymbols, Section, SymbolBase, ValueFunction, WithIRSymbol } from "./ir";
+import { AbsoluteSymbol, DataSymbol, ExportEntry, FunctionInnerSymbol, FunctionSymbol, getReferences, ImportSymbol, InnerSymbol, IRInstruction, IRMarkerInstruction, IROpcode, PredefinedSymbols, Section, SymbolBase, ValueFunction, WithIRSymbol } from "./ir";
 import { Parser } from "./parser";
+import { reorderBlocks } from "./blocks";
+import { Profile } from "./profile";
+import { assignAddresses } from "./layout";
+import { writeLineTable } from "./lines";
+import { verifySafeAccesses } from "./bounds";
+import { expandCode } from "./expand";
+import { verifyProgram, VerifyResult } from "./verify";
 
 
 const sectionsNameRegExp = {
@@ -10,6 +17,7 @@ const sectionsNameRegExp = {
     bss: /^\.(bss|common)(\..*)?$/,
     stack: /^\.ccvm\.stack(\..*)?$/,
     heap: /^\.ccvm\.heap(\..*)?$/,
+    profile: /^\.(ccvm\.profile|tcov)$/,
     entry: /^\.text\.ccvm\.entry(\..*)?$/,
     text: /^\.text(\..*)?$/,
     init: /^\.init_array(\..+)?$/,
@@ -18,6 +26,8 @@ const sectionsNameRegExp = {
     removed: /.*/,
 };
 
+const coldSectionRegExp = /^\.text\.(unlikely|exit)(\..*)?$/;
+
 type OutputSections = { [key in keyof typeof sectionsNameRegExp]: WithIRSymbol[] };
 
 class SymbolOrganizer {
@@ -27,11 +37,14 @@ class SymbolOrganizer {
     private minHeapSize: number;
     private anySection: Section | undefined;
     private traveled!: Set<WithIRSymbol>;
+    public outputSymbols!: WithIRSymbol[];
+    public verifyResult!: VerifyResult;
 
     constructor(
         private symbols: SymbolBase[],
         private predefinedSymbols: PredefinedSymbols,
         private exports: ExportEntry[],
+        private profile?: Profile,
     ) { }
 
     public organize() {
@@ -61,6 +74,7 @@ class SymbolOrganizer {
 
             } else if (symbol instanceof ImportSymbol) {
 
+                // Direct calls use CALL_HOST, the wrapper is needed for calls through a pointer
                 let wrapper = new FunctionSymbol(symbol.name, symbol.section, 0, 0);
                 wrapper.ir = [
                     {
@@ -110,8 +124,9 @@ class SymbolOrganizer {
         this.usedSection([exportTableSymbol]);
         this.usedSection(this.outputSections.init);
         this.usedSection(this.outputSections.fini);
+        this.usedSection(this.outputSections.profile);
 
-        let outputSymbols = [
+        let outputSymbols = this.outputSymbols = [
             this.predefinedSymbols.__ccvm_section_registers_begin__,
             ...sortSymbols(this.outputSections.registers, false),
             this.predefinedSymbols.__ccvm_section_registers_end__,
@@ -119,6 +134,9 @@ class SymbolOrganizer {
             this.predefinedSymbols.__ccvm_section_data_begin__,
             this.createMarker('dataBegin'),
             ...sortSymbols(this.outputSections.data, true),
+            this.predefinedSymbols.__ccvm_section_profile_begin__,
+            ...sortSymbols(this.outputSections.profile, false),
+            this.predefinedSymbols.__ccvm_section_profile_end__,
             this.createMarker('dataEnd'),
             this.predefinedSymbols.__ccvm_section_data_end__,
 
@@ -158,7 +176,7 @@ class SymbolOrganizer {
             this.predefinedSymbols.__ccvm_section_fini_end__,
 
             this.predefinedSymbols.__ccvm_section_text_begin__,
-            ...sortSymbols(this.outputSections.text, false),
+            ...sortTextSymbols(this.outputSections.text, this.profile, this.findRunOnceFunctions()),
             this.predefinedSymbols.__ccvm_section_text_end__,
 
             this.predefinedSymbols.__ccvm_load_section_data_begin__,
@@ -168,6 +186,18 @@ class SymbolOrganizer {
 
         this.findUsedSymbols(outputSymbols);
 
+        // Only used functions are expanded from the compact code
+        for (let symbol of this.outputSections.text) {
+            if (symbol instanceof FunctionSymbol && symbol.used) {
+                expandCode(symbol);
+                reorderBlocks(symbol);
+            }
+        }
+
+        verifySafeAccesses(outputSymbols);
+        assignAddresses(outputSymbols, { stackSize: this.minStackSize, heapSize: this.minHeapSize });
+        this.verifyResult = verifyProgram(outputSymbols);
+
         dumpIRFromSymbols(outputSymbols, true);
         console.log('===========================\n    REMOVED\n===========================');
         dumpIRFromSymbols(this.outputSections.removed, true);
@@ -187,22 +217,30 @@ class SymbolOrganizer {
         while (toTravel.length > 0) {
             let symbol = toTravel.pop()!;
             symbol.used = true;
-            for (let instr of symbol.ir ?? []) {
-                if (instr.references) {
-                    for (let ref of instr.references) {
-                        if (ref instanceof WithIRSymbol && !done.has(ref)) {
-                            toTravel.push(ref);
-                            done.add(ref);
-                        } else if (ref instanceof InnerSymbol && !done.has(ref.parentSymbol)) {
-                            toTravel.push(ref.parentSymbol);
-                            done.add(ref.parentSymbol);
-                        }
-                    }
+            for (let ref of getReferences(symbol)) {
+                if (ref instanceof WithIRSymbol && !done.has(ref)) {
+                    toTravel.push(ref);
+                    done.add(ref);
+                } else if (ref instanceof InnerSymbol && !done.has(ref.parentSymbol)) {
+                    toTravel.push(ref.parentSymbol);
+                    done.add(ref.parentSymbol);
                 }
             }
         }
     }
 
+    private findRunOnceFunctions(): Set<WithIRSymbol> {
+        let result = new Set<WithIRSymbol>();
+        for (let symbol of [...this.outputSections.init, ...this.outputSections.fini]) {
+            for (let ref of getReferences(symbol)) {
+                if (ref instanceof FunctionSymbol) {
+                    result.add(ref);
+                }
+            }
+        }
+        return result;
+    }
+
     usedSection(symbols: WithIRSymbol[]) {
         for (let symbol of symbols) {
             symbol.used = true;
@@ -233,10 +271,48 @@ class SymbolOrganizer {
 }
 
 
+function parseCommandLine(args: string[]) {
+    let result = {
+        input: '../bin/sample.bin',
+        profile: undefined as string | undefined,
+        lines: undefined as string | undefined,
+        verify: false,
+    };
+    for (let i = 0; i < args.length; i++) {
+        if (args[i] === '--profile' && i + 1 < args.length) {
+            result.profile = args[++i];
+        } else if (args[i] === '--lines' && i + 1 < args.length) {
+            result.lines = args[++i];
+        } else if (args[i] === '--verify') {
+            result.verify = true;
+        } else if (args[i].startsWith('-') && args[i] !== '-') {
+            throw new Error(`Unknown option "${args[i]}".`);
+        } else {
+            result.input = args[i];
+        }
+    }
+    return result;
+}
+
+
+let options = parseCommandLine(process.argv.slice(2));
+let profile = options.profile ? Profile.load(options.profile) : undefined;
 let parser = new Parser();
-let { symbols, predefinedSymbols, exports } = parser.parse('../bin/sample.bin');
-let org = new SymbolOrganizer(symbols, predefinedSymbols, exports);
+let { symbols, predefinedSymbols, exports } = parser.parse(options.input === '-' ? process.stdin.fd : options.input);
+let org = new SymbolOrganizer(symbols, predefinedSymbols, exports, profile);
 org.organize();
+if (options.lines) {
+    writeLineTable(options.lines, org.outputSymbols);
+}
+// Reports the verification of this link, it does not read a linked image
+if (options.verify) {
+    let { verified, errors, indirectJumps } = org.verifyResult;
+    for (let message of errors) {
+        console.error(`Verification failed: ${message}`);
+    }
+    console.log(`Program ${verified ? 'verified' : 'not verified'}, ${indirectJumps} indirect jumps and calls left for the VM to check.`);
+    if (!verified) process.exitCode = 1;
+}
 
 
 function sortSymbols(symbols: WithIRSymbol[], sortByAlignment: boolean): WithIRSymbol[] {
@@ -245,6 +321,36 @@ function sortSymbols(symbols: WithIRSymbol[], sortByAlignment: boolean): WithIRS
 }
 
 
+/*
+ * Without a profile, functions are sorted the same way as any other symbols. With a profile,
+ * functions that were called are placed first, most frequently called at the beginning,
+ * so the hot code occupies as few program memory pages as possible. Functions not present
+ * in the profile keep their default order. Functions that were never called, run-once
+ * initializers and finalizers, and functions from ".text.unlikely" and ".text.exit"
+ * sections go to the end.
+ */
+function sortTextSymbols(symbols: WithIRSymbol[], profile: Profile | undefined, runOnce: Set<WithIRSymbol>): WithIRSymbol[] {
+    symbols.sort(compare);
+    if (!profile) {
+        return symbols;
+    }
+    let hot: WithIRSymbol[] = [];
+    let neutral: WithIRSymbol[] = [];
+    let cold: WithIRSymbol[] = [];
+    for (let symbol of symbols) {
+        let count = profile.getFunctionCount(symbol.name);
+        if (count === 0 || runOnce.has(symbol) || coldSectionRegExp.test(symbol.section.name)) {
+            cold.push(symbol);
+        } else if (count !== undefined) {
+            hot.push(symbol);
+        } else {
+            neutral.push(symbol);
+        }
+    }
+    hot.sort((a, b) => (profile.getFunctionCount(b.name)! - profile.getFunctionCount(a.name)!) || compare(a, b));
+    return [...hot, ...neutral, ...cold];
+}
+
 function compareWithAlignment(a: WithIRSymbol, b: WithIRSymbol): number {
     let res = compareSectionNames(a.section.name, b.section.name);
     if (res !== 0) return res;
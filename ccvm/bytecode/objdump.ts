@@ -0,0 +1,236 @@
+import { dumpIR } from './dump';
+import { expandCode } from './expand';
+import { FunctionSymbol, IRBinOpcode, IRCode, IROpcode, SymbolBase } from './ir';
+import { INSTRUCTION_SIZE } from './layout';
+import { Parser } from './parser';
+
+/*
+ * Inspection of the linker input (output of "ccvm-tcc" linking, see ../doc/linking.md).
+ *
+ *   objdump.ts disasm <input> [<function>...]
+ *       Disassembles all functions, or only the given ones.
+ *
+ *   objdump.ts size [--sort name|size|relocs] <input>
+ *       Bytes, instructions and relocations of each function, relocation density
+ *       is the number of relocations per 100 instructions.
+ *
+ *   objdump.ts opcodes <input>
+ *       Static opcode histogram of all functions, arithmetic by operator.
+ *
+ *   objdump.ts diff <old input> <new input>
+ *       Functions that changed size, totals and changes in the opcode histogram.
+ *
+ * Sizes are before the shrinking stage, i.e. each instruction takes 12 bytes. Label
+ * pseudo-instructions and instructions removed by the compiler are not counted.
+ */
+
+interface FunctionInfo {
+    name: string;
+    instructions: number;
+    relocations: number;
+    opcodes: Map<string, number>;
+}
+
+function main(args: string[]) {
+    let [command, ...rest] = args;
+    switch (command) {
+        case 'disasm': {
+            let [input, ...names] = rest;
+            if (!input) usage();
+            disassemble(input, names);
+            break;
+        }
+        case 'size': {
+            let sort = 'size';
+            let input: string | undefined;
+            for (let i = 0; i < rest.length; i++) {
+                if (rest[i] === '--sort' && i + 1 < rest.length) {
+                    sort = rest[++i];
+                } else {
+                    input = rest[i];
+                }
+            }
+            if (!input || !['name', 'size', 'relocs'].includes(sort)) usage();
+            reportSize(analyze(input), sort);
+            break;
+        }
+        case 'opcodes': {
+            let [input] = rest;
+            if (!input) usage();
+            reportOpcodes(analyze(input));
+            break;
+        }
+        case 'diff': {
+            let [oldInput, newInput] = rest;
+            if (!oldInput || !newInput) usage();
+            reportDiff(analyze(oldInput), analyze(newInput));
+            break;
+        }
+        default:
+            usage();
+    }
+}
+
+function usage(): never {
+    throw new Error('Usage: objdump.ts disasm <input> [<function>...]\n'
+        + '       objdump.ts size [--sort name|size|relocs] <input>\n'
+        + '       objdump.ts opcodes <input>\n'
+        + '       objdump.ts diff <old input> <new input>');
+}
+
+function loadFunctions(input: string): FunctionSymbol[] {
+    let { symbols } = new Parser().parse(input);
+    return symbols.filter((symbol: SymbolBase): symbol is FunctionSymbol =>
+        symbol instanceof FunctionSymbol && symbol.code !== undefined);
+}
+
+function disassemble(input: string, names: string[]) {
+    for (let symbol of loadFunctions(input)) {
+        if (names.length > 0 && !names.includes(symbol.name)) continue;
+        expandCode(symbol);
+        console.log(`${symbol.name}:  # ${symbol.section.name}`);
+        dumpIR(symbol.ir, '    ');
+        console.log();
+    }
+}
+
+function isPseudo(code: IRCode, index: number): boolean {
+    switch (code.opcode[index]) {
+        case IROpcode.INSTR_LABEL_RELATIVE:
+        case IROpcode.INSTR_LABEL_ABSOLUTE:
+        case IROpcode.INSTR_LABEL_ALIAS:
+            return true;
+        case IROpcode.INSTR_NOOP:
+            return code.value[index] === 0 && !code.relocations.has(index);
+        default:
+            return false;
+    }
+}
+
+function getOpcodeName(code: IRCode, index: number): string {
+    let opcode = code.opcode[index];
+    let name = IROpcode[opcode]?.substring(6) ?? `0x${opcode.toString(16)}`;
+    if (opcode === IROpcode.INSTR_BIN_OP || opcode === IROpcode.INSTR_BIN_OP_CONST) {
+        let operator = IRBinOpcode[code.op2[index]]?.substring(7) ?? `0x${code.op2[index].toString(16)}`;
+        name += ` ${operator}`;
+    }
+    return name;
+}
+
+/* Static functions may have the same name, they get a "#n" suffix in the input order. */
+function analyze(input: string): Map<string, FunctionInfo> {
+    let result = new Map<string, FunctionInfo>();
+    for (let symbol of loadFunctions(input)) {
+        let code = symbol.code!;
+        let name = symbol.name;
+        for (let n = 2; result.has(name); n++) {
+            name = `${symbol.name}#${n}`;
+        }
+        let info: FunctionInfo = { name, instructions: 0, relocations: code.relocations.size, opcodes: new Map() };
+        for (let i = 0; i < code.length; i++) {
+            if (isPseudo(code, i)) continue;
+            let opcode = getOpcodeName(code, i);
+            info.instructions++;
+            info.opcodes.set(opcode, (info.opcodes.get(opcode) ?? 0) + 1);
+        }
+        result.set(name, info);
+    }
+    return result;
+}
+
+function density(relocations: number, instructions: number): string {
+    return instructions > 0 ? (100 * relocations / instructions).toFixed(1) : '-';
+}
+
+function reportSize(functions: Map<string, FunctionInfo>, sort: string) {
+    let list = [...functions.values()];
+    switch (sort) {
+        case 'name':
+            list.sort((a, b) => a.name.localeCompare(b.name, 'en'));
+            break;
+        case 'size':
+            list.sort((a, b) => (b.instructions - a.instructions) || a.name.localeCompare(b.name, 'en'));
+            break;
+        case 'relocs':
+            list.sort((a, b) => (b.relocations - a.relocations) || a.name.localeCompare(b.name, 'en'));
+            break;
+    }
+    let instructions = 0;
+    let relocations = 0;
+    console.log(`${'bytes'.padStart(10)}${'instr'.padStart(10)}${'relocs'.padStart(10)}${'density'.padStart(10)}  function`);
+    for (let info of list) {
+        console.log(`${(INSTRUCTION_SIZE * info.instructions).toString().padStart(10)}${info.instructions.toString().padStart(10)}`
+            + `${info.relocations.toString().padStart(10)}${density(info.relocations, info.instructions).padStart(10)}  ${info.name}`);
+        instructions += info.instructions;
+        relocations += info.relocations;
+    }
+    console.log(`${(INSTRUCTION_SIZE * instructions).toString().padStart(10)}${instructions.toString().padStart(10)}`
+        + `${relocations.toString().padStart(10)}${density(relocations, instructions).padStart(10)}  total (${list.length} functions)`);
+}
+
+function sumOpcodes(functions: Map<string, FunctionInfo>): Map<string, number> {
+    let result = new Map<string, number>();
+    for (let info of functions.values()) {
+        for (let [opcode, count] of info.opcodes) {
+            result.set(opcode, (result.get(opcode) ?? 0) + count);
+        }
+    }
+    return result;
+}
+
+function reportOpcodes(functions: Map<string, FunctionInfo>) {
+    let opcodes = sumOpcodes(functions);
+    let total = [...opcodes.values()].reduce((sum, count) => sum + count, 0);
+    console.log(`${'count'.padStart(10)}${'%'.padStart(8)}  opcode`);
+    for (let [opcode, count] of [...opcodes].sort((a, b) => (b[1] - a[1]) || a[0].localeCompare(b[0], 'en'))) {
+        console.log(`${count.toString().padStart(10)}${(100 * count / total).toFixed(1).padStart(8)}  ${opcode}`);
+    }
+    console.log(`${total.toString().padStart(10)}${'100.0'.padStart(8)}  total`);
+}
+
+function formatDelta(delta: number): string {
+    return delta > 0 ? `+${delta}` : `${delta}`;
+}
+
+function reportDiff(oldFunctions: Map<string, FunctionInfo>, newFunctions: Map<string, FunctionInfo>) {
+    let names = new Set([...oldFunctions.keys(), ...newFunctions.keys()]);
+    let changes: { name: string, oldSize: number, newSize: number }[] = [];
+    let oldTotal = 0;
+    let newTotal = 0;
+    for (let name of names) {
+        let oldSize = INSTRUCTION_SIZE * (oldFunctions.get(name)?.instructions ?? 0);
+        let newSize = INSTRUCTION_SIZE * (newFunctions.get(name)?.instructions ?? 0);
+        oldTotal += oldSize;
+        newTotal += newSize;
+        if (oldSize !== newSize || oldFunctions.has(name) !== newFunctions.has(name)) {
+            changes.push({ name, oldSize, newSize });
+        }
+    }
+    changes.sort((a, b) => (Math.abs(b.newSize - b.oldSize) - Math.abs(a.newSize - a.oldSize)) || a.name.localeCompare(b.name, 'en'));
+
+    console.log(`${'old'.padStart(10)}${'new'.padStart(10)}${'delta'.padStart(10)}  function`);
+    for (let { name, oldSize, newSize } of changes) {
+        let note = !oldFunctions.has(name) ? ' (added)' : !newFunctions.has(name) ? ' (removed)' : '';
+        console.log(`${oldSize.toString().padStart(10)}${newSize.toString().padStart(10)}`
+            + `${formatDelta(newSize - oldSize).padStart(10)}  ${name}${note}`);
+    }
+    console.log(`${oldTotal.toString().padStart(10)}${newTotal.toString().padStart(10)}`
+        + `${formatDelta(newTotal - oldTotal).padStart(10)}  total`);
+    console.log();
+
+    let oldOpcodes = sumOpcodes(oldFunctions);
+    let newOpcodes = sumOpcodes(newFunctions);
+    let opcodes = [...new Set([...oldOpcodes.keys(), ...newOpcodes.keys()])]
+        .map(opcode => ({ opcode, oldCount: oldOpcodes.get(opcode) ?? 0, newCount: newOpcodes.get(opcode) ?? 0 }))
+        .filter(({ oldCount, newCount }) => oldCount !== newCount)
+        .sort((a, b) => (Math.abs(b.newCount - b.oldCount) - Math.abs(a.newCount - a.oldCount)) || a.opcode.localeCompare(b.opcode, 'en'));
+    if (opcodes.length > 0) {
+        console.log(`${'old'.padStart(10)}${'new'.padStart(10)}${'delta'.padStart(10)}  opcode`);
+        for (let { opcode, oldCount, newCount } of opcodes) {
+            console.log(`${oldCount.toString().padStart(10)}${newCount.toString().padStart(10)}`
+                + `${formatDelta(newCount - oldCount).padStart(10)}  ${opcode}`);
+        }
+    }
+}
+
+main(process.argv.slice(2));
@@ -1,8 +1,8 @@
 
 
 import * as fs from 'node:fs';
-import { AbsoluteSymbol, collectAliasedLabels, DataSymbol, ExportEntry, FunctionInnerSymbol, FunctionSymbol, ImportSymbol, InnerSymbol, InvalidSymbol, IRInstruction, IROpcode, Label, PredefinedSymbols, predefinedSymbols, Relocation, RelocationType, RWOpcodeFlags, Section, SymbolBase, UndefinedSymbol, ValueFunction, WithIRSymbol } from './ir';
-import { Dict, error, newDict, replaceObjectContent, warning } from './utils';
+import { AbsoluteSymbol, DataSymbol, ExportEntry, FunctionInnerSymbol, FunctionSymbol, ImportSymbol, InnerSymbol, InvalidSymbol, IRCode, IRInstruction, IROpcode, PredefinedSymbols, predefinedSymbols, Relocation, RelocationType, RWOpcodeFlags, Section, SourceLine, SymbolBase, UndefinedSymbol, ValueFunction, WithIRSymbol } from './ir';
+import { Dict, error, newDict, warning } from './utils';
 import { dumpIRFromSymbols } from './dump';
 
 const SHN_LORESERVE = 0xff00;
@@ -11,7 +11,14 @@ const RELOCATION_MAX_SIZE = 12;
 
 const exportSectionRegExp = /^\.ccvm\.export\.([0-9]+)\.(.+)$/;
 const importSectionRegExp = /^\.ccvm\.import\.([0-9]+)\.(.+)$/;
-const initFiniSectionRegExp = /^\.(init|fini)_array(\..+)?$/;
+const wholeSectionRegExp = /^(\.(init|fini)_array(\..+)?|\.ccvm\.profile|\.tcov)$/;
+
+// Stabs entry types used for line information, see ../../stab.def
+const N_FUN = 0x24;
+const N_SLINE = 0x44;
+const N_SO = 0x64;
+const N_SOL = 0x84;
+const STAB_ENTRY_SIZE = 12;
 
 export enum SymbolBinding {
     LOCAL = 0,
@@ -54,27 +61,64 @@ function getSymbolKind(section: Section): SymbolKind {
     }
 }
 
+/*
+ * Sequential reader of the input file. It does not seek, so it also works with pipes.
+ * Each section is read into its own buffer. Code sections are decoded and their buffer
+ * is dropped before the next section is read, see Parser.readSections(), the other
+ * buffers are kept until the end of parsing, see Parser.releaseSectionData().
+ */
+class SectionReader {
+
+    private scratch = new Uint8Array(64 * 1024);
+
+    constructor(private fd: number) { }
+
+    /**
+     * Fill the buffer with the next bytes from the input.
+     * @param allowEof if true, return false on end of input before the first byte.
+     */
+    public read(buffer: Uint8Array, allowEof: boolean = false): boolean {
+        let offset = 0;
+        while (offset < buffer.length) {
+            let count = fs.readSync(this.fd, buffer, offset, buffer.length - offset, null);
+            if (count === 0) {
+                if (offset === 0 && allowEof) return false;
+                throw new Error('Corrupted input file.');
+            }
+            offset += count;
+        }
+        return true;
+    }
+
+    public skip(size: number): void {
+        while (size > 0) {
+            let chunk = this.scratch.subarray(0, Math.min(size, this.scratch.length));
+            this.read(chunk);
+            size -= chunk.length;
+        }
+    }
+}
+
 export class Parser {
 
     private sections!: Section[];
-    private sectionById!: Dict<Section>;
+    private sectionById!: Map<number, Section>;
     private sectionByIndex!: Section[];
     private symtab!: Section;
     private strtab!: Section;
-    private initFiniSections: Section[];
+    private wholeSections: Section[];
     private exports!: ExportEntry[];
     private imports!: ImportSymbol[];
     private importByName!: Dict<ImportSymbol>;
     private strings!: string;
     private symbols!: SymbolBase[];
     private predefinedSymbols!: PredefinedSymbols;
-    private labels: Label[] = [];
     private customSectionIndex: number | undefined;
 
-    public parse(fileName: string): { symbols: SymbolBase[], predefinedSymbols: PredefinedSymbols, exports: ExportEntry[] } {
+    public parse(input: string | number): { symbols: SymbolBase[], predefinedSymbols: PredefinedSymbols, exports: ExportEntry[] } {
 
         this.sections = [];
-        this.sectionById = newDict();
+        this.sectionById = new Map();
         this.sectionByIndex = [];
         this.exports = [];
         this.imports = [];
@@ -84,16 +128,16 @@ export class Parser {
         this.customSectionIndex = undefined;
 
         this.createPredefinedSymbols();
-        this.readSections(fileName);
+        this.readSections(input);
         this.findSpecialSections();
         this.parseStrtab();
         this.parseSymtab();
-        this.createInitFiniSymbols();
+        this.createWholeSectionSymbols();
         this.findInnerSymbols();
         this.generateIR();
         //dumpIRFromSymbols(this.symbols);
-        this.resolveLabels();
-        //dumpIRFromSymbols(this.symbols);
+        this.assignSourceLines();
+        this.releaseSectionData();
         return {
             symbols: this.symbols,
             predefinedSymbols: this.predefinedSymbols,
@@ -101,6 +145,18 @@ export class Parser {
         };
     }
 
+    /*
+     * Drops the section contents, everything is parsed at this point: symbols, strings,
+     * relocations and source lines are in their own objects. Data symbols keep views of their
+     * section in INSTR_DATA, so only those buffers stay alive. Code sections were already
+     * released by readSections().
+     */
+    private releaseSectionData() {
+        for (let section of this.sections) {
+            section.data = undefined;
+        }
+    }
+
     private createPredefinedSymbols() {
         let section = this.createSection({ name: '$predefined_symbols_section' });
         this.predefinedSymbols = {} as any;
@@ -110,15 +166,19 @@ export class Parser {
     }
 
     private findInnerSymbols() {
-        let symbolsBySection = newDict<WithIRSymbol[]>();
+        let symbolsBySection = new Map<Section, WithIRSymbol[]>();
         let replacements = new Map<SymbolBase, SymbolBase>();
         for (let symbol of this.symbols) {
             if (symbol instanceof WithIRSymbol) {
-                symbolsBySection[symbol.section.id] = symbolsBySection[symbol.section.id] ?? [];
-                symbolsBySection[symbol.section.id].push(symbol);
+                let list = symbolsBySection.get(symbol.section);
+                if (!list) {
+                    list = [];
+                    symbolsBySection.set(symbol.section, list);
+                }
+                list.push(symbol);
             }
         }
-        for (let symbols of Object.values(symbolsBySection)) {
+        for (let symbols of symbolsBySection.values()) {
             let currentSymbol: WithIRSymbol | undefined = undefined;
             symbols.sort((a, b) => {
                 if (a.addr === b.addr) return b.size - a.size;
@@ -147,95 +207,90 @@ export class Parser {
         }
     }
 
-    private createInitFiniSymbols() {
-        for (let section of this.initFiniSections) {
-            let symbol = new DataSymbol(`_ccvm_init_fini_auto_${section.name}`, section, 0, section.size);
+    private createWholeSectionSymbols() {
+        for (let section of this.wholeSections) {
+            let symbol = new DataSymbol(`_ccvm_section_auto_${section.name}`, section, 0, section.size);
             symbol.indexes.push(this.symbols.length);
             this.symbols.push(symbol);
         }
     }
 
-    private resolveLabels() {
-        for (let symbol of this.symbols) {
-            if (symbol instanceof WithIRSymbol && symbol.ir) {
-                this.resolveLabelsInIR(symbol.ir);
-            }
+    /*
+     * Assigns source lines to instructions using stabs generated by the compiler with "-g".
+     * Each instruction gets the line of the nearest preceding line entry in the same function,
+     * so the information stays valid when the instructions are later moved or duplicated.
+     */
+    private assignSourceLines() {
+        let stab = this.sections.find(section => section.name === '.stab');
+        let stabstr = this.sections.find(section => section.name === '.stabstr');
+        if (!stab?.data || !stabstr?.data) {
+            return;
         }
-    }
-
-    private resolveLabelsInIR(ir: IRInstruction[]) {
-        for (let instr of ir) {
-
-            switch (instr.opcode) {
-
-                case IROpcode.INSTR_JUMP_LABEL:
-                    instr.label = this.resolveLabel(ir, instr.label);
-                    if (instr.label.instruction === undefined) throw new Error('Absolute label address not allowed in JUMP instructions');
-                    replaceObjectContent<IRInstruction>(instr, {
-                        opcode: IROpcode.INSTR_JUMP_INSTR,
-                        instruction: instr.label.instruction,
-                    });
-                    break;
+        stab.known = true;
+        stabstr.known = true;
+        let decoder = new TextDecoder();
+        let getStabString = (offset: number): string => {
+            let end = stabstr!.data!.indexOf(0, offset);
+            if (offset >= stabstr!.data!.length || end < 0) throw new Error('Invalid stabs string reference.');
+            return decoder.decode(stabstr!.data!.subarray(offset, end));
+        };
+        let relocations = this.getRelocations(stab);
+        let view = new DataView(stab.data.buffer, stab.data.byteOffset, stab.data.byteLength);
+        let directory = '';
+        let fileName = '';
+        let lines = new Map<string, SourceLine>();
+        let func: FunctionSymbol | undefined = undefined;
+        let funcLines: SourceLine[] = [];
+
+        let flushFunction = () => {
+            if (func?.code) {
+                for (let [index, line] of funcLines.entries()) {
+                    if (line) func.code.lines.set(index, line);
+                }
+            }
+            func = undefined;
+            funcLines = [];
+        };
 
-                case IROpcode.INSTR_JUMP_COND_LABEL:
-                    instr.label = this.resolveLabel(ir, instr.label);
-                    if (instr.label.instruction === undefined) throw new Error('Absolute label address not allowed in JUMP instructions');
-                    replaceObjectContent<IRInstruction>(instr, {
-                        opcode: IROpcode.INSTR_JUMP_COND_INSTR,
-                        instruction: instr.label.instruction,
-                        condition: instr.condition,
-                    });
+        for (let offset = 0; offset + STAB_ENTRY_SIZE <= view.byteLength; offset += STAB_ENTRY_SIZE) {
+            let strx = view.getUint32(offset, true);
+            let type = view.getUint8(offset + 4);
+            let desc = view.getUint16(offset + 6, true);
+            let value = view.getUint32(offset + 8, true);
+            switch (type) {
+                case N_SO:
+                case N_SOL: {
+                    let name = strx ? getStabString(strx) : '';
+                    if (type === N_SO && name.endsWith('/')) {
+                        directory = name;
+                    } else if (name !== '') {
+                        fileName = name.startsWith('/') || directory === '' ? name : directory + name;
+                    }
                     break;
-
-                case IROpcode.INSTR_PUSH_BLOCK_LABEL:
-                    instr.label = this.resolveLabel(ir, instr.label);
-                    if (instr.label.absoluteValue === undefined) throw new Error('Relative label address not allowed in PUSH_BLOCK instruction');
-                    if (instr.optional && instr.label.absoluteValue === 0) {
-                        replaceObjectContent<IRInstruction>(instr, {
-                            opcode: IROpcode.INSTR_EMPTY
-                        });
-                    } else {
-                        replaceObjectContent<IRInstruction>(instr, {
-                            opcode: IROpcode.INSTR_PUSH_BLOCK_CONST,
-                            optional: instr.optional,
-                            reg: instr.reg,
-                            value: new ValueFunction(instr.label.absoluteValue),
-                        });
+                }
+                case N_FUN: {
+                    flushFunction();
+                    let symbol = relocations[offset + 8]?.symbol;
+                    if (strx && getStabString(strx) !== '' && symbol instanceof FunctionSymbol) {
+                        func = symbol;
                     }
                     break;
-
-                case IROpcode.INSTR_LABEL_RELATIVE:
-                case IROpcode.INSTR_LABEL_ABSOLUTE:
-                case IROpcode.INSTR_LABEL_ALIAS:
-                    replaceObjectContent<IRInstruction>(instr, {
-                        opcode: IROpcode.INSTR_EMPTY,
-                    });
+                }
+                case N_SLINE: {
+                    if (!func?.code) break;
+                    let index = Math.min(Math.floor(value / 12), func.code.length - 1);
+                    let key = `${desc}:${fileName}`;
+                    let line = lines.get(key);
+                    if (!line) {
+                        line = { file: fileName, line: desc };
+                        lines.set(key, line);
+                    }
+                    funcLines[index] = line;
                     break;
+                }
             }
         }
-    }
-
-    private resolveLabel(ir: IRInstruction[], label: Label): Label {
-        let all = collectAliasedLabels(label);
-        let definitions = all.filter(label =>
-            label.instruction !== undefined
-            || label.instructionOffset !== undefined
-            || label.absoluteValue !== undefined
-        );
-        let main = definitions[0];
-        if (definitions.length < 1) {
-            throw new Error('Undefined label.');
-        } else if (definitions.length > 1) {
-            throw new Error('Multiple definitions of the same label.');
-        } else if (main.absoluteValue !== undefined || main.instruction !== undefined) {
-            return main;
-        } else if (main.instructionOffset! < 0 || main.instructionOffset! >= ir.length) {
-            throw new Error('Invalid label instruction offset.');
-        } else {
-            main.instruction = ir[main.instructionOffset!];
-            delete main.instructionOffset;
-            return main;
-        }
+        flushFunction();
     }
 
     private createSection(options: Partial<Section>): Section {
@@ -245,7 +300,7 @@ export class Parser {
         let index = this.customSectionIndex;
         this.customSectionIndex++;
         return {
-            id: `custom_section_${index}`, name: `.__ccvm_custom_section_${index}`, index,
+            id: -1 - index, name: `.__ccvm_custom_section_${index}`, index,
             link: undefined, reloc: undefined, prev: undefined,
             size: 0, data: new Uint8Array(),
             addr: 0, entsize: 0, flags: 0, info: 0, type: 1,
@@ -259,7 +314,7 @@ export class Parser {
         this.symtab = this.createSection({ name: '.symtab', entsize: 16, type: 2 });
         this.strtab = this.createSection({ name: '.strtab', entsize: 0, type: 3, size: 1, data: new Uint8Array([0]) });
 
-        this.initFiniSections = [];
+        this.wholeSections = [];
         let m: RegExpMatchArray | null;
         for (let section of this.sections) {
             if (section.name === '.symtab') {
@@ -289,8 +344,8 @@ export class Parser {
                 let symbol = new ImportSymbol(name, index, section);
                 this.imports[index] = symbol;
                 this.importByName[name] = symbol;
-            } else if (section.name.match(initFiniSectionRegExp)) {
-                this.initFiniSections.push(section);
+            } else if (section.name.match(wholeSectionRegExp)) {
+                this.wholeSections.push(section);
             }
         }
     }
@@ -302,64 +357,86 @@ export class Parser {
         return this.strings.substring(offset, end);
     }
 
-    private readSections(fileName: string): void {
+    private readSections(input: string | number): void {
 
         let decoder = new TextDecoder('ascii');
-        let file = fs.readFileSync(fileName) as Uint8Array;
-        let view = new DataView(file.buffer, file.byteOffset, file.byteLength);
-        let offset = 0;
-
-        while (offset < file.length) {
-
-            if (offset + 72 > file.length) throw new Error('Corrupted input file.');
-            let id = view.getBigUint64(offset + 0, true);      // uint64_t id;
-            let link = view.getBigUint64(offset + 8, true);    // uint64_t link;
-            let reloc = view.getBigUint64(offset + 16, true);  // uint64_t reloc;
-            let prev = view.getBigUint64(offset + 24, true);   // uint64_t prev;
-            let size = view.getUint32(offset + 32, true);      // uint32_t size;
-            let data_size = view.getUint32(offset + 36, true); // uint32_t data_size;
-            let addr = view.getUint32(offset + 40, true);      // uint32_t addr;
-            let entsize = view.getUint32(offset + 44, true);   // uint32_t entsize;
-            let flags = view.getUint32(offset + 48, true);     // uint32_t flags;
-            let info = view.getUint32(offset + 52, true);      // uint32_t info;
-            let type = view.getUint32(offset + 56, true);      // uint32_t type;
-            let name_len = view.getUint32(offset + 60, true);  // uint32_t name_len;
-            let index = view.getUint32(offset + 64, true);     // uint32_t index;
-            // uint32_t _reserved, 68
-            offset += 72;
-
-            if (id === 0n) {
-                if (offset !== file.length) throw new Error('Corrupted input file.');
-                break;
+        let fd = typeof input === 'number' ? input : fs.openSync(input, 'r');
+        let reader = new SectionReader(fd);
+        let header = new Uint8Array(72);
+        let view = new DataView(header.buffer);
+        let ids = new Map<bigint, number>();
+
+        // Sections are referenced by 64-bit ids, intern them to small numbers
+        let internId = (value: bigint): number => {
+            let id = ids.get(value);
+            if (id === undefined) {
+                id = ids.size + 1;
+                ids.set(value, id);
             }
+            return id;
+        };
 
-            if (offset + name_len > file.length) throw new Error('Corrupted input file.');
-            let name = decoder.decode(file.slice(offset, offset + name_len));
-            offset += name_len;
+        try {
+            while (reader.read(header, true)) {
+
+                let id = view.getBigUint64(0, true);       // uint64_t id;
+                let link = view.getBigUint64(8, true);     // uint64_t link;
+                let reloc = view.getBigUint64(16, true);   // uint64_t reloc;
+                let prev = view.getBigUint64(24, true);    // uint64_t prev;
+                let size = view.getUint32(32, true);       // uint32_t size;
+                let data_size = view.getUint32(36, true);  // uint32_t data_size;
+                let addr = view.getUint32(40, true);       // uint32_t addr;
+                let entsize = view.getUint32(44, true);    // uint32_t entsize;
+                let flags = view.getUint32(48, true);      // uint32_t flags;
+                let info = view.getUint32(52, true);       // uint32_t info;
+                let type = view.getUint32(56, true);       // uint32_t type;
+                let name_len = view.getUint32(60, true);   // uint32_t name_len;
+                let index = view.getUint32(64, true);      // uint32_t index;
+                // uint32_t _reserved, 68
+
+                if (id === 0n) {
+                    if (reader.read(new Uint8Array(1), true)) throw new Error('Corrupted input file.');
+                    break;
+                }
 
-            if (offset + data_size > file.length) throw new Error('Corrupted input file.');
-            let data: Uint8Array | undefined;
-            if (data_size !== size) {
-                data = undefined;
-            } else {
-                data = file.slice(offset, offset + data_size);
+                let nameBytes = new Uint8Array(name_len);
+                reader.read(nameBytes);
+                let name = decoder.decode(nameBytes);
+
+                let data: Uint8Array | undefined;
+                if (data_size !== size) {
+                    reader.skip(data_size);
+                    data = undefined;
+                } else {
+                    data = new Uint8Array(data_size);
+                    reader.read(data);
+                }
+
+                let section: Section = {
+                    id: internId(id),
+                    index, name,
+                    link: link !== 0n ? internId(link) : undefined,
+                    reloc: reloc !== 0n ? internId(reloc) : undefined,
+                    prev: prev !== 0n ? internId(prev) : undefined,
+                    size, data, addr, entsize, flags, info, type,
+                    known: false,
+                };
+
+                // Functions take views of the decoded columns, so the bytes are not needed
+                if (data && data.byteLength % 12 === 0 && getSymbolKind(section) === SymbolKind.FUNCTION) {
+                    section.code = IRCode.decode(data, 0, data.byteLength / 12);
+                    section.data = undefined;
+                }
+
+                this.sections.push(section);
             }
-            offset += data_size;
-
-            this.sections.push({
-                id: id.toString(16).padStart(16, '0'),
-                index, name,
-                link: link !== 0n ? link.toString(16).padStart(16, '0') : undefined,
-                reloc: reloc !== 0n ? reloc.toString(16).padStart(16, '0') : undefined,
-                prev: prev !== 0n ? prev.toString(16).padStart(16, '0') : undefined,
-                size, data, addr, entsize, flags, info, type,
-                known: false,
-            });
+        } finally {
+            if (fd !== input) fs.closeSync(fd);
         }
 
         for (let section of this.sections) {
-            if (this.sectionById[section.id]) throw new Error(`Repeating section id ${section.id}`);
-            this.sectionById[section.id] = section;
+            if (this.sectionById.has(section.id)) throw new Error(`Repeating section id ${section.id}`);
+            this.sectionById.set(section.id, section);
             if (this.sectionByIndex[section.index]) throw new Error(`Repeating section index ${section.index}`);
             this.sectionByIndex[section.index] = section;
         }
@@ -482,7 +559,7 @@ export class Parser {
             // Find relocations section
             let reloc: Section | undefined = undefined;
             if (section.reloc) {
-                reloc = this.sectionById[section.reloc];
+                reloc = this.sectionById.get(section.reloc);
                 if (!reloc) throw new Error('Invalid relocation section index.');
             } else {
                 for (let sec of this.sections) {
@@ -526,199 +603,29 @@ export class Parser {
     }
 
     generateFunctionIR(symbol: FunctionSymbol) {
-        let innerByAddr = new Map<number, FunctionInnerSymbol>();
         for (let inner of symbol.innerSymbols ?? []) {
             if (inner.parentOffset < 0 || inner.parentOffset > symbol.size || inner.parentOffset % 12 !== 0) {
                 throw new Error(`Invalid inner symbol "${inner.name}" offset for function "${symbol.name}"`);
             }
-            innerByAddr.set(inner.parentOffset, inner);
         }
-        this.labels.splice(0);
-        let ir: IRInstruction[] = [];
-        //console.log('>>', symbol.name);
         let relocations = this.getRelocationsInRange(symbol.section, symbol.addr, symbol.size);
-        let data = symbol.section.data;
-        if (!data) throw new Error(`No bits generated for symbol ${symbol.name}`); // todo: normal error
-        let view = new DataView(data.buffer, data.byteOffset, data.byteLength);
-        if (data.byteLength % 12 != 0) throw new Error(`Invalid size of function ${symbol.name}`); // todo: normal error
-        for (let funcOffset = 0; funcOffset < symbol.size; funcOffset += 12) {
-            let relocation: Relocation | undefined = undefined;
-            if (relocations[funcOffset]) {
-                relocation = relocations[funcOffset];
-                if (relocation.type !== RelocationType.INSTR) throw new Error(`Invalid relocation type in function ${symbol.name}`);
-            }
-            if (relocations[funcOffset + 4]) {
-                if (relocation) throw new Error(`Two relocations in the same instruction in function ${symbol.name}`);
-                if (relocations[funcOffset + 4].type !== RelocationType.DATA) throw new Error(`Invalid relocation type in function ${symbol.name}`);
-                relocation = {
-                    type: RelocationType.INSTR,
-                    symbol: relocations[funcOffset + 4].symbol,
-                };
-            }
-            for (let i of [/* 0, */ 1, 2, 3, /* 4, */ 5, 6, 7, 8, 9, 10, 11]) {
-                if (relocations[funcOffset + i]) throw new Error(`Invalid relocation position in function ${symbol.name}`);
-            }
-            let instr = this.generateInstruction(symbol, view, funcOffset, relocation);
-            ir.push(instr);
-            if (innerByAddr.has(funcOffset)) {
-                let inner = innerByAddr.get(funcOffset)!;
-                inner.instruction = instr;
-            }
-        }
-        symbol.ir = ir;
-    }
-
-    generateInstruction(symbol: FunctionSymbol, view: DataView, funcOffset: number, relocation: Relocation | undefined): IRInstruction {
-        let secOffset = symbol.addr + funcOffset;
-        let opcode = view.getUint8(secOffset);
-        let op2 = view.getUint8(secOffset + 1);
-        let reg = view.getUint8(secOffset + 2);
-        let dstReg = reg;
-        let srcReg = view.getUint8(secOffset + 3);
-        let addrReg = srcReg;
-        let uintValue = view.getUint32(secOffset + 4, true);
-        let uintValue2 = view.getUint32(secOffset + 8, true);
-        let value: ValueFunction;
-        let references: SymbolBase[] | undefined = undefined;
-
-        if (relocation) {
-            value = new ValueFunction(uintValue, relocation.symbol);
-            references = [relocation.symbol];
-        } else {
-            value = new ValueFunction(uintValue);
-        }
-
-        switch (opcode) {
-
-            case IROpcode.INSTR_MOV_REG:          // dstReg = srcReg
-                this.noRelocation(relocation);
-                return { opcode, references, dstReg, srcReg };
-
-            case IROpcode.INSTR_PUSH_BLOCK_REG:          // dstReg = BLOCK of srcReg bytes
-                this.noRelocation(relocation);
-                return { opcode, references, dstReg, srcReg };
-
-            case IROpcode.INSTR_NOOP:
-                return { opcode, references, value };
-
-            case IROpcode.INSTR_MOV_CONST:        // reg = value
-                return { opcode, references, reg, value };
-
-            case IROpcode.INSTR_LABEL_RELATIVE: {   // label, address_offset
-                this.noRelocation(relocation);
-                let label = this.getLabel(uintValue);
-                let address = (uintValue2 + funcOffset) & 0xFFFFFFFF;
-                if (address % 12 !== 0) throw new Error(`Invalid label address ${address}`);
-                if (address < 0) throw new Error('Label offset out of range');
-                if (address > symbol.size) throw new Error('Label offset out of range');
-                label.instructionOffset = address / 12;
-                return { opcode, references, label, value: address };
-            }
-
-            case IROpcode.INSTR_LABEL_ABSOLUTE: {   // label, address_offset
-                this.noRelocation(relocation);
-                let label = this.getLabel(uintValue);
-                label.absoluteValue = uintValue2;
-                return { opcode, references, label, value: uintValue2 };
-            }
-
-            case IROpcode.INSTR_WRITE_CONST:      // reg => [value]
-            case IROpcode.INSTR_READ_CONST:       // reg <= [value]
-                return { opcode, references, reg, value, op: op2 }
-
-            case IROpcode.INSTR_WRITE_REG:        // reg => [addrReg]
-            case IROpcode.INSTR_READ_REG:         // reg <= [addrReg]
-                this.noRelocation(relocation);
-                return { opcode, references, reg, addrReg };
-
-            case IROpcode.INSTR_JUMP_COND_LABEL:  // label, op2 = condition
-                this.noRelocation(relocation);
-                return { opcode, references, label: this.getLabel(uintValue), condition: op2 };
-
-            case IROpcode.INSTR_JUMP_CONST:       // address
-            case IROpcode.INSTR_CALL_CONST:       // address
-                return { opcode, references, value };
-
-            case IROpcode.INSTR_JUMP_LABEL:       // label
-                this.noRelocation(relocation);
-                return { opcode, references, label: this.getLabel(uintValue) };
-
-            case IROpcode.INSTR_JUMP_REG:         // reg
-            case IROpcode.INSTR_CALL_REG:         // reg
-                this.noRelocation(relocation);
-                return { opcode, references, reg };
-
-            case IROpcode.INSTR_PUSH:             // reg, op2 = 1..4 bytes
-                this.noRelocation(relocation);
-                return { opcode, references, reg, bytes: op2 as any };
-
-            case IROpcode.INSTR_POP:             // reg, op2 = 1..4 bytes
-                this.noRelocation(relocation);
-                return { opcode, references, reg, bytes: op2 as any };
-
-            case IROpcode.INSTR_PUSH_BLOCK_CONST: // reg, value = block size
-                return { opcode, references, reg, value, optional: op2 !== 0 };
-
-            case IROpcode.INSTR_PUSH_BLOCK_LABEL: // reg, label = label containing block size
-                this.noRelocation(relocation);
-                return { opcode, references, reg, label: this.getLabel(uintValue), optional: op2 !== 0 };
-
-            case IROpcode.INSTR_BIN_OP:           // srcReg, dstReg, op2 = operator
-                this.noRelocation(relocation);
-                return { opcode, references, dstReg, srcReg, op: op2 };
-
-            case IROpcode.INSTR_BIN_OP_CONST:
-                return { opcode, references, reg, value, op: op2 };
-
-            case IROpcode.INSTR_RETURN:           //
-                return { opcode, references }
-
-            case IROpcode.INSTR_HOST:           //
-                return { opcode, references, value }
-
-            case IROpcode.INSTR_POP_BLOCK_CONST:           //
-                return { opcode, references, value }
-
-            case IROpcode.INSTR_LABEL_ALIAS: {      // labelAlias = label
-                this.noRelocation(relocation);
-                let label1 = this.getLabel(uintValue);
-                let label2 = this.getLabel(uintValue2);
-                if (!label1.aliases) label1.aliases = [];
-                if (!label2.aliases) label2.aliases = [];
-                label1.aliases.push(label2);
-                label2.aliases.push(label1);
-                return { opcode, references, label1, label2 };
-            }
-
-            case IROpcode.INSTR_DATA: {
-                this.noRelocation(relocation);
-                let v = new DataView(new ArrayBuffer(8));
-                v.setUint32(0, uintValue, true);
-                v.setUint32(4, uintValue2, true);
-                return { opcode, references, data: new Uint8Array(v.buffer, 0, Math.min(8, op2)) };
+        let section = symbol.section;
+        if (!section.code && !section.data) throw new Error(`No bits generated for symbol ${symbol.name}`); // todo: normal error
+        if (!section.code || symbol.addr % 12 !== 0 || symbol.size % 12 !== 0) throw new Error(`Invalid size of function ${symbol.name}`); // todo: normal error
+        let code = section.code.subcode(symbol.addr / 12, symbol.size / 12);
+        relocations.forEach((relocation, funcOffset) => {
+            if (funcOffset % 12 === 0 && relocation.type === RelocationType.INSTR) {
+                code.relocations.set(funcOffset / 12, relocation.symbol);
+            } else if (funcOffset % 12 === 4 && relocation.type === RelocationType.DATA) {
+                if (relocations[funcOffset - 4]) throw new Error(`Two relocations in the same instruction in function ${symbol.name}`);
+                code.relocations.set((funcOffset - 4) / 12, relocation.symbol);
+            } else if (funcOffset % 12 === 0 || funcOffset % 12 === 4) {
+                throw new Error(`Invalid relocation type in function ${symbol.name}`);
+            } else {
+                throw new Error(`Invalid relocation position in function ${symbol.name}`);
             }
-
-            case IROpcode.INSTR_WORD:
-                return { opcode, references, value };
-
-            case IROpcode.INSTR_FILL:
-                this.noRelocation(relocation);
-                return { opcode, references, size: uintValue };
-
-            default:
-                throw new Error(`Unknown IR opcode ${opcode}`);
-        }
-    }
-
-    getLabel(labelIndex: number): Label {
-        if (!this.labels[labelIndex]) {
-            this.labels[labelIndex] = {};
-        }
-        return this.labels[labelIndex];
-    }
-
-    private noRelocation(relocation: Relocation | undefined) {
-        if (relocation) throw new Error('Relocation in instruction not supporting relocations.');
+        });
+        symbol.code = code;
     }
 
     generateDataIR(symbol: DataSymbol) {
@@ -736,7 +643,7 @@ export class Parser {
                 if (data) {
                     ir.push({
                         opcode: IROpcode.INSTR_DATA,
-                        data: data.slice(offset, relAddr),
+                        data: data.subarray(offset, relAddr),
                     });
                 } else {
                     ir.push({
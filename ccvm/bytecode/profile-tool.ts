@@ -0,0 +1,104 @@
+import * as fs from 'node:fs';
+import { CoverageBlock, decodeCoverage } from './coverage';
+import { Profile } from './profile';
+
+/*
+ * Profile files utility, see ../doc/profiling.md.
+ *
+ *   profile-tool.ts decode <output profile> <section dump>...
+ *       Converts raw ".ccvm.profile" section dumps passed to the host
+ *       into a text profile. Counts from multiple runs are added.
+ *
+ *   profile-tool.ts merge <output profile> <input profile>...
+ *       Adds counts from multiple text profiles.
+ *
+ *   profile-tool.ts report [--top <n>] [--tcov <tcov dump>]... <input profile>...
+ *       Prints hot spots: most frequently called functions, most frequently
+ *       taken jumps and, with "--tcov", most frequently executed source lines.
+ */
+
+const DEFAULT_TOP = 20;
+
+function main(args: string[]) {
+    let [command, ...rest] = args;
+    switch (command) {
+        case 'decode':
+        case 'merge': {
+            let [output, ...inputs] = rest;
+            if (!output || inputs.length === 0) usage();
+            let profile = new Profile();
+            for (let input of inputs) {
+                profile.merge(command === 'decode' ? Profile.decode(fs.readFileSync(input)) : Profile.load(input));
+            }
+            profile.save(output);
+            break;
+        }
+        case 'report': {
+            let top = DEFAULT_TOP;
+            let profile = new Profile();
+            let coverage: CoverageBlock[] = [];
+            for (let i = 0; i < rest.length; i++) {
+                if (rest[i] === '--top' && i + 1 < rest.length) {
+                    top = parseInt(rest[++i]);
+                } else if (rest[i] === '--tcov' && i + 1 < rest.length) {
+                    coverage = coverage.concat(decodeCoverage(fs.readFileSync(rest[++i])));
+                } else {
+                    profile.merge(Profile.load(rest[i]));
+                }
+            }
+            report(profile, coverage, top);
+            break;
+        }
+        default:
+            usage();
+    }
+}
+
+function usage(): never {
+    throw new Error('Usage: profile-tool.ts decode|merge <output profile> <input>...\n'
+        + '       profile-tool.ts report [--top <n>] [--tcov <tcov dump>]... <input profile>...');
+}
+
+function report(profile: Profile, coverage: CoverageBlock[], top: number) {
+
+    let functions = Object.entries(profile.functions)
+        .sort((a, b) => b[1] - a[1])
+        .slice(0, top);
+    if (functions.length > 0) {
+        console.log('Most frequently called functions:');
+        console.log(`${'calls'.padStart(12)}  function`);
+        for (let [name, count] of functions) {
+            console.log(`${count.toString().padStart(12)}  ${name}`);
+        }
+        console.log();
+    }
+
+    let jumps: { name: string, index: number, taken: number, fallthrough: number }[] = [];
+    for (let [name, edges] of Object.entries(profile.edges)) {
+        for (let [index, edge] of edges.entries()) {
+            if (edge && edge.taken > 0) jumps.push({ name, index, ...edge });
+        }
+    }
+    jumps.sort((a, b) => b.taken - a.taken);
+    if (jumps.length > 0) {
+        console.log('Most frequently taken conditional jumps:');
+        console.log(`${'taken'.padStart(12)}${'not taken'.padStart(12)}  function:branch`);
+        for (let jump of jumps.slice(0, top)) {
+            console.log(`${jump.taken.toString().padStart(12)}${jump.fallthrough.toString().padStart(12)}  ${jump.name}:${jump.index}`);
+        }
+        console.log();
+    }
+
+    let blocks = coverage.filter(block => block.count > 0).sort((a, b) => b.count - a.count);
+    if (blocks.length > 0) {
+        console.log('Most frequently executed lines:');
+        console.log(`${'count'.padStart(12)}  location`);
+        for (let block of blocks.slice(0, top)) {
+            let lines = block.firstLine === block.lastLine ? `${block.firstLine}` : `${block.firstLine}-${block.lastLine}`;
+            console.log(`${block.count.toString().padStart(12)}  ${block.fileName}:${lines} (${block.functionName})`);
+        }
+        console.log();
+    }
+}
+
+main(process.argv.slice(2));
@@ -0,0 +1,146 @@
+import * as fs from 'node:fs';
+import { Dict, newDict, warning } from './utils';
+
+/*
+ * Execution profile of a guest program.
+ *
+ * Text file, one record per line, empty lines and lines starting with "#" are ignored:
+ *
+ *   func <function name> <call count>
+ *   edge <function name> <branch index> <taken count> <fallthrough count>
+ *
+ * Unknown record kinds are skipped with a warning, so newer profiles can be still used
+ * by older linkers. The "edge" records are also read by the compiler ("-fprofile-use").
+ */
+
+export interface EdgeCounts {
+    taken: number;
+    fallthrough: number;
+}
+
+enum ProfileRecordKind {
+    FUNC = 1,
+    EDGE = 2,
+    CALLS = 3,
+}
+
+export class Profile {
+
+    public functions: Dict<number> = newDict();
+    public edges: Dict<EdgeCounts[]> = newDict();
+
+    public static load(fileName: string): Profile {
+        let profile = new Profile();
+        let lines = fs.readFileSync(fileName, 'utf-8').split(/\r?\n/);
+        for (let [i, line] of lines.entries()) {
+            line = line.trim();
+            if (line === '' || line.startsWith('#')) continue;
+            let parts = line.split(/\s+/);
+            switch (parts[0]) {
+                case 'func':
+                    if (parts.length !== 3) throw new Error(`${fileName}:${i + 1}: Invalid function record.`);
+                    profile.addFunctionCount(parts[1], parseCount(fileName, i, parts[2]));
+                    break;
+                case 'edge':
+                    if (parts.length !== 5) throw new Error(`${fileName}:${i + 1}: Invalid edge record.`);
+                    profile.addEdgeCounts(parts[1], parseCount(fileName, i, parts[2]),
+                        parseCount(fileName, i, parts[3]), parseCount(fileName, i, parts[4]));
+                    break;
+                default:
+                    warning(`${fileName}:${i + 1}: Unknown profile record "${parts[0]}", skipping.`);
+                    break;
+            }
+        }
+        return profile;
+    }
+
+    /*
+     * Decodes content of the ".ccvm.profile" section passed to the host by
+     * "__ccvm_store_profile()" with kind 1 when the guest program exits.
+     */
+    public static decode(data: Uint8Array): Profile {
+        let profile = new Profile();
+        let view = new DataView(data.buffer, data.byteOffset, data.byteLength);
+        let decoder = new TextDecoder();
+        let funcName: string | undefined = undefined;
+        let offset = 0;
+        while (offset + 4 <= data.length) {
+            let header = view.getUint32(offset, true);
+            let arg = header >>> 8;
+            offset += 4;
+            switch (header & 0xFF) {
+                case ProfileRecordKind.FUNC:
+                    if (offset + arg > data.length) throw new Error('Corrupted profile data.');
+                    funcName = decoder.decode(data.subarray(offset, offset + arg));
+                    offset += (arg + 3) & ~3;
+                    break;
+                case ProfileRecordKind.EDGE: {
+                    if (offset + 8 > data.length || funcName === undefined) throw new Error('Corrupted profile data.');
+                    let executed = view.getUint32(offset, true);
+                    let fallthrough = view.getUint32(offset + 4, true);
+                    offset += 8;
+                    if (fallthrough > executed) throw new Error(`Corrupted profile data of "${funcName}".`);
+                    profile.addEdgeCounts(funcName, arg, executed - fallthrough, fallthrough);
+                    break;
+                }
+                case ProfileRecordKind.CALLS:
+                    if (offset + 4 > data.length || funcName === undefined) throw new Error('Corrupted profile data.');
+                    profile.addFunctionCount(funcName, view.getUint32(offset, true));
+                    offset += 4;
+                    break;
+                default:
+                    throw new Error(`Unknown profile record kind ${header & 0xFF}.`);
+            }
+        }
+        return profile;
+    }
+
+    public save(fileName: string): void {
+        let lines: string[] = [];
+        for (let [name, count] of Object.entries(this.functions)) {
+            lines.push(`func ${name} ${count}`);
+        }
+        for (let [name, edges] of Object.entries(this.edges)) {
+            for (let [index, edge] of edges.entries()) {
+                if (edge) lines.push(`edge ${name} ${index} ${edge.taken} ${edge.fallthrough}`);
+            }
+        }
+        fs.writeFileSync(fileName, lines.join('\n') + '\n');
+    }
+
+    public merge(other: Profile): void {
+        for (let [name, count] of Object.entries(other.functions)) {
+            this.addFunctionCount(name, count);
+        }
+        for (let [name, edges] of Object.entries(other.edges)) {
+            for (let [index, edge] of edges.entries()) {
+                if (edge) this.addEdgeCounts(name, index, edge.taken, edge.fallthrough);
+            }
+        }
+    }
+
+    public getFunctionCount(name: string): number | undefined {
+        return this.functions[name];
+    }
+
+    public getEdgeCounts(name: string, index: number): EdgeCounts | undefined {
+        return this.edges[name]?.[index];
+    }
+
+    private addFunctionCount(name: string, count: number) {
+        this.functions[name] = (this.functions[name] ?? 0) + count;
+    }
+
+    private addEdgeCounts(name: string, index: number, taken: number, fallthrough: number) {
+        let edges = this.edges[name] = this.edges[name] ?? [];
+        let edge = edges[index] = edges[index] ?? { taken: 0, fallthrough: 0 };
+        edge.taken += taken;
+        edge.fallthrough += fallthrough;
+    }
+}
+
+function parseCount(fileName: string, lineIndex: number, text: string): number {
+    let count = parseInt(text);
+    if (count.toString() !== text || count < 0) throw new Error(`${fileName}:${lineIndex + 1}: Invalid counter value "${text}".`);
+    return count;
+}
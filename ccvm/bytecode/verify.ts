@@ -0,0 +1,278 @@
+import { FunctionInnerSymbol, FunctionSymbol, IRInstruction, IROpcode, RWOpcodeFlags, WithIRSymbol } from './ir';
+import { getOutputValue } from './layout';
+
+/*
+ * Verification of the linked program, so the VM can drop per-instruction checks. It runs
+ * after assignAddresses(), so the relocated values are checked with their final addresses.
+ *
+ * For each used function, the verifier proves that:
+ *
+ *   - all instructions are VM instructions (no unresolved labels or pseudo-instructions),
+ *   - all register indexes are 0..7, 0..3 for the Rn:Xn pairs of the 64-bit operations,
+ *   - jumps target an instruction of the same function,
+ *   - direct calls and jumps to other symbols target the first instruction of a used function
+ *     or an instruction inside it,
+ *   - the stack depth is the same on each path to an instruction and PUSH/POP/PUSH_BLOCK/
+ *     POP_BLOCK never pop the saved BP and return address,
+ *   - SP, PC and BP registers are not written with memory access instructions with
+ *     a constant address, relocated addresses included,
+ *   - BP relative writes do not touch the saved BP and return address.
+ *
+ * Indirect jumps and calls (JUMP_REG, CALL_REG) are not covered, the VM still checks
+ * their targets. Writes through a register may reach the frame header, so the VM also
+ * checks the return address on RETURN. Stack depth of code reachable only indirectly
+ * (computed goto) is assumed to be the depth just after the prologue, as tcc emits it
+ * only at the statement level. Functions with dynamic stack allocation (VLA, alloca)
+ * cannot be verified.
+ *
+ * The result is only reported by "main.ts --verify", nothing is stored in the program,
+ * see ../doc/linking.md.
+ */
+
+const REGISTER_COUNT = 8;
+const REGISTER_PAIR_COUNT = 4; // Rn:Xn, Xn is register n + 4
+const SP_ADDR = 8 * 4;
+const BP_ADDR = 10 * 4; // PC is between SP and BP
+const FRAME_HEADER_SIZE = 8; // saved BP and return address at BP + 0
+
+export interface VerifyResult {
+    verified: boolean;
+    errors: string[];
+    indirectJumps: number;
+}
+
+export function verifyProgram(outputSymbols: WithIRSymbol[]): VerifyResult {
+    let result: VerifyResult = { verified: true, errors: [], indirectJumps: 0 };
+    for (let symbol of outputSymbols) {
+        if (!(symbol instanceof FunctionSymbol) || !symbol.used || !symbol.ir) continue;
+        new FunctionVerifier(symbol, result).verify();
+    }
+    result.verified = result.errors.length === 0;
+    return result;
+}
+
+class FunctionVerifier {
+
+    private index = new Map<IRInstruction, number>();
+    private depth: (number | undefined)[] = [];
+
+    public constructor(
+        private symbol: FunctionSymbol,
+        private result: VerifyResult,
+    ) {
+        for (let [i, instr] of symbol.ir!.entries()) {
+            this.index.set(instr, i);
+        }
+    }
+
+    public verify(): void {
+        let ir = this.symbol.ir!;
+        let errorCount = this.result.errors.length;
+        for (let instr of ir) {
+            this.verifyInstruction(instr);
+        }
+        if (this.result.errors.length === errorCount) {
+            this.verifyStack(ir);
+        }
+    }
+
+    private error(message: string): void {
+        this.result.errors.push(`${this.symbol.name}: ${message}`);
+    }
+
+    private verifyInstruction(instr: IRInstruction): void {
+        let count = instr.opcode === IROpcode.INSTR_BIN_OP64 || instr.opcode === IROpcode.INSTR_BIN_OP64_CONST
+            ? REGISTER_PAIR_COUNT : REGISTER_COUNT;
+        for (let reg of getRegisters(instr)) {
+            if (!(reg >= 0 && reg < count)) {
+                this.error(`register index ${reg} out of range in ${IROpcode[instr.opcode]}`);
+            }
+        }
+        switch (instr.opcode) {
+            case IROpcode.INSTR_JUMP_INSTR:
+            case IROpcode.INSTR_JUMP_COND_INSTR:
+                if (!this.index.has(instr.instruction)) {
+                    this.error('jump outside the function');
+                }
+                break;
+            case IROpcode.INSTR_JUMP_CONST:
+            case IROpcode.INSTR_CALL_CONST:
+                if (!this.isCodeTarget(instr.value.relocation, instr.value.value)) {
+                    this.error(`${IROpcode[instr.opcode]} target is not an instruction of a used function`);
+                }
+                break;
+            case IROpcode.INSTR_JUMP_REG:
+            case IROpcode.INSTR_CALL_REG:
+                this.result.indirectJumps++;
+                break;
+            case IROpcode.INSTR_WRITE_CONST: {
+                let size = 1 << (instr.op & RWOpcodeFlags.BITS_MASK);
+                if (instr.op & RWOpcodeFlags.BP) {
+                    let offset = instr.value.value | 0;
+                    if (instr.value.relocation) {
+                        this.error('BP relative write with a relocated offset');
+                    } else if (offset < FRAME_HEADER_SIZE && offset + size > 0) {
+                        this.error('saved BP or return address written');
+                    }
+                } else {
+                    let begin = getOutputValue(instr.value);
+                    if (begin === undefined) {
+                        this.error('write to a symbol without an output address');
+                    } else if (begin < BP_ADDR + 4 && begin + size > SP_ADDR) {
+                        this.error('SP, PC or BP register written directly');
+                    }
+                }
+                break;
+            }
+            case IROpcode.INSTR_PUSH_BLOCK_REG:
+                this.error('dynamic stack allocation');
+                break;
+            case IROpcode.INSTR_JUMP_LABEL:
+            case IROpcode.INSTR_JUMP_COND_LABEL:
+            case IROpcode.INSTR_PUSH_BLOCK_LABEL:
+            case IROpcode.INSTR_LABEL_RELATIVE:
+            case IROpcode.INSTR_LABEL_ABSOLUTE:
+            case IROpcode.INSTR_LABEL_ALIAS:
+            case IROpcode.INSTR_DATA:
+            case IROpcode.INSTR_WORD:
+            case IROpcode.INSTR_FILL:
+            case IROpcode.INSTR_MARKER:
+                this.error(`unexpected ${IROpcode[instr.opcode]} in code`);
+                break;
+        }
+    }
+
+    private isCodeTarget(target: unknown, offset: number): boolean {
+        if (offset !== 0) {
+            return false;
+        } else if (target instanceof FunctionSymbol) {
+            return target.used && !!target.ir?.length;
+        } else if (target instanceof FunctionInnerSymbol) {
+            return target.parentSymbol.used && target.instruction !== undefined
+                && !!target.parentSymbol.ir?.includes(target.instruction);
+        }
+        return false;
+    }
+
+    /*
+     * Stack depth in bytes above BP, propagated along the control flow from the function
+     * entry. Code entered only through inner symbols starts with the prologue depth.
+     */
+    private verifyStack(ir: IRInstruction[]): void {
+        if (ir.length === 0) return;
+        let roots: [number, number][] = [[0, 0]];
+        let prologue = ir.find(instr => instr.opcode !== IROpcode.INSTR_EMPTY);
+        let prologueDepth = prologue?.opcode === IROpcode.INSTR_PUSH_BLOCK_CONST && prologue.optional
+            ? prologue.value.getValue() : 0;
+        for (let inner of this.symbol.innerSymbols ?? []) {
+            let i = inner.instruction ? this.index.get(inner.instruction) : undefined;
+            if (i !== undefined) roots.push([i, prologueDepth]);
+        }
+        let stack: number[] = [];
+        let visit = (i: number, depth: number) => {
+            if (i >= ir.length) {
+                this.error('execution falls off the function end');
+            } else if (this.depth[i] === undefined) {
+                this.depth[i] = depth;
+                stack.push(i);
+            } else if (this.depth[i] !== depth) {
+                this.error(`stack depth ${this.depth[i]} and ${depth} at instruction ${i}`);
+            }
+        };
+        // The entry first, so inner symbols reachable from it take their depth from the flow
+        for (let [root, depth] of roots) {
+            if (this.depth[root] === undefined) visit(root, depth);
+            while (stack.length > 0) {
+                let i = stack.pop()!;
+                let instr = ir[i];
+                let depth = this.depth[i]! + getStackEffect(instr)!;
+                if (depth < 0) {
+                    this.error(`stack underflow at instruction ${i}`);
+                    return;
+                }
+                if (instr.opcode === IROpcode.INSTR_JUMP_INSTR || instr.opcode === IROpcode.INSTR_JUMP_COND_INSTR) {
+                    visit(this.index.get(instr.instruction)!, depth);
+                }
+                if (!isTerminator(instr)) {
+                    visit(i + 1, depth);
+                }
+            }
+        }
+    }
+}
+
+function isTerminator(instr: IRInstruction): boolean {
+    switch (instr.opcode) {
+        case IROpcode.INSTR_JUMP_INSTR:
+        case IROpcode.INSTR_JUMP_CONST:
+        case IROpcode.INSTR_JUMP_REG:
+        case IROpcode.INSTR_RETURN:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* Number of bytes pushed to the stack, undefined for pseudo-instructions. */
+function getStackEffect(instr: IRInstruction): number | undefined {
+    switch (instr.opcode) {
+        case IROpcode.INSTR_PUSH:
+            return instr.bytes;
+        case IROpcode.INSTR_POP:
+            return -instr.bytes;
+        case IROpcode.INSTR_PUSH_BLOCK_CONST:
+            return instr.value.getValue();
+        case IROpcode.INSTR_POP_BLOCK_CONST:
+            return -instr.value.getValue();
+        case IROpcode.INSTR_EMPTY:
+            return 0;
+        case IROpcode.INSTR_JUMP_LABEL:
+        case IROpcode.INSTR_JUMP_COND_LABEL:
+        case IROpcode.INSTR_PUSH_BLOCK_LABEL:
+        case IROpcode.INSTR_LABEL_RELATIVE:
+        case IROpcode.INSTR_LABEL_ABSOLUTE:
+        case IROpcode.INSTR_LABEL_ALIAS:
+        case IROpcode.INSTR_DATA:
+        case IROpcode.INSTR_WORD:
+        case IROpcode.INSTR_FILL:
+        case IROpcode.INSTR_MARKER:
+            return undefined;
+        default:
+            return 0;
+    }
+}
+
+function getRegisters(instr: IRInstruction): number[] {
+    switch (instr.opcode) {
+        case IROpcode.INSTR_MOV_REG:
+        case IROpcode.INSTR_PUSH_BLOCK_REG:
+        case IROpcode.INSTR_BIN_OP:
+        case IROpcode.INSTR_BIN_OP64:
+        case IROpcode.INSTR_SELECT:
+        case IROpcode.INSTR_BFI:
+            return [instr.dstReg, instr.srcReg];
+        case IROpcode.INSTR_MOV_CONST:
+        case IROpcode.INSTR_READ_CONST:
+        case IROpcode.INSTR_WRITE_CONST:
+        case IROpcode.INSTR_BIN_OP_CONST:
+        case IROpcode.INSTR_BIN_OP64_CONST:
+        case IROpcode.INSTR_BFX:
+        case IROpcode.INSTR_SETCC:
+        case IROpcode.INSTR_JUMP_REG:
+        case IROpcode.INSTR_CALL_REG:
+        case IROpcode.INSTR_PUSH:
+        case IROpcode.INSTR_POP:
+        case IROpcode.INSTR_PUSH_BLOCK_CONST:
+            return [instr.reg];
+        case IROpcode.INSTR_READ_REG:
+        case IROpcode.INSTR_WRITE_REG:
+        case IROpcode.INSTR_READ_REG_OFFSET:
+        case IROpcode.INSTR_WRITE_REG_OFFSET:
+            return [instr.reg, instr.addrReg];
+        case IROpcode.INSTR_READ_REG_INDEX:
+        case IROpcode.INSTR_WRITE_REG_INDEX:
+            return [instr.reg, instr.addrReg, instr.indexReg];
+        default:
+            return [];
+    }
+}
@@ -69,6 +69,8 @@ enum {
 #include "ccvm-reloc.c"
 #include "ccvm-output.c"
 #include "ccvm-link.c"
+#include "ccvm-profile.c"
+#include "ccvm-opt.c"
 
 #define R0_ADDR (0 * 4)
 #define X0_ADDR (1 * 4)
@@ -128,14 +130,159 @@ static int my_type_size(CType *type, int *a)
     return r;
 }
 
+/* code generator state, one per TCCState */
+struct _ccvmgen {
+    int label_number;
+    int prologue_push_label;
+    int params_end;
+    OptSlot* pinned; /* locals the optimizer must keep, see pin_local */
+    int fold_barrier; /* last position that may be a backward jump target, see gen_rw_ind */
+    VEC int* import_index; /* host function index + 1 by token - TOK_IDENT, see get_import_index */
+    int import_sections; /* sections already added to import_index */
+};
+
+#define label_number        tcc_state->ccvm_gen->label_number
+#define prologue_push_label tcc_state->ccvm_gen->prologue_push_label
+#define params_end          tcc_state->ccvm_gen->params_end
+#define opt_pinned          tcc_state->ccvm_gen->pinned
+#define fold_barrier        tcc_state->ccvm_gen->fold_barrier
+
 int get_label(int t) {
-    static int label_number = 1;
     if (t == 0) {
         return label_number++;
     }
     return t;
 }
 
+/* Returns 1 if 'size' bytes at BP + 'offset' are in allocated locals or in parameters of
+   the current function. Locals area only grows, so it is also true for the final frame. */
+static int is_frame_access(int offset, int size)
+{
+    return (offset >= loc && offset + size <= 0) || (offset >= 8 && offset + size <= params_end);
+}
+
+/* Returns 1 if 'size' bytes at 'sym' + 'offset' are inside the object defined by 'sym'. */
+static int is_symbol_access(Sym *sym, int offset, int size)
+{
+    int align;
+    if ((sym->type.t & VT_BTYPE) == VT_FUNC)
+        return 0;
+    return offset >= 0 && offset + size <= type_size(&sym->type, &align);
+}
+
+/* Keeps the optimizer away from 'size' bytes at BP + 'offset', e.g. a volatile local or a local
+   whose address was taken. Size 0 means everything from 'offset' up. */
+static void pin_local(int offset, int size)
+{
+    OptSlot* slot;
+    if (!tcc_state->optimize || nocode_wanted)
+        return;
+    if (!opt_pinned)
+        vecAlloc(opt_pinned, 8);
+    slot = vecPush(opt_pinned);
+    slot->offset = offset;
+    slot->size = size > 0 ? size : 0x7FFFFFFF - MAX(offset, 0);
+}
+
+/* Pins the local accessed through 'sv' if it is volatile. Locals whose address is taken
+   are pinned when load() computes the address. 'sv->sym' is not used, it is not set for
+   all local values. */
+static void pin_local_access(SValue *sv, int size)
+{
+    if (sv->type.t & VT_VOLATILE)
+        pin_local(sv->c.i, size);
+}
+
+/* maximum number of instructions searched back for address arithmetic */
+#define FOLD_WINDOW 16
+
+/* Returns 1 if register 'r' is used by any value on the stack other than 'sv'. */
+static int is_reg_live(int r, SValue *sv)
+{
+    SValue *p;
+    for (p = vstack; p <= vtop; p++) {
+        if (p != sv && ((p->r & VT_VALMASK) == r || p->r2 == r))
+            return 1;
+    }
+    return 0;
+}
+
+/* Finds the last instruction before 'end' that writes register 'r'. The search stops
+   at any control flow instruction, at a position that may be a backward jump target,
+   or if some instruction in between touches one of the 'mask' registers. */
+static CCVMInstr* find_reg_writer(int end, int r, int mask)
+{
+    int pos, use, def;
+    int begin = MAX(MAX(func_ind, fold_barrier), end - FOLD_WINDOW * (int)sizeof(CCVMInstr));
+    for (pos = end - sizeof(CCVMInstr); pos >= begin; pos -= sizeof(CCVMInstr)) {
+        CCVMInstr* instr = (CCVMInstr*)&cur_text_section->data[pos];
+        if (!instrRegUsage(instr, &use, &def))
+            return NULL;
+        if (def & (1 << r))
+            return instr;
+        if ((use | def) & mask)
+            return NULL;
+    }
+    return NULL;
+}
+
+/* Read or write indirectly from 'sv' register. Address arithmetic generated for this access
+   (constant offsets of struct fields, scaled array indexes) is folded into the instruction
+   if the address register is not used after it. */
+static void gen_rw_ind(int read, int r, SValue *sv, int bits, int sign_extend)
+{
+    CCVMInstr *add, *shl;
+    int a, b, offset, scale, position;
+
+    a = sv->r & VT_VALMASK;
+    if (nocode_wanted || a > TREG_R3 || ((r != a || !read) && is_reg_live(a, sv))) {
+        instrRWInd(read, r, a, bits, sign_extend);
+        return;
+    }
+
+    // [a + offset]: one or more constant additions to the address register
+    offset = 0;
+    position = ind;
+    while ((add = find_reg_writer(position, a, 1 << a))
+        && add->opcode == INSTR_BIN_OP_CONST
+        && (add->op2 == BIN_OP_ADD || add->op2 == BIN_OP_SUB)) {
+        offset += add->op2 == BIN_OP_ADD ? (int)add->value : -(int)add->value;
+        position = (uint8_t*)add - cur_text_section->data;
+        instrRemove(add);
+    }
+    if (position != ind) {
+        instrRWOffset(read, r, a, offset, bits, sign_extend);
+        return;
+    }
+
+    // [a + (b << scale)]: sum of two registers, one of them optionally shifted
+    add = find_reg_writer(ind, a, 1 << a);
+    if (add && add->opcode == INSTR_BIN_OP && add->op2 == BIN_OP_ADD && add->srcReg != a
+        && add->srcReg <= TREG_R3 && !is_reg_live(add->srcReg, sv)
+        && find_reg_writer(ind, a, (1 << a) | (1 << add->srcReg)) == add) {
+        b = add->srcReg;
+        position = (uint8_t*)add - cur_text_section->data;
+        scale = 0;
+        // the shifted register may be any of the operands
+        if ((shl = find_reg_writer(position, b, 1 << b))
+            && shl->opcode == INSTR_BIN_OP_CONST && shl->op2 == BIN_OP_SHL && shl->value <= 3) {
+            scale = shl->value;
+            instrRemove(shl);
+        } else if ((shl = find_reg_writer(position, a, 1 << a))
+            && shl->opcode == INSTR_BIN_OP_CONST && shl->op2 == BIN_OP_SHL && shl->value <= 3) {
+            scale = shl->value;
+            instrRemove(shl);
+            b = a;
+            a = add->srcReg;
+        }
+        instrRemove(add);
+        instrRWIndex(read, r, a, b, scale, bits, sign_extend);
+        return;
+    }
+
+    instrRWInd(read, r, a, bits, sign_extend);
+}
+
 /* load 'r' from value 'sv' */
 void load(int r, SValue *sv)
 {
@@ -195,23 +342,32 @@ void load(int r, SValue *sv)
         if ((fr & VT_VALMASK) == VT_CONST) {
             // Constant memory reference
             if (fr & VT_SYM) {
-                instrRWReloc(1, sv->sym, r, fc, bits, sign_extend);
+                CCVMInstr* instr = instrRWReloc(1, sv->sym, r, fc, bits, sign_extend);
+                if (is_symbol_access(sv->sym, fc, bits / 8))
+                    instrMarkSafe(instr);
             } else {
                 instrRWConst(1, r, fc, bits, sign_extend, 0);
             }
         } else if ((fr & VT_VALMASK) == VT_LOCAL) {
             // Local variable
-            instrRWConst(1, r, fc, bits, sign_extend, 1);
+            CCVMInstr* instr = instrRWConst(1, r, fc, bits, sign_extend, 1);
+            if (is_frame_access(fc, bits / 8))
+                instrMarkSafe(instr);
+            pin_local_access(sv, bits / 8);
         } else {
             // Indirect access from fr register
-            instrRWInd(1, r, fr & VT_VALMASK, bits, sign_extend);
+            if (v == VT_LLOCAL) {
+                instrRWInd(1, r, fr, bits, sign_extend);
+            } else {
+                gen_rw_ind(1, r, sv, bits, sign_extend);
+            }
         }
 
     } else if (v == VT_CONST) {
 
         // Load constant value into register either from symbol or absolute.
         if (fr & VT_SYM) {
-            instrMovReloc(r, sv->sym);
+            instrMovReloc(r, sv->sym, fc);
         } else {
             instrMovConst(r, fc);
         }
@@ -219,6 +375,10 @@ void load(int r, SValue *sv)
     } else if (v == VT_LOCAL) {
 
         // Calculate address of local variable, e.g. int x; f(&x);
+        if ((sv->type.t & VT_BTYPE) == VT_PTR && !(sv->type.t & VT_ARRAY))
+            pin_local(fc, type_size(pointed_type(&sv->type), &t));
+        else
+            pin_local(fc, type_size(&sv->type, &t));
         instrRWConst(1, r, BP_ADDR, 32, 0, 0);
         if (fc) {
             instrBinOpConst(BIN_OP_ADD, r, fc);
@@ -227,11 +387,7 @@ void load(int r, SValue *sv)
     } else if (v == VT_CMP) {
 
         // Load comparision result into register, e.g. int x = (a < b);
-        int label = get_label(0);
-        instrMovConst(r, 1);
-        instrJumpCondLabel(vtop->cmp_op, label);
-        instrMovConst(r, 0);
-        instrLabel(label, 1, 0);
+        instrSetCC(r, vtop->cmp_op);
 
     } else if (v == VT_JMP || v == VT_JMPI) {
 
@@ -303,17 +459,22 @@ void store(int r, SValue *v)
 
         if ((fr & VT_VALMASK) == VT_CONST) {
             // Constant memory reference
-            if (fr & VT_SYM) {
-                instrRWReloc(0, v->sym, r, fc, bits, 0);
+            if (v->r & VT_SYM) {
+                CCVMInstr* instr = instrRWReloc(0, v->sym, r, fc, bits, 0);
+                if (is_symbol_access(v->sym, fc, bits / 8))
+                    instrMarkSafe(instr);
             } else {
                 instrRWConst(0, r, fc, bits, 0, 0);
             }
         } else if ((fr & VT_VALMASK) == VT_LOCAL) {
             // Local variable
-            instrRWConst(0, r, fc, bits, 0, 1);
+            CCVMInstr* instr = instrRWConst(0, r, fc, bits, 0, 1);
+            if (is_frame_access(fc, bits / 8))
+                instrMarkSafe(instr);
+            pin_local_access(v, bits / 8);
         } else {
             // Indirect access from v->r register
-            instrRWInd(0, r, v->r & VT_VALMASK, bits, 0);
+            gen_rw_ind(0, r, v, bits, 0);
         }
 
     } else if (fr != r) {
@@ -362,12 +523,35 @@ static void gcall_or_jmp(int is_jmp)
     }
 }
 
+/* Returns host function index if 'sym' is imported in this translation unit with
+   ".ccvm.import.NNN.name" section, or -1 otherwise. Only sections created since
+   the previous call are scanned, the names found are kept in 'import_index'. */
+static int get_import_index(Sym *sym)
+{
+    struct _ccvmgen *gen = tcc_state->ccvm_gen;
+    int i, index, len, v;
+    for (i = gen->import_sections; i < tcc_state->nb_sections; i++) {
+        const char *sec_name = tcc_state->sections[i]->name;
+        len = 0;
+        if (sscanf(sec_name, ".ccvm.import.%d.%n", &index, &len) == 1 && len > 0 && index >= 0) {
+            v = tok_alloc(sec_name + len, strlen(sec_name + len))->tok - TOK_IDENT;
+            if (v >= 0 && *vecEnsure(gen->import_index, v) == 0)
+                gen->import_index[v] = index + 1;
+        }
+    }
+    gen->import_sections = i;
+    v = sym->v - TOK_IDENT;
+    if (v < 0 || v >= vecSize(gen->import_index))
+        return -1;
+    return gen->import_index[v] - 1;
+}
+
 /* Generate function call. The function address is pushed first, then
    all the parameters in call order. This functions pops all the
    parameters and the function address. */
 void gfunc_call(int nb_args)
 {
-    int i;
+    int i, import_index;
     Sym *func_sym;
     int *offsets;
     MALLOC_OR_STACK(offsets, sizeof(int) * (nb_args + 1));
@@ -391,7 +575,7 @@ void gfunc_call(int nb_args)
         SValue* arg = vtop - nb_args + 1 + i;
         // calculate size, alignment, and offset
         int align;
-        int size = my_type_size(&vtop->type, &align);
+        int size = my_type_size(&arg->type, &align);
         int offset_aligned = (offset + align - 1) & ~(align - 1);
         offsets[i] = offset_aligned;
         offset = offset_aligned + size;
@@ -442,18 +626,27 @@ void gfunc_call(int nb_args)
     }
     save_regs(0); /* save used temporary registers */
 
-    gcall_or_jmp(0);
+    import_index = -1;
+    if ((vtop->r & (VT_VALMASK | VT_LVAL | VT_SYM)) == (VT_CONST | VT_SYM))
+        import_index = get_import_index(vtop->sym);
+    if (import_index >= 0) {
+        /* host reads arguments directly from the stack, so wrapper is not needed,
+           the symbol is still needed by the linker to verify the import */
+        if (0 == vtop->sym->c)
+            put_extern_sym(vtop->sym, NULL, 0, 0);
+        instrCallHost(import_index);
+    } else {
+        gcall_or_jmp(0);
+    }
 
-    if (offset > 0) {
-        instrPopBlockConst(offset);
+    if (offsets[nb_args] > 0) {
+        instrPopBlockConst(offsets[nb_args]);
     }
 
     vtop--;
     FREE_OR_STACK(offsets);
 }
 
-static int prologue_push_label;
-
 /* generate function prolog of type 't' */
 void gfunc_prolog(Sym *func_sym)
 {
@@ -482,12 +675,11 @@ void gfunc_prolog(Sym *func_sym)
     */
 
     loc = 0;
+    if (opt_pinned)
+        vecResize(opt_pinned, 0);
 
     DEBUG_COMMENT("Function %s", get_tok_str(func_sym->v, NULL));
 
-    prologue_push_label = get_label(0);
-    instrPushBlockLabel(0, prologue_push_label, 1);
-
     for(param = sym->next; param; param = param->next) {
         // Get parameter information
         CType* type = &param->type;
@@ -500,12 +692,21 @@ void gfunc_prolog(Sym *func_sym)
         // Calculate address for next parameter
         addr += size;
     }
+    params_end = addr;
+
+    /* the linker takes the parameters size from the prologue to verify SAFE accesses */
+    prologue_push_label = get_label(0);
+    instrPushBlockLabel(0, prologue_push_label, 1, params_end - 8);
+
+    profileFunctionBegin();
 }
 
 /* generate function epilog */
 void gfunc_epilog(void)
 {
     int loc_aligned = (-loc + 3) & -4;
+    if (tcc_state->optimize)
+        optimizeFunction(opt_pinned);
     instrLabel(prologue_push_label, 0, loc_aligned);
     DEBUG_COMMENT("Adjusting function prologue to %d", loc_aligned);
     instrReturn();
@@ -534,7 +735,9 @@ ST_FUNC void gjmp_addr(int a)
 
 ST_FUNC int gjmp_cond(int op, int t)
 {
-    instrJumpCondLabel(op, t);
+    int hint = profileBranchBegin();
+    instrJumpCondLabel(op, t, hint);
+    profileBranchEnd();
     return t;
 }
 
@@ -608,7 +811,7 @@ void gen_opi(int op)
             save_reg(a + TREG_X0);
             if (op == '%' || op == TOK_UMOD) {
                 vtop->r = a + TREG_X0;
-                op = BIN_OP_DIV;
+                op = op == TOK_UMOD ? BIN_OP_UDIV : BIN_OP_DIV;
             }
             if (op == TOK_UMULL) {
                 vtop->r2 = a + TREG_X0;
@@ -660,6 +863,103 @@ void gen_opi(int op)
     tcc_error("gen_opi unimplemented 0x%02X", op);
 }
 
+/* checks if long long value is in Rn:Xn register pair */
+static int is_reg_pair(SValue *sv)
+{
+    return (sv->r & (VT_VALMASK | VT_LVAL)) <= TREG_R3 && sv->r2 == (sv->r & VT_VALMASK) + TREG_X0;
+}
+
+/* loads long long value on the top of the stack into Rn:Xn register pair, returns n */
+static int gv_pair(void)
+{
+    int r;
+    if (is_reg_pair(vtop))
+        return vtop->r;
+    r = gv(RC_INT);
+    save_reg_upstack(r + TREG_X0, 1);
+    /* gv(RC_INT) leaves the high word in an R register, X is written through its address */
+    instrRWConst(0, vtop->r2, reg_addr(r + TREG_X0), 32, 0, 0);
+    vtop->r2 = r + TREG_X0;
+    return r;
+}
+
+/* generate a long long operation on Rn:Xn register pairs, the shift count is an int */
+ST_FUNC void gen_opl(int op)
+{
+    int a, b;
+    int shift = op == TOK_SHL || op == TOK_SHR || op == TOK_SAR;
+
+    DEBUG_COMMENT("0x%04X:0x%04X %c (0x%02X) 0x%04X:0x%04X", vtop[-1].r, vtop[-1].r2, op, op, vtop[0].r, vtop[0].r2);
+    if (op == TOK_PDIV)
+        op = BIN_OP_DIV;
+    if (TOK_ISCOND(op)) {
+        b = op;
+        op = BIN_OP_CMP;
+    }
+
+    if ((vtop->r & (VT_VALMASK | VT_LVAL | VT_SYM)) == VT_CONST) {
+        uint64_t c;
+        vswap();
+        a = gv_pair();
+        vswap();
+        c = shift ? vtop->c.i & 63 : vtop->c.i;
+        vtop--;
+        if (op != BIN_OP_CMP) {
+            save_reg_upstack(a, 1);
+            save_reg_upstack(a + TREG_X0, 1);
+        }
+        instrBinOp64Const(op, a, c);
+    } else {
+        int r;
+        vswap();
+        gv_pair();
+        vswap();
+        if (shift)
+            gv(RC_INT);
+        else
+            gv_pair();
+        /* test if reload is needed for first operand */
+        if (!is_reg_pair(vtop - 1)) {
+            vswap();
+            gv_pair();
+            vswap();
+        }
+        a = vtop[-1].r;
+        r = vtop[0].r;
+        vtop--;
+        if (op != BIN_OP_CMP) {
+            save_reg_upstack(a, 1);
+            save_reg_upstack(a + TREG_X0, 1);
+        }
+        instrBinOp64(op, a, r);
+    }
+
+    if (op == BIN_OP_CMP) {
+        vset_VT_CMP(b);
+        vtop->r2 = VT_CONST;
+    }
+}
+
+/* extract 'bit_size' bits at 'bit_pos' from int value on the top of the stack */
+ST_FUNC void gen_bf_extract(int bit_pos, int bit_size, int is_signed)
+{
+    int r = gv(RC_INT);
+    save_reg_upstack(r, 1);
+    instrBitFieldExtract(r, bit_pos, bit_size, is_signed);
+}
+
+/* replace 'bit_size' bits at 'bit_pos' of int value vtop[-1] with low bits of vtop[0] */
+ST_FUNC void gen_bf_insert(int bit_pos, int bit_size)
+{
+    int a, b;
+    gv2(RC_INT, RC_INT);
+    a = vtop[-1].r;
+    b = vtop[0].r;
+    vtop--;
+    save_reg_upstack(a, 1);
+    instrBitFieldInsert(a, b, bit_pos, bit_size);
+}
+
 /* generate a floating point operation 'v = t1 op t2' instruction. The
  *    two operands are guaranteed to have the same floating point type */
 void gen_opf(int op)
@@ -752,11 +1052,119 @@ ST_FUNC void gen_vla_alloc(CType *type, int align)
     vpop();
 }
 
+/* Returns 1 if the operand of conditional expression can be loaded to a register without
+   changing flags or causing any side effects. */
+static int select_operand(SValue *sv, CType *type)
+{
+    int bt = sv->type.t & VT_BTYPE;
+    if ((sv->type.t & (VT_VOLATILE | VT_BITFIELD)) || sv->r2 != VT_CONST)
+        return 0;
+    if (bt != VT_BYTE && bt != VT_SHORT && bt != VT_INT && bt != VT_PTR && bt != VT_BOOL)
+        return 0;
+    if ((type->t & VT_BTYPE) == VT_LLONG || is_float(type->t) || (type->t & VT_BTYPE) == VT_STRUCT)
+        return 0;
+    switch (sv->r & (VT_VALMASK | VT_LVAL)) {
+        case VT_CONST:
+            // Constants are folded by the cast
+            return 1;
+        case VT_CONST | VT_LVAL:
+        case VT_LOCAL | VT_LVAL:
+            // Loaded directly with the final type, so the cast must not generate any code
+            return bt == (type->t & VT_BTYPE) && (sv->type.t & VT_UNSIGNED) == (type->t & VT_UNSIGNED);
+        default:
+            return 0;
+    }
+}
+
+/* Try to replace conditional expression "cond ? sv : vtop" with SELECT instruction.
+   Both operands must be available without generating any code, so they can be evaluated
+   unconditionally without side effects, e.g. constants and non-volatile variables.
+   The code generated for the branches since 'cond_ind' (conditional jump, jump to the end
+   and the label of the second operand) is removed. Returns 1 if the result is in vtop. */
+ST_FUNC int gen_cond_select(int cond_ind, int op, SValue *sv, CType *type)
+{
+    CCVMInstr* instr = (CCVMInstr*)&cur_text_section->data[cond_ind];
+    int r1, r2;
+
+    if (op < 2 || nocode_wanted || ind != cond_ind + 3 * (int)sizeof(CCVMInstr)
+        || instr[0].opcode != INSTR_JUMP_COND_LABEL
+        || instr[1].opcode != INSTR_JUMP_LABEL
+        || instr[2].opcode != INSTR_LABEL_RELATIVE
+        || !select_operand(sv, type) || !select_operand(vtop, type))
+        return 0;
+
+    DEBUG_COMMENT("Branches at 0x%08X replaced by SELECT", cond_ind);
+    ind = cond_ind;
+    gen_cast(type);
+    r2 = gv(RC_INT);
+    vpushv(sv);
+    gen_cast(type);
+    r1 = gv(RC_INT);
+    instrSelect(op, r2, r1);
+    vtop--;
+    return 1;
+}
+
 ST_FUNC void gsym_addr(int t, int a)
 {
     instrLabel(t, 1, a - ind);
 }
 
+/* Called when the current position is saved as a possible target of a later gjmp_addr or
+   gsym_addr. These labels are emitted at the jump, not at the target, so instructions
+   before and after the position must not be folded together. */
+ST_FUNC void gen_jump_target(void)
+{
+    fold_barrier = ind;
+}
+
+/* increment 64-bit test coverage counter */
+ST_FUNC void gen_increment_tcov (SValue *sv)
+{
+    instrCount(sv->sym, sv->c.i, 64);
+}
+
+/* Called at the beginning of each compilation */
+ST_FUNC void ccvm_init(TCCState* s1)
+{
+    if (!s1->ccvm_gen) {
+        s1->ccvm_gen = tcc_mallocz(sizeof(*s1->ccvm_gen));
+        vecAlloc(s1->ccvm_gen->import_index, 64);
+        label_number = 1;
+    }
+    /* token numbers are not kept between compilations */
+    vecResize(s1->ccvm_gen->import_index, 0);
+    s1->ccvm_gen->import_sections = 1;
+    profileInit(s1);
+}
+
+/* Called at the end of each compilation */
+ST_FUNC void ccvm_finish(TCCState* s1)
+{
+    /* not initialized for -E and assembler input */
+    if (!s1->ccvm_gen) return;
+    profileFinish(s1);
+}
+
+/* Called from tcc_delete() */
+ST_FUNC void ccvm_delete(TCCState* s1)
+{
+    profileDelete(s1);
+    linkDelete(s1);
+    if (s1->ccvm_gen && s1->ccvm_gen->pinned)
+        vecFree(s1->ccvm_gen->pinned);
+    if (s1->ccvm_gen && s1->ccvm_gen->import_index)
+        vecFree(s1->ccvm_gen->import_index);
+    tcc_free(s1->ccvm_gen);
+    s1->ccvm_gen = NULL;
+}
+
+#undef label_number
+#undef prologue_push_label
+#undef params_end
+#undef opt_pinned
+#undef fold_barrier
+
 /*************************************************************/
 #endif
 /*************************************************************/
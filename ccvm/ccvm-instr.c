@@ -1,6 +1,7 @@
 
 #include <stdint.h>
 
+#include "ccvm-instr.h"
 #include "ccvm-output.h"
 
 #ifdef INTELLISENSE
@@ -9,52 +10,6 @@
 #endif
 
 
-enum {
-    INSTR_MOV_REG,          // dstReg = srcReg
-    INSTR_MOV_CONST,        // reg = value
-    INSTR_LABEL_RELATIVE,   // label, address_offset
-    INSTR_LABEL_ABSOLUTE,   // label, address_offset
-    INSTR_WRITE_CONST,      // reg => [value]
-    INSTR_READ_CONST,       // reg <= [value]
-    INSTR_WRITE_REG,        // reg => [addrReg]
-    INSTR_READ_REG,         // reg <= [addrReg]
-    INSTR_JUMP_COND_LABEL,  // label, op2 = condition
-    INSTR_JUMP_CONST,       // address
-    INSTR_CALL_CONST,       // address
-    INSTR_JUMP_LABEL,       // label
-    INSTR_JUMP_REG,         // reg
-    INSTR_CALL_REG,         // reg
-    INSTR_PUSH,             // reg, op2 = 1..4 bytes
-    INSTR_PUSH_BLOCK_CONST, // reg, op2 = optional, value = block size
-    INSTR_PUSH_BLOCK_LABEL, // reg, op2 = optional, label = label containing block size
-    INSTR_BIN_OP,           // srcReg, dstReg, op2 = operator
-    INSTR_RETURN,           // value = cleanup words
-    INSTR_LABEL_ALIAS,      // labelAlias = label
-    INSTR_HOST,             // value = host function index
-    INSTR_POP,              // reg, op2 = 1..4 bytes, TODO: is signed needed?
-    INSTR_POP_BLOCK_CONST,  // value = bytes
-    INSTR_BIN_OP_CONST,     // reg = reg ?? value
-    INSTR_NOOP,             // value = bytes
-    INSTR_PUSH_BLOCK_REG,   // dstReg = block size srcReg
-};
-
-enum {
-    BIN_OP_ADD = 0x2B,
-    BIN_OP_SUB = 0x2D,
-    BIN_OP_ADDC = 0x88,
-    BIN_OP_SUBC = 0x8a,
-    BIN_OP_BITAND = 0x26,
-    BIN_OP_BITXOR = 0x5E,
-    BIN_OP_BITOR = 0x7C,
-    BIN_OP_MUL = 0x2A,
-    BIN_OP_SHL = 0x3C,
-    BIN_OP_SHR = 0x8b,
-    BIN_OP_SAR = 0x3E,
-    BIN_OP_DIV = 0x2F,
-    BIN_OP_UDIV = 0x83,
-    BIN_OP_CMP = 0xFF,
-};
-
 _Static_assert(BIN_OP_ADD == '+', "BIN_OP_ADD");
 _Static_assert(BIN_OP_SUB == '-', "BIN_OP_SUB");
 _Static_assert(BIN_OP_ADDC == TOK_ADDC2, "BIN_OP_ADDC2");
@@ -68,21 +23,8 @@ _Static_assert(BIN_OP_SHR == TOK_SHR, "BIN_OP_SHR");
 _Static_assert(BIN_OP_SAR == TOK_SAR, "BIN_OP_SAR");
 _Static_assert(BIN_OP_DIV == '/', "BIN_OP_DIV");
 _Static_assert(BIN_OP_UDIV == TOK_UDIV, "BIN_OP_UDIV");
-
-enum {
-    CMP_OP_ULT = 0x92,
-    CMP_OP_UGE = 0x93,
-    CMP_OP_EQ = 0x94,
-    CMP_OP_NE = 0x95,
-    CMP_OP_ULE = 0x96,
-    CMP_OP_UGT = 0x97,
-    CMP_OP_Nset = 0x98,
-    CMP_OP_Nclear = 0x99,
-    CMP_OP_LT = 0x9c,
-    CMP_OP_GE = 0x9d,
-    CMP_OP_LE = 0x9e,
-    CMP_OP_GT = 0x9f,
-};
+_Static_assert(BIN_OP_MOD == '%', "BIN_OP_MOD");
+_Static_assert(BIN_OP_UMOD == TOK_UMOD, "BIN_OP_UMOD");
 
 _Static_assert(CMP_OP_ULT == TOK_ULT, "CMP_OP_ULT");
 _Static_assert(CMP_OP_UGE == TOK_UGE, "CMP_OP_UGE");
@@ -98,29 +40,6 @@ _Static_assert(CMP_OP_LE == TOK_LE, "CMP_OP_LE");
 _Static_assert(CMP_OP_GT == TOK_GT, "CMP_OP_GT");
 
 
-typedef struct CCVMInstr {
-    struct {
-        uint8_t opcode;
-        uint8_t op2;
-        union {
-            uint8_t reg;
-            uint8_t dstReg;
-        };
-        union {
-            uint8_t srcReg;
-            uint8_t addrReg;
-        };
-    };
-    union {
-        uint32_t value;
-        uint32_t address;
-        uint32_t label;
-    };
-    union {
-        int32_t address_offset;
-        int32_t labelAlias;
-    };
-} CCVMInstr;
 
 
 static CCVMInstr* genInstr(uint8_t opcode, uint8_t force_output)
@@ -147,10 +66,12 @@ static void addReloc(Sym* sym, uint32_t address, int type)
 }
 
 
-static void instrMovReloc(int reg, Sym* sym) {
-    DEBUG_INSTR("MOV_CONST R%d = %s", reg, get_tok_str(sym->v, NULL));
+static void instrMovReloc(int reg, Sym* sym, int offset) {
+    DEBUG_INSTR("MOV_CONST R%d = %s + %d", reg, get_tok_str(sym->v, NULL), offset);
     addReloc(sym, ind, RELOC_INSTR);
-    genInstr(INSTR_MOV_CONST, 0)->reg = reg;
+    CCVMInstr* instr = genInstr(INSTR_MOV_CONST, 0);
+    instr->reg = reg;
+    instr->value = offset;
 }
 
 static void instrMovConst(int reg, uint32_t value) {
@@ -183,6 +104,11 @@ static void instrJumpReloc(int is_call, Sym* sym) {
     genInstr(is_call ? INSTR_CALL_CONST : INSTR_JUMP_CONST, 0);
 }
 
+static void instrCallHost(int index) {
+    DEBUG_INSTR("CALL_HOST %d", index);
+    genInstr(INSTR_CALL_HOST, 0)->value = index;
+}
+
 static void instrPush(int bits, int reg) {
     int op2 = 1;
     switch (bits)
@@ -199,12 +125,13 @@ static void instrPush(int bits, int reg) {
     instr->reg = reg;
 }
 
-static void instrPushBlockLabel(int reg, int label, uint8_t optional) {
+static void instrPushBlockLabel(int reg, int label, uint8_t optional, int params_size) {
     DEBUG_INSTR("PUSH_BLOCK R%d, label_%d", reg, label);
     CCVMInstr* instr = genInstr(INSTR_PUSH_BLOCK_LABEL, 0);
     instr->reg = reg;
     instr->label = label;
     instr->op2 = optional;
+    instr->paramsSize = params_size;
 }
 
 static void instrPushBlockConst(int reg, int size, uint8_t optional) {
@@ -234,11 +161,38 @@ static void instrReturn() {
 }
 
 
-static void instrJumpCondLabel(int op, int label) {
-    DEBUG_INSTR("JUMP_IF 0x%02X [...reloc...]", op);
+static void instrJumpCondLabel(int op, int label, int hint) {
+    DEBUG_INSTR("JUMP_IF 0x%02X [...reloc...]%s", op, hint > 0 ? " likely" : hint < 0 ? " unlikely" : "");
     CCVMInstr* instr = genInstr(INSTR_JUMP_COND_LABEL, 0);
     instr->op2 = op;
     instr->label = label;
+    instr->hint = hint;
+}
+
+static void instrSetCC(int reg, int op)
+{
+    DEBUG_INSTR("SETCC R%d, 0x%02X", reg, op);
+    CCVMInstr* instr = genInstr(INSTR_SETCC, 0);
+    instr->op2 = op;
+    instr->reg = reg;
+}
+
+static void instrSelect(int op, int dstReg, int srcReg)
+{
+    DEBUG_INSTR("SELECT 0x%02X R%d = R%d", op, dstReg, srcReg);
+    CCVMInstr* instr = genInstr(INSTR_SELECT, 0);
+    instr->op2 = op;
+    instr->dstReg = dstReg;
+    instr->srcReg = srcReg;
+}
+
+static void instrCount(Sym* sym, int offset, int bits)
+{
+    DEBUG_INSTR("COUNT%d [%s + %d]", bits, get_tok_str(sym->v, NULL), offset);
+    addReloc(sym, ind, RELOC_INSTR);
+    CCVMInstr* instr = genInstr(INSTR_COUNT, 0);
+    instr->op2 = bits == 64 ? 3 : 2;
+    instr->value = offset;
 }
 
 static void instrBinOpConst(int op, int a, int value)
@@ -259,6 +213,45 @@ static void instrBinOp(int op, int a, int b)
     instr->srcReg = b;
 }
 
+static void instrBinOp64Const(int op, int a, uint64_t value)
+{
+    DEBUG_INSTR("BIN_OP64_CONST 0x%02X R%d:X%d 0x%016llX", op, a, a, (unsigned long long)value);
+    CCVMInstr* instr = genInstr(INSTR_BIN_OP64_CONST, 0);
+    instr->op2 = op;
+    instr->dstReg = a;
+    instr->value = (uint32_t)value;
+    instr->valueHigh = (int32_t)(value >> 32);
+}
+
+static void instrBinOp64(int op, int a, int b)
+{
+    DEBUG_INSTR("BIN_OP64 0x%02X R%d:X%d R%d:X%d", op, a, a, b, b);
+    CCVMInstr* instr = genInstr(INSTR_BIN_OP64, 0);
+    instr->op2 = op;
+    instr->dstReg = a;
+    instr->srcReg = b;
+}
+
+static void instrBitFieldExtract(int reg, int bit_pos, int bit_size, int is_signed)
+{
+    DEBUG_INSTR("BFX%s R%d, %d, %d", is_signed ? "_SIGNED" : "", reg, bit_pos, bit_size);
+    CCVMInstr* instr = genInstr(INSTR_BFX, 0);
+    instr->op2 = !!is_signed;
+    instr->reg = reg;
+    instr->value = bit_pos;
+    instr->bitSize = bit_size;
+}
+
+static void instrBitFieldInsert(int dstReg, int srcReg, int bit_pos, int bit_size)
+{
+    DEBUG_INSTR("BFI R%d, R%d, %d, %d", dstReg, srcReg, bit_pos, bit_size);
+    CCVMInstr* instr = genInstr(INSTR_BFI, 0);
+    instr->dstReg = dstReg;
+    instr->srcReg = srcReg;
+    instr->value = bit_pos;
+    instr->bitSize = bit_size;
+}
+
 static uint8_t instrReadWriteOp2(char* str, int* value, int bits, int sign_extend, int bp)
 {
     uint8_t res = 0;
@@ -281,7 +274,7 @@ static uint8_t instrReadWriteOp2(char* str, int* value, int bits, int sign_exten
     return res;
 }
 
-static void instrRWReloc(int read, Sym* sym, int reg, int offset, int bits, int sign_extend)
+static CCVMInstr* instrRWReloc(int read, Sym* sym, int reg, int offset, int bits, int sign_extend)
 {
     char format[128];
     char str[128];
@@ -294,9 +287,10 @@ static void instrRWReloc(int read, Sym* sym, int reg, int offset, int bits, int
     instr->op2 = op2;
     instr->reg = reg;
     instr->value = offset;
+    return instr;
 }
 
-static void instrRWConst(int read, int reg, int value, int bits, int sign_extend, int bp)
+static CCVMInstr* instrRWConst(int read, int reg, int value, int bits, int sign_extend, int bp)
 {
     char format[128];
     char str[128];
@@ -308,6 +302,13 @@ static void instrRWConst(int read, int reg, int value, int bits, int sign_extend
     instr->op2 = op2;
     instr->reg = reg;
     instr->value = value;
+    return instr;
+}
+
+static void instrMarkSafe(CCVMInstr* instr)
+{
+    DEBUG_COMMENT("Access in bounds");
+    instr->op2 |= RW_SAFE;
 }
 
 static void instrRWInd(int read, int reg, int addrReg, int bits, int sign_extend)
@@ -327,6 +328,36 @@ static void instrRWInd(int read, int reg, int addrReg, int bits, int sign_extend
     instr->addrReg = addrReg;
 }
 
+static void instrRWOffset(int read, int reg, int addrReg, int offset, int bits, int sign_extend)
+{
+    char format[128];
+    char str[128];
+    strcpy(format, read ? "READ" : "WRITE");
+    uint8_t op2 = instrReadWriteOp2(format, NULL, bits, sign_extend, 0);
+    sprintf(str, format, reg);
+    DEBUG_INSTR("%s[R%d + %d]", str, addrReg, offset);
+    CCVMInstr* instr = genInstr(read ? INSTR_READ_REG_OFFSET : INSTR_WRITE_REG_OFFSET, 0);
+    instr->op2 = op2;
+    instr->reg = reg;
+    instr->addrReg = addrReg;
+    instr->value = offset;
+}
+
+static void instrRWIndex(int read, int reg, int addrReg, int indexReg, int scale, int bits, int sign_extend)
+{
+    char format[128];
+    char str[128];
+    strcpy(format, read ? "READ" : "WRITE");
+    uint8_t op2 = instrReadWriteOp2(format, NULL, bits, sign_extend, 0);
+    sprintf(str, format, reg);
+    DEBUG_INSTR("%s[R%d + (R%d << %d)]", str, addrReg, indexReg, scale);
+    CCVMInstr* instr = genInstr(read ? INSTR_READ_REG_INDEX : INSTR_WRITE_REG_INDEX, 0);
+    instr->op2 = op2 | (scale << RW_SCALE_SHIFT);
+    instr->reg = reg;
+    instr->addrReg = addrReg;
+    instr->indexReg = indexReg;
+}
+
 static void instrLabel(int label, int relative, int offset)
 {
     DEBUG_INSTR("LABEL label_%d = %s0x%08X", label, relative ? "rel " : "", offset);
@@ -349,3 +380,105 @@ static void instrNoop(int bytes)
     CCVMInstr* instr = genInstr(INSTR_NOOP, 0);
     instr->value = bytes;
 }
+
+/* Replaces already generated instruction with an empty one, the linker drops it. */
+static void instrRemove(CCVMInstr* instr)
+{
+    DEBUG_COMMENT("Instruction at 0x%08X removed", (int)((uint8_t*)instr - cur_text_section->data));
+    memset(instr, 0, sizeof(CCVMInstr));
+    instr->opcode = INSTR_NOOP;
+}
+
+/* Sets bit masks of registers (bit n for register n) read and written by the instruction. Returns 0 if the
+   instruction may change control flow, or may access registers in any other way, e.g. by
+   reading or writing registers memory. */
+static int instrRegUsage(CCVMInstr* instr, int* use, int* def)
+{
+    *use = 0;
+    *def = 0;
+    switch (instr->opcode) {
+        case INSTR_NOOP:
+            return instr->value == 0;
+        case INSTR_COUNT:
+        case INSTR_POP_BLOCK_CONST:
+            return 1;
+        case INSTR_MOV_REG:
+            *use = 1 << instr->srcReg;
+            *def = 1 << instr->dstReg;
+            return 1;
+        case INSTR_MOV_CONST:
+        case INSTR_SETCC:
+        case INSTR_PUSH_BLOCK_CONST:
+        case INSTR_PUSH_BLOCK_LABEL:
+        case INSTR_POP:
+            *def = 1 << instr->reg;
+            return 1;
+        case INSTR_BFX:
+            *use = 1 << instr->reg;
+            *def = 1 << instr->reg;
+            return 1;
+        case INSTR_PUSH_BLOCK_REG:
+            *use = 1 << instr->srcReg;
+            *def = 1 << instr->dstReg;
+            return 1;
+        case INSTR_SELECT:
+        case INSTR_BFI:
+            *use = (1 << instr->srcReg) | (1 << instr->dstReg);
+            *def = 1 << instr->dstReg;
+            return 1;
+        case INSTR_PUSH:
+            *use = 1 << instr->reg;
+            return 1;
+        case INSTR_READ_CONST:
+        case INSTR_WRITE_CONST:
+            // Registers are mapped at the beginning of the data memory
+            if (!(instr->op2 & 0x40) && instr->value < 0x40)
+                return 0;
+            if (instr->opcode == INSTR_READ_CONST)
+                *def = 1 << instr->reg;
+            else
+                *use = 1 << instr->reg;
+            return 1;
+        case INSTR_READ_REG:
+        case INSTR_READ_REG_OFFSET:
+            *use = 1 << instr->addrReg;
+            *def = 1 << instr->reg;
+            return 1;
+        case INSTR_READ_REG_INDEX:
+            *use = (1 << instr->addrReg) | (1 << instr->indexReg);
+            *def = 1 << instr->reg;
+            return 1;
+        case INSTR_WRITE_REG:
+        case INSTR_WRITE_REG_OFFSET:
+            *use = (1 << instr->reg) | (1 << instr->addrReg);
+            return 1;
+        case INSTR_WRITE_REG_INDEX:
+            *use = (1 << instr->reg) | (1 << instr->addrReg) | (1 << instr->indexReg);
+            return 1;
+        case INSTR_BIN_OP:
+        case INSTR_BIN_OP_CONST:
+            // Carry consumers depend on the flags of previous instructions
+            if (instr->op2 == BIN_OP_ADDC || instr->op2 == BIN_OP_SUBC)
+                return 0;
+            *use = 1 << instr->dstReg;
+            if (instr->opcode == INSTR_BIN_OP)
+                *use |= 1 << instr->srcReg;
+            if (instr->op2 != BIN_OP_CMP)
+                *def = 1 << instr->dstReg;
+            return 1;
+        case INSTR_BIN_OP64:
+        case INSTR_BIN_OP64_CONST:
+            *use = 0x11 << instr->dstReg;
+            if (instr->opcode == INSTR_BIN_OP64) {
+                if (instr->op2 == BIN_OP_SHL || instr->op2 == BIN_OP_SHR || instr->op2 == BIN_OP_SAR)
+                    *use |= 1 << instr->srcReg;
+                else
+                    *use |= 0x11 << instr->srcReg;
+            }
+            if (instr->op2 != BIN_OP_CMP)
+                *def = 0x11 << instr->dstReg;
+            return 1;
+        default:
+            return 0;
+    }
+}
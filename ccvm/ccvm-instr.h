@@ -0,0 +1,116 @@
+#ifndef _CCVM_INSTR_H_
+#define _CCVM_INSTR_H_
+
+#include <stdint.h>
+
+/* Opcodes and operators of the ccvm instructions, shared with the host tools in tests/ */
+
+enum {
+    INSTR_MOV_REG,          // dstReg = srcReg
+    INSTR_MOV_CONST,        // reg = value
+    INSTR_LABEL_RELATIVE,   // label, address_offset
+    INSTR_LABEL_ABSOLUTE,   // label, address_offset
+    INSTR_WRITE_CONST,      // reg => [value]
+    INSTR_READ_CONST,       // reg <= [value]
+    INSTR_WRITE_REG,        // reg => [addrReg]
+    INSTR_READ_REG,         // reg <= [addrReg]
+    INSTR_JUMP_COND_LABEL,  // label, op2 = condition, hint = taken (> 0) or not taken (< 0) is likely
+    INSTR_JUMP_CONST,       // address
+    INSTR_CALL_CONST,       // address
+    INSTR_JUMP_LABEL,       // label
+    INSTR_JUMP_REG,         // reg
+    INSTR_CALL_REG,         // reg
+    INSTR_PUSH,             // reg, op2 = 1..4 bytes
+    INSTR_PUSH_BLOCK_CONST, // reg, op2 = optional, value = block size
+    INSTR_PUSH_BLOCK_LABEL, // reg, op2 = optional, label = label containing block size, paramsSize
+    INSTR_BIN_OP,           // srcReg, dstReg, op2 = operator
+    INSTR_RETURN,           // value = cleanup words
+    INSTR_LABEL_ALIAS,      // labelAlias = label
+    INSTR_HOST,             // value = host function index
+    INSTR_POP,              // reg, op2 = 1..4 bytes, TODO: is signed needed?
+    INSTR_POP_BLOCK_CONST,  // value = bytes
+    INSTR_BIN_OP_CONST,     // reg = reg ?? value
+    INSTR_NOOP,             // value = bytes
+    INSTR_PUSH_BLOCK_REG,   // dstReg = block size srcReg
+    INSTR_COUNT,            // [value]++, op2 = 2 (32-bit) or 3 (64-bit) counter, flags preserved
+    INSTR_WRITE_REG_OFFSET, // reg => [addrReg + value]
+    INSTR_READ_REG_OFFSET,  // reg <= [addrReg + value]
+    INSTR_WRITE_REG_INDEX,  // reg => [addrReg + (indexReg << scale)], scale in op2
+    INSTR_READ_REG_INDEX,   // reg <= [addrReg + (indexReg << scale)], scale in op2
+    INSTR_SETCC,            // reg = condition ? 1 : 0, op2 = condition
+    INSTR_SELECT,           // dstReg = condition ? srcReg : dstReg, op2 = condition
+    INSTR_BIN_OP64,         // Rd:Xd = Rd:Xd ?? Rs:Xs, d = dstReg, s = srcReg, op2 = operator, shift count is Rs only
+    INSTR_BIN_OP64_CONST,   // Rd:Xd = Rd:Xd ?? (valueHigh << 32 | value), d = reg, op2 = operator
+    INSTR_CALL_HOST,        // value = host function index, arguments start at SP
+    INSTR_BFX,              // reg = bitSize bits of reg at bit value, op2 = 1 if sign extended
+    INSTR_BFI,              // bitSize bits of dstReg at bit value = low bits of srcReg
+};
+
+#define RW_SCALE_SHIFT 2
+#define RW_SCALE_MASK 0x0C
+#define RW_SAFE 0x20 /* access is proven to be in bounds, READ_CONST and WRITE_CONST only */
+
+enum {
+    BIN_OP_ADD = 0x2B,
+    BIN_OP_SUB = 0x2D,
+    BIN_OP_ADDC = 0x88,
+    BIN_OP_SUBC = 0x8a,
+    BIN_OP_BITAND = 0x26,
+    BIN_OP_BITXOR = 0x5E,
+    BIN_OP_BITOR = 0x7C,
+    BIN_OP_MUL = 0x2A,
+    BIN_OP_SHL = 0x3C,
+    BIN_OP_SHR = 0x8b,
+    BIN_OP_SAR = 0x3E,
+    BIN_OP_DIV = 0x2F,
+    BIN_OP_UDIV = 0x83,
+    BIN_OP_MOD = 0x25,  // 64-bit operations only
+    BIN_OP_UMOD = 0x84, // 64-bit operations only
+    BIN_OP_CMP = 0xFF,
+};
+
+enum {
+    CMP_OP_ULT = 0x92,
+    CMP_OP_UGE = 0x93,
+    CMP_OP_EQ = 0x94,
+    CMP_OP_NE = 0x95,
+    CMP_OP_ULE = 0x96,
+    CMP_OP_UGT = 0x97,
+    CMP_OP_Nset = 0x98,
+    CMP_OP_Nclear = 0x99,
+    CMP_OP_LT = 0x9c,
+    CMP_OP_GE = 0x9d,
+    CMP_OP_LE = 0x9e,
+    CMP_OP_GT = 0x9f,
+};
+
+typedef struct CCVMInstr {
+    struct {
+        uint8_t opcode;
+        uint8_t op2;
+        union {
+            uint8_t reg;
+            uint8_t dstReg;
+        };
+        union {
+            uint8_t srcReg;
+            uint8_t addrReg;
+        };
+    };
+    union {
+        uint32_t value;
+        uint32_t address;
+        uint32_t label;
+        uint32_t indexReg;
+    };
+    union {
+        int32_t address_offset;
+        int32_t labelAlias;
+        int32_t hint;
+        int32_t valueHigh;
+        int32_t bitSize;
+        int32_t paramsSize; // prologue PUSH_BLOCK_LABEL: bytes of parameters after the frame header
+    };
+} CCVMInstr;
+
+#endif // _CCVM_INSTR_H_
@@ -65,21 +65,46 @@ typedef struct OutputSection {
     LinkRelocation VEC* relocations;
 } OutputSection;
 
-static LinkSymbol* VEC* link_symbols;
-static int elf_symbol_count;
-
-static InterfaceSymbol VEC* exports;
-static InterfaceSymbol VEC* imports;
-
-static OutputSection outputSections[OUTPUT_SECTION_COUNT];
-
-static Section* elf_symtab;
-static Section* elf_strtab;
-static Section* elf_link_symbols;
-static LinkSymbol* invalidExport;
-
-static uint8_t VEC* programMemory;
-static uint8_t VEC* dataMemory;
+/* linker state, one per TCCState */
+struct _ccvmlink {
+    LinkSymbol* VEC* link_symbols;
+    int elf_symbol_count;
+
+    InterfaceSymbol VEC* exports;
+    InterfaceSymbol VEC* imports;
+
+    OutputSection outputSections[OUTPUT_SECTION_COUNT];
+
+    Section* elf_symtab;
+    Section* elf_strtab;
+    Section* elf_link_symbols;
+    LinkSymbol* invalidExport;
+
+    uint8_t VEC* programMemory;
+    uint8_t VEC* dataMemory;
+
+    struct {
+        uint32_t stackBegin;
+        uint32_t stackSize;
+        uint32_t stackEnd;
+        uint32_t heapBegin;
+        uint32_t heapSize;
+        uint32_t heapEnd;
+    } locations;
+};
+
+#define link_symbols        s1->ccvm_link->link_symbols
+#define elf_symbol_count    s1->ccvm_link->elf_symbol_count
+#define exports             s1->ccvm_link->exports
+#define imports             s1->ccvm_link->imports
+#define outputSections      s1->ccvm_link->outputSections
+#define elf_symtab          s1->ccvm_link->elf_symtab
+#define elf_strtab          s1->ccvm_link->elf_strtab
+#define elf_link_symbols    s1->ccvm_link->elf_link_symbols
+#define invalidExport       s1->ccvm_link->invalidExport
+#define programMemory       s1->ccvm_link->programMemory
+#define dataMemory          s1->ccvm_link->dataMemory
+#define locations           s1->ccvm_link->locations
 
 static bool interfaceSymbolFromSection(Section *sec, InterfaceSymbol* output)
 {
@@ -314,7 +339,7 @@ static const char* outputSectionName(OutputSectionType type)
 }
 
 
-static LinkSymbol* addCustomSymbol(OutputSection *section, uint32_t offset, const char *text, ...)
+static LinkSymbol* addCustomSymbol(TCCState *s1, OutputSection *section, uint32_t offset, const char *text, ...)
 {
     TRACE("");
     va_list ap;
@@ -335,12 +360,12 @@ static LinkSymbol* addCustomSymbol(OutputSection *section, uint32_t offset, cons
     return symbol;
 }
 
-static LinkSymbol* getLabelSymbol(LinkSymbol* VEC* * label_to_symbol, OutputSection* output, int label, int nb)
+static LinkSymbol* getLabelSymbol(TCCState *s1, LinkSymbol* VEC* * label_to_symbol, OutputSection* output, int label, int nb)
 {
     TRACE("");
     LinkSymbol* symbol = *vecEnsure(*label_to_symbol, label);
     if (symbol == NULL) {
-        symbol = addCustomSymbol(output, -1, "ccvm.loc.rel.lbl.%d.%d.%d", output->type, nb, label);
+        symbol = addCustomSymbol(s1, output, -1, "ccvm.loc.rel.lbl.%d.%d.%d", output->type, nb, label);
         (*label_to_symbol)[label] = symbol;
     }
     return symbol;
@@ -408,7 +433,7 @@ static void copyToOutputSection(TCCState *s1, OutputSection* output, Section* VE
             switch (elf_rel->cmd)
             {
             case LOCAL_RELOC_ADDR: {
-                LinkSymbol* symbol = addCustomSymbol(output, offset_adjust + elf_rel->source, "ccvm.loc.rel.adr.%d.%d.%d", output->type, k, i);
+                LinkSymbol* symbol = addCustomSymbol(s1, output, offset_adjust + elf_rel->source, "ccvm.loc.rel.adr.%d.%d.%d", output->type, k, i);
                 LinkRelocation* rel = vecPush(output->relocations);
                 rel->type = elf_rel->type;
                 rel->target = offset_adjust + elf_rel->target;
@@ -417,7 +442,7 @@ static void copyToOutputSection(TCCState *s1, OutputSection* output, Section* VE
             }
             case LOCAL_RELOC_LABEL: {
                 int label = elf_rel->source;
-                LinkSymbol* symbol = getLabelSymbol(&label_to_symbol, output, elf_rel->source, k);
+                LinkSymbol* symbol = getLabelSymbol(s1, &label_to_symbol, output, elf_rel->source, k);
                 LinkRelocation* rel = vecPush(output->relocations);
                 rel->type = elf_rel->type;
                 rel->target = offset_adjust + elf_rel->target;
@@ -428,13 +453,13 @@ static void copyToOutputSection(TCCState *s1, OutputSection* output, Section* VE
                 // Will be done later, first, all aliases must be set
                 break;
             case LOCAL_RELOC_ALIAS_LABEL: {
-                LinkSymbol* a = getLabelSymbol(&label_to_symbol, output, elf_rel->source, k);
-                LinkSymbol* b = getLabelSymbol(&label_to_symbol, output, elf_rel->target, k);
+                LinkSymbol* a = getLabelSymbol(s1, &label_to_symbol, output, elf_rel->source, k);
+                LinkSymbol* b = getLabelSymbol(s1, &label_to_symbol, output, elf_rel->target, k);
                 joinSymbolGroups(a, b);
                 break;
             }
             case LOCAL_RELOC_CONST: {
-                LinkSymbol* symbol = addCustomSymbol(NULL, elf_rel->source, "ccvm.loc.rel.c.%d.%d.%d", output->type, k, i);
+                LinkSymbol* symbol = addCustomSymbol(s1, NULL, elf_rel->source, "ccvm.loc.rel.c.%d.%d.%d", output->type, k, i);
                 LinkRelocation* rel = vecPush(output->relocations);
                 rel->type = elf_rel->type;
                 rel->target = offset_adjust + elf_rel->target;
@@ -473,7 +498,7 @@ static void copyToOutputSection(TCCState *s1, OutputSection* output, Section* VE
             if (elf_rel->cmd == LOCAL_RELOC_SET_LABEL) {
                 int offset = offset_adjust + elf_rel->source;
                 int label = elf_rel->target;
-                LinkSymbol* symbol = getLabelSymbol(&label_to_symbol, output, label, k);
+                LinkSymbol* symbol = getLabelSymbol(s1, &label_to_symbol, output, label, k);
                 LinkSymbol* s = symbol;
                 do {
                     if (s->offset != -1 && s->offset != offset) {
@@ -580,15 +605,6 @@ static void copySections(TCCState *s1)
     }
 }
 
-struct
-{
-    uint32_t stackBegin;
-    uint32_t stackSize;
-    uint32_t stackEnd;
-    uint32_t heapBegin;
-    uint32_t heapSize;
-    uint32_t heapEnd;
-} locations;
 
 
 static void generateSection(TCCState *s1, uint32_t* addr, OutputSection* sec, uint8_t VEC* *destination)
@@ -649,9 +665,7 @@ typedef struct MySection {
     uint32_t _reserved;
 } MySection;
 
-static FILE* output_file;
-
-static void write_string(const char* str) {
+static void write_string(FILE* output_file, const char* str) {
     uint32_t len = strlen(str);
     fwrite(&len, sizeof(len), 1, output_file);
     fwrite(str, len, 1, output_file);
@@ -661,11 +675,13 @@ static int ccvm_output_file(TCCState *s1, const char *filename)
 {    
     TRACE("");
     MySection ms;
-    output_file = fopen(filename, "wb");
+    int phase;
+    FILE* output_file = fopen(filename, "wb");
     if (!output_file) {
         tcc_error("Cannot open output file '%s'", filename);
         return -1;
     }
+    phase = tcc_bench_phase(s1, BENCH_OUTPUT);
     for (int i = 1; i < s1->nb_sections; i++) {
         Section* sec = s1->sections[i];
         ms.id = (uint64_t)(uintptr_t)sec;
@@ -691,12 +707,17 @@ static int ccvm_output_file(TCCState *s1, const char *filename)
     memset(&ms, 0, sizeof(ms));
     fwrite(&ms, 1, sizeof(ms), output_file);
     fclose(output_file);
+    tcc_bench_phase(s1, phase);
+    return 0;
 }
 
 static int ccvm_output_fileOLD(TCCState *s1, const char *filename)
 {
     TRACE("");
 
+    if (!s1->ccvm_link) {
+        s1->ccvm_link = tcc_mallocz(sizeof(*s1->ccvm_link));
+    }
     vecAlloc(programMemory, 1024);
     vecAlloc(dataMemory, 1024);
 
@@ -746,3 +767,37 @@ static int ccvm_output_fileOLD(TCCState *s1, const char *filename)
     tcc_exit_state(s1);
     return 0;
 }
+
+static void linkDelete(TCCState *s1)
+{
+    if (!s1->ccvm_link) return;
+    if (link_symbols) {
+        for (LinkSymbol** psym = link_symbols; psym < vecEnd(link_symbols); psym++) {
+            tcc_free(*psym);
+        }
+        vecFree(link_symbols);
+    }
+    if (exports) vecFree(exports);
+    if (imports) vecFree(imports);
+    for (int i = 0; i < OUTPUT_SECTION_COUNT; i++) {
+        if (outputSections[i].data) vecFree(outputSections[i].data);
+        if (outputSections[i].relocations) vecFree(outputSections[i].relocations);
+    }
+    if (programMemory) vecFree(programMemory);
+    if (dataMemory) vecFree(dataMemory);
+    tcc_free(s1->ccvm_link);
+    s1->ccvm_link = NULL;
+}
+
+#undef link_symbols
+#undef elf_symbol_count
+#undef exports
+#undef imports
+#undef outputSections
+#undef elf_symtab
+#undef elf_strtab
+#undef elf_link_symbols
+#undef invalidExport
+#undef programMemory
+#undef dataMemory
+#undef locations
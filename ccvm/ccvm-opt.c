@@ -0,0 +1,371 @@
+#ifdef INTELLISENSE
+#define USING_GLOBALS
+#include "tcc.h"
+#endif
+
+#include "utils.h"
+
+/*
+ * Block-local peephole optimization of each function, enabled with -O1 or higher.
+ *
+ * Code generators emit instructions one expression at a time, so local variables are written
+ * to the frame by one statement and read back by the next one, and values known at compile
+ * time are not propagated between statements. When the function is complete, its instructions
+ * are scanned once more, block by block (label targets and control flow instructions split
+ * blocks, nothing is known at the block beginning):
+ *
+ *   - 32-bit read of a local variable that is still in a register is replaced by MOV_REG
+ *     or removed,
+ *   - write to a local variable is removed if the same variable is written again before
+ *     anything may read it,
+ *   - register known to contain a constant is replaced by the constant in BIN_OP,
+ *   - BIN_OP_CONST on a known constant is folded into MOV_CONST if the flags it sets are
+ *     overwritten before they are used,
+ *   - MOV_CONST and MOV_REG are removed if the register is written again before it is read.
+ *
+ * Instructions are modified in place or removed (replaced by NOOP), so labels stay valid.
+ * Instructions with relocations are never touched. Any memory write, other than to a local
+ * variable at a constant BP offset or to a global variable, is assumed to change all local
+ * variables. Locals that are volatile or have their address taken are pinned by the code
+ * generator (see pin_local) and their accesses are kept as they are.
+ */
+
+#define OPT_ALL_REGS 0xFF
+#define OPT_MAX_SLOTS 16
+
+typedef struct OptInfo {
+    int count;
+    CCVMInstr* code;
+    uint8_t* leader;    /* instruction begins a block */
+    uint8_t* reloc;     /* instruction has a relocation */
+    struct OptSlot* pinned; /* vector of locals that must not be touched, may be NULL */
+} OptInfo;
+
+typedef struct OptSlot {
+    int offset;         /* BP offset of the local variable */
+    int size;
+    int index;          /* register containing the value, or instruction writing it */
+} OptSlot;
+
+static int optIsPinned(OptInfo* info, int offset, int size)
+{
+    OptSlot* slot;
+    if (!info->pinned)
+        return 0;
+    for (slot = info->pinned; slot < vecEnd(info->pinned); slot++) {
+        if (slot->offset < offset + size && offset < slot->offset + slot->size)
+            return 1;
+    }
+    return 0;
+}
+
+static int optIsLabel(CCVMInstr* instr)
+{
+    return instr->opcode == INSTR_LABEL_RELATIVE || instr->opcode == INSTR_LABEL_ABSOLUTE
+        || instr->opcode == INSTR_LABEL_ALIAS;
+}
+
+static int optIsLocalAccess(OptInfo* info, int i)
+{
+    CCVMInstr* instr = &info->code[i];
+    return (instr->opcode == INSTR_READ_CONST || instr->opcode == INSTR_WRITE_CONST)
+        && (instr->op2 & 0x40) && !info->reloc[i];
+}
+
+static void optMarkBlocks(OptInfo* info)
+{
+    int i, target;
+    ElfW_Rel *rel;
+
+    for (i = 0; i < info->count; i++) {
+        CCVMInstr* instr = &info->code[i];
+        switch (instr->opcode) {
+            case INSTR_LABEL_RELATIVE:
+                target = i + instr->address_offset / (int)sizeof(CCVMInstr);
+                if (target >= 0 && target < info->count)
+                    info->leader[target] = 1;
+                break;
+            case INSTR_JUMP_COND_LABEL:
+            case INSTR_JUMP_LABEL:
+            case INSTR_JUMP_CONST:
+            case INSTR_JUMP_REG:
+            case INSTR_CALL_CONST:
+            case INSTR_CALL_REG:
+            case INSTR_CALL_HOST:
+            case INSTR_RETURN:
+                if (i + 1 < info->count)
+                    info->leader[i + 1] = 1;
+                break;
+        }
+    }
+
+    if (cur_text_section->reloc) {
+        for_each_elem(cur_text_section->reloc, 0, rel, ElfW_Rel) {
+            if (rel->r_offset >= (addr_t)func_ind && rel->r_offset < (addr_t)func_ind + info->count * sizeof(CCVMInstr))
+                info->reloc[(rel->r_offset - func_ind) / sizeof(CCVMInstr)] = 1;
+        }
+    }
+}
+
+/* Removes slots overlapping 'size' bytes at 'offset', or all slots if 'size' is 0. */
+static int optDropSlots(OptSlot* slots, int count, int offset, int size)
+{
+    int i, n = 0;
+    for (i = 0; i < count; i++) {
+        if (size && (slots[i].offset >= offset + size || slots[i].offset + slots[i].size <= offset))
+            slots[n++] = slots[i];
+    }
+    return n;
+}
+
+static int optAddSlot(OptSlot* slots, int count, int offset, int size, int index)
+{
+    if (count == OPT_MAX_SLOTS)
+        count = optDropSlots(slots, count, slots[0].offset, slots[0].size);
+    slots[count].offset = offset;
+    slots[count].size = size;
+    slots[count].index = index;
+    return count + 1;
+}
+
+static void optForwardLocals(OptInfo* info)
+{
+    OptSlot values[OPT_MAX_SLOTS];  /* local variables with value in a register */
+    OptSlot stores[OPT_MAX_SLOTS];  /* writes to local variables not read yet */
+    int value_count = 0, store_count = 0;
+    int i, j, r, use, def, offset, size;
+
+    for (i = 0; i < info->count; i++) {
+        CCVMInstr* instr = &info->code[i];
+        if (info->leader[i])
+            value_count = store_count = 0;
+        if (optIsLabel(instr))
+            continue;
+        if (optIsLocalAccess(info, i)) {
+            offset = (int)instr->value;
+            size = 1 << (instr->op2 & 3);
+            r = instr->reg;
+            if (optIsPinned(info, offset, size)) {
+                // Access is kept, it only invalidates what is known about the memory and 'r'
+                store_count = optDropSlots(stores, store_count, offset, size);
+                value_count = optDropSlots(values, value_count, offset, size);
+                for (j = 0; j < value_count; j++) {
+                    if (instr->opcode == INSTR_READ_CONST && values[j].index == r)
+                        values[j--] = values[--value_count];
+                }
+                continue;
+            }
+            if (instr->opcode == INSTR_WRITE_CONST) {
+                for (j = 0; j < store_count; j++) {
+                    if (stores[j].offset >= offset && stores[j].offset + stores[j].size <= offset + size) {
+                        DEBUG_COMMENT("Opt: dead write at 0x%08X removed", func_ind + stores[j].index * (int)sizeof(CCVMInstr));
+                        instrRemove(&info->code[stores[j].index]);
+                    }
+                }
+                store_count = optDropSlots(stores, store_count, offset, size);
+                store_count = optAddSlot(stores, store_count, offset, size, i);
+                value_count = optDropSlots(values, value_count, offset, size);
+                if (size == 4)
+                    value_count = optAddSlot(values, value_count, offset, size, r);
+                continue;
+            }
+            store_count = optDropSlots(stores, store_count, offset, size);
+            for (j = 0; j < value_count; j++) {
+                if (size == 4 && values[j].offset == offset && values[j].size == 4)
+                    break;
+            }
+            if (j < value_count) {
+                DEBUG_COMMENT("Opt: read at 0x%08X replaced by R%d", func_ind + i * (int)sizeof(CCVMInstr), values[j].index);
+                if (values[j].index == r) {
+                    instrRemove(instr);
+                    continue;
+                }
+                memset(instr, 0, sizeof(CCVMInstr));
+                instr->opcode = INSTR_MOV_REG;
+                instr->dstReg = r;
+                instr->srcReg = values[j].index;
+            }
+            for (j = 0; j < value_count; j++) {
+                if (values[j].index == r)
+                    values[j--] = values[--value_count];
+            }
+            if (size == 4)
+                value_count = optAddSlot(values, value_count, offset, size, r);
+            continue;
+        }
+        switch (instr->opcode) {
+            case INSTR_NOOP:
+            case INSTR_MOV_REG:
+            case INSTR_MOV_CONST:
+            case INSTR_BIN_OP:
+            case INSTR_BIN_OP_CONST:
+            case INSTR_BIN_OP64:
+            case INSTR_BIN_OP64_CONST:
+            case INSTR_SETCC:
+            case INSTR_SELECT:
+            case INSTR_BFX:
+            case INSTR_BFI:
+                if (instrRegUsage(instr, &use, &def))
+                    break;
+                /* fall through */
+            default:
+                value_count = store_count = 0;
+                continue;
+            case INSTR_WRITE_CONST:
+                // Write to a global variable does not change local variables
+                if (info->reloc[i] && instrRegUsage(instr, &use, &def))
+                    break;
+                value_count = store_count = 0;
+                continue;
+            case INSTR_READ_CONST:
+            case INSTR_READ_REG:
+            case INSTR_READ_REG_OFFSET:
+            case INSTR_READ_REG_INDEX:
+                // May read a local variable through a pointer
+                store_count = 0;
+                if (!instrRegUsage(instr, &use, &def))
+                    value_count = 0;
+                break;
+        }
+        for (j = 0; j < value_count; j++) {
+            if (def & (1 << values[j].index))
+                values[j--] = values[--value_count];
+        }
+    }
+}
+
+/* Returns 1 if flags set by instruction 'i' are overwritten before they are used. */
+static int optFlagsDead(OptInfo* info, int i)
+{
+    int use, def;
+    for (i++; i < info->count && !info->leader[i]; i++) {
+        CCVMInstr* instr = &info->code[i];
+        switch (instr->opcode) {
+            case INSTR_BIN_OP:
+            case INSTR_BIN_OP_CONST:
+            case INSTR_BIN_OP64:
+            case INSTR_BIN_OP64_CONST:
+                return instr->op2 != BIN_OP_ADDC && instr->op2 != BIN_OP_SUBC;
+            case INSTR_JUMP_COND_LABEL:
+            case INSTR_SETCC:
+            case INSTR_SELECT:
+                return 0;
+        }
+        if (!optIsLabel(instr) && !instrRegUsage(instr, &use, &def))
+            return 0;
+    }
+    return 0;
+}
+
+static int optFoldConst(int op, uint32_t a, uint32_t b, uint32_t* result)
+{
+    switch (op) {
+        case BIN_OP_ADD: *result = a + b; return 1;
+        case BIN_OP_SUB: *result = a - b; return 1;
+        case BIN_OP_MUL: *result = a * b; return 1;
+        case BIN_OP_BITAND: *result = a & b; return 1;
+        case BIN_OP_BITOR: *result = a | b; return 1;
+        case BIN_OP_BITXOR: *result = a ^ b; return 1;
+        case BIN_OP_SHL: if (b >= 32) return 0; *result = a << b; return 1;
+        case BIN_OP_SHR: if (b >= 32) return 0; *result = a >> b; return 1;
+        case BIN_OP_SAR: if (b >= 32) return 0; *result = (uint32_t)((int32_t)a >> b); return 1;
+        default: return 0;
+    }
+}
+
+static void optPropagateConstants(OptInfo* info)
+{
+    int i, r, use, def;
+    int known = 0;
+    uint32_t value[NB_REGS];
+    uint32_t result;
+
+    for (i = 0; i < info->count; i++) {
+        CCVMInstr* instr = &info->code[i];
+        if (info->leader[i])
+            known = 0;
+        if (optIsLabel(instr))
+            continue;
+        if (info->reloc[i]) {
+            // Value is not known until link time
+        } else if (instr->opcode == INSTR_MOV_CONST) {
+            known |= 1 << instr->reg;
+            value[instr->reg] = instr->value;
+            continue;
+        } else if (instr->opcode == INSTR_MOV_REG) {
+            known &= ~(1 << instr->dstReg);
+            if (known & (1 << instr->srcReg)) {
+                known |= 1 << instr->dstReg;
+                value[instr->dstReg] = value[instr->srcReg];
+            }
+            continue;
+        } else if (instr->opcode == INSTR_BIN_OP && instr->op2 != BIN_OP_ADDC && instr->op2 != BIN_OP_SUBC
+            && instr->srcReg != instr->dstReg && (known & (1 << instr->srcReg))) {
+            DEBUG_COMMENT("Opt: R%d replaced by 0x%08X at 0x%08X", instr->srcReg, value[instr->srcReg],
+                func_ind + i * (int)sizeof(CCVMInstr));
+            instr->opcode = INSTR_BIN_OP_CONST;
+            instr->value = value[instr->srcReg];
+            instr->srcReg = 0;
+        }
+        if (!info->reloc[i] && instr->opcode == INSTR_BIN_OP_CONST && (known & (1 << instr->reg))
+            && optFoldConst(instr->op2, value[instr->reg], instr->value, &result) && optFlagsDead(info, i)) {
+            DEBUG_COMMENT("Opt: folded to MOV_CONST R%d = 0x%08X at 0x%08X", instr->reg, result,
+                func_ind + i * (int)sizeof(CCVMInstr));
+            r = instr->reg;
+            memset(instr, 0, sizeof(CCVMInstr));
+            instr->opcode = INSTR_MOV_CONST;
+            instr->reg = r;
+            instr->value = result;
+            value[r] = result;
+            continue;
+        }
+        if (!instrRegUsage(instr, &use, &def))
+            known = 0;
+        else
+            known &= ~def;
+    }
+}
+
+static void optRemoveDeadMoves(OptInfo* info)
+{
+    int i, use, def;
+    int live = OPT_ALL_REGS;
+
+    for (i = info->count - 1; i >= 0; i--) {
+        CCVMInstr* instr = &info->code[i];
+        if (optIsLabel(instr)) {
+            // Not an instruction
+        } else if (!instrRegUsage(instr, &use, &def)) {
+            live = OPT_ALL_REGS;
+        } else if ((instr->opcode == INSTR_MOV_CONST || instr->opcode == INSTR_MOV_REG)
+            && !info->reloc[i] && !(def & live)) {
+            DEBUG_COMMENT("Opt: dead move at 0x%08X removed", func_ind + i * (int)sizeof(CCVMInstr));
+            instrRemove(instr);
+        } else {
+            live = (live & ~def) | use;
+        }
+        if (info->leader[i])
+            live = OPT_ALL_REGS;
+    }
+}
+
+static void optimizeFunction(OptSlot* pinned)
+{
+    OptInfo info;
+
+    info.count = (ind - func_ind) / sizeof(CCVMInstr);
+    if (nocode_wanted || info.count <= 0)
+        return;
+    info.code = (CCVMInstr*)&cur_text_section->data[func_ind];
+    info.leader = tcc_mallocz(info.count);
+    info.reloc = tcc_mallocz(info.count);
+    info.pinned = pinned;
+
+    optMarkBlocks(&info);
+    optForwardLocals(&info);
+    optPropagateConstants(&info);
+    optRemoveDeadMoves(&info);
+
+    tcc_free(info.leader);
+    tcc_free(info.reloc);
+}
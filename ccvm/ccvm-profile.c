@@ -0,0 +1,250 @@
+
+#ifdef INTELLISENSE
+#define USING_GLOBALS
+#include "tcc.h"
+#endif
+
+#include "utils.h"
+
+/*
+ * Guest profiling, see doc/profiling.md for details.
+ *
+ * With -fprofile-arcs, each conditional jump generated by gjmp_cond() gets two counters
+ * in the ".ccvm.profile" section: one incremented before the jump and one incremented
+ * on the fallthrough path. With -fprofile-functions, each function gets a counter
+ * incremented in its prologue. The section is filled with records (32-bit little-endian words):
+ *
+ *   FUNC: (name_length << 8) | 1, name padded with zeros to 4 bytes
+ *   EDGE: (branch_index << 8) | 2, executed count, fallthrough count
+ *   CALLS: 3, call count
+ *
+ * Branch index is an ordinal number of gjmp_cond() call within a function, so it is the same
+ * in instrumented and optimized builds as long as the source code does not change.
+ *
+ * With -fprofile-use=file, the counts are read back and each conditional jump gets a hint
+ * that is used by the linker to invert conditions and reorder basic blocks.
+ *
+ * Counters are passed to the host at exit by a destructor calling imported function:
+ *
+ *   void __ccvm_store_profile(int kind, void* data, unsigned size);
+ *
+ * where kind is PROFILE_KIND_*, one call for each output file.
+ */
+
+#define PROFILE_SECTION_NAME ".ccvm.profile"
+#define PROFILE_IMPORT_INDEX 65535
+
+enum {
+    PROFILE_RECORD_FUNC = 1,
+    PROFILE_RECORD_EDGE = 2,
+    PROFILE_RECORD_CALLS = 3,
+};
+
+enum {
+    PROFILE_KIND_PROFILE = 1, // content of ".ccvm.profile" section
+    PROFILE_KIND_TCOV = 2,    // content of ".tcov" section from -ftest-coverage, see lib/tcov.c
+};
+
+typedef struct ProfileEdge {
+    char* func;
+    int index;
+    uint32_t taken;
+    uint32_t fallthrough;
+} ProfileEdge;
+
+/* instrumentation state, one per TCCState */
+struct _ccvmprofile {
+    Section* section;
+    Sym sym;
+    int branch_index;
+    int fallthrough_offset;
+    VEC ProfileEdge* edges;
+};
+
+#define profile_section             s1->ccvm_profile->section
+#define profile_sym                 s1->ccvm_profile->sym
+#define profile_branch_index        s1->ccvm_profile->branch_index
+#define profile_fallthrough_offset  s1->ccvm_profile->fallthrough_offset
+#define profile_edges               s1->ccvm_profile->edges
+
+
+static int profileEdgeCmp(const void* pa, const void* pb)
+{
+    const ProfileEdge* a = pa;
+    const ProfileEdge* b = pb;
+    int res = strcmp(a->func, b->func);
+    return res ? res : a->index - b->index;
+}
+
+static void profileLoad(TCCState* s1, const char* file_name)
+{
+    char line[1024];
+    char func[512];
+    int index;
+    unsigned long taken, fallthrough;
+    FILE* f = fopen(file_name, "r");
+    if (!f) {
+        tcc_error("cannot open profile '%s'", file_name);
+    }
+    vecAlloc(profile_edges, 256);
+    while (fgets(line, sizeof(line), f)) {
+        // Other records, like "func", are used only by the linker.
+        if (sscanf(line, " edge %511s %d %lu %lu", func, &index, &taken, &fallthrough) != 4) continue;
+        ProfileEdge* edge = vecPush(profile_edges);
+        edge->func = tcc_strdup(func);
+        edge->index = index;
+        edge->taken = taken;
+        edge->fallthrough = fallthrough;
+    }
+    fclose(f);
+    qsort(profile_edges, vecSize(profile_edges), sizeof(ProfileEdge), profileEdgeCmp);
+}
+
+static void profileFree(TCCState* s1)
+{
+    ProfileEdge* edge;
+    if (!profile_edges) return;
+    for (edge = profile_edges; edge < vecEnd(profile_edges); edge++) {
+        tcc_free(edge->func);
+    }
+    vecFree(profile_edges);
+}
+
+/* Returns hint for conditional jump: 1 - jump is likely, -1 - fallthrough is likely, 0 - unknown. */
+static int profileGetHint(int index)
+{
+    TCCState* s1 = tcc_state;
+    ProfileEdge key;
+    ProfileEdge* edge;
+    if (!profile_edges) return 0;
+    key.func = (char*)funcname;
+    key.index = index;
+    edge = bsearch(&key, profile_edges, vecSize(profile_edges), sizeof(ProfileEdge), profileEdgeCmp);
+    if (!edge || edge->taken == edge->fallthrough) return 0;
+    return edge->taken > edge->fallthrough ? 1 : -1;
+}
+
+static void profileWriteWord(uint32_t value)
+{
+    TCCState* s1 = tcc_state;
+    write32le(section_ptr_add(profile_section, 4), value);
+}
+
+static void profileFunctionBegin()
+{
+    TCCState* s1 = tcc_state;
+    int len;
+    profile_branch_index = 0;
+    if (!(s1->profile_arcs || s1->profile_functions) || nocode_wanted) return;
+    if (!profile_section) {
+        profile_section = have_section(s1, PROFILE_SECTION_NAME);
+        if (!profile_section) {
+            profile_section = new_section(s1, PROFILE_SECTION_NAME, SHT_PROGBITS, SHF_ALLOC | SHF_WRITE);
+            profile_section->sh_addralign = 4;
+        }
+    }
+    if (!profile_sym.c) {
+        // All counters of this translation unit are addressed relative to the section beginning.
+        profile_sym.type.t = VT_INT | VT_STATIC;
+        put_extern_sym(&profile_sym, profile_section, 0, 0);
+    }
+    len = strlen(funcname);
+    profileWriteWord((len << 8) | PROFILE_RECORD_FUNC);
+    memcpy(section_ptr_add(profile_section, ALIGN_UP(len, 4)), funcname, len);
+    if (s1->profile_functions) {
+        profileWriteWord(PROFILE_RECORD_CALLS);
+        instrCount(&profile_sym, profile_section->data_offset, 32);
+        profileWriteWord(0);
+    }
+}
+
+/* Called before conditional jump is generated, returns hint for it. */
+static int profileBranchBegin()
+{
+    TCCState* s1 = tcc_state;
+    int index = profile_branch_index++;
+    profile_fallthrough_offset = -1;
+    if (s1->profile_arcs && !nocode_wanted && profile_sym.c) {
+        profileWriteWord((index << 8) | PROFILE_RECORD_EDGE);
+        instrCount(&profile_sym, profile_section->data_offset, 32);
+        profileWriteWord(0);
+        profile_fallthrough_offset = profile_section->data_offset;
+        profileWriteWord(0);
+    }
+    return profileGetHint(index);
+}
+
+/* Called after conditional jump is generated. */
+static void profileBranchEnd()
+{
+    TCCState* s1 = tcc_state;
+    if (profile_fallthrough_offset >= 0) {
+        instrCount(&profile_sym, profile_fallthrough_offset, 32);
+        profile_fallthrough_offset = -1;
+    }
+}
+
+static void profileAddExit(TCCState* s1, Section* sec, const char* data_name, int kind)
+{
+    CString cstr;
+    cstr_new(&cstr);
+    cstr_printf(&cstr,
+        "extern char %s[];"
+        "void __ccvm_store_profile(int kind, void* data, unsigned size);"
+        "__attribute__((section(\".ccvm.import.%d.__ccvm_store_profile\")))"
+        " static void __cc_vm__export_indicator___ccvm_store_profile_(){}"
+        "__attribute__((destructor)) static void %s_exit() {"
+        "__ccvm_store_profile(%d, %s, %u);"
+        "}",
+        data_name, PROFILE_IMPORT_INDEX, data_name, kind, data_name, (unsigned)sec->data_offset);
+    tcc_compile_string_no_debug(s1, cstr.data);
+    cstr_free(&cstr);
+    set_local_sym(s1, data_name, sec, 0);
+}
+
+/* Called from tcc_output_file() to pass profile counters to the host. */
+ST_FUNC void ccvm_profile_add_file(TCCState* s1)
+{
+    if (!(s1->profile_arcs || s1->profile_functions) || !s1->ccvm_profile || !profile_section) return;
+    profileAddExit(s1, profile_section, "__ccvm_profile_data", PROFILE_KIND_PROFILE);
+}
+
+/* Called from tcc_tcov_add_file(), guest cannot write coverage files, so counters are passed to the host. */
+ST_FUNC void ccvm_tcov_add_exit(TCCState* s1)
+{
+    profileAddExit(s1, tcov_section, "__tcov_data", PROFILE_KIND_TCOV);
+}
+
+static void profileInit(TCCState* s1)
+{
+    if (!s1->ccvm_profile) {
+        s1->ccvm_profile = tcc_mallocz(sizeof(*s1->ccvm_profile));
+    }
+    profile_section = NULL;
+    memset(&profile_sym, 0, sizeof(profile_sym));
+    profile_branch_index = 0;
+    profile_fallthrough_offset = -1;
+    if (s1->profile_use) {
+        profileLoad(s1, s1->profile_use);
+    }
+}
+
+static void profileFinish(TCCState* s1)
+{
+    if (!s1->ccvm_profile) return;
+    profileFree(s1);
+}
+
+static void profileDelete(TCCState* s1)
+{
+    if (!s1->ccvm_profile) return;
+    profileFree(s1);
+    tcc_free(s1->ccvm_profile);
+    s1->ccvm_profile = NULL;
+}
+
+#undef profile_section
+#undef profile_sym
+#undef profile_branch_index
+#undef profile_fallthrough_offset
+#undef profile_edges
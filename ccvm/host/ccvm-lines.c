@@ -0,0 +1,85 @@
+#include <string.h>
+
+#include "ccvm-lines.h"
+
+#define LINES_MAGIC "CCVMLINE"
+#define LINES_VERSION 1
+#define LINES_HEADER_SIZE 24
+#define LINES_ENTRY_SIZE 12
+
+static uint32_t read32(const uint8_t* ptr)
+{
+    return (uint32_t)ptr[0] | ((uint32_t)ptr[1] << 8) | ((uint32_t)ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+}
+
+/* Returns index of the last entry with the first word not greater than the key, or -1. */
+static int64_t findEntry(const uint8_t* entries, uint32_t count, uint32_t key)
+{
+    uint32_t low = 0;
+    uint32_t high = count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (read32(entries + (size_t)mid * LINES_ENTRY_SIZE) <= key) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return (int64_t)low - 1;
+}
+
+static const char* getString(const CCVMLineTable* table, uint32_t offset)
+{
+    return offset < table->strings_size ? table->strings + offset : NULL;
+}
+
+int ccvmLinesInit(CCVMLineTable* table, const void* data, size_t size)
+{
+    const uint8_t* ptr = data;
+    uint64_t entries_size;
+
+    memset(table, 0, sizeof(*table));
+    if (size < LINES_HEADER_SIZE || memcmp(ptr, LINES_MAGIC, 8) != 0 || read32(ptr + 8) != LINES_VERSION)
+        return -1;
+    table->line_count = read32(ptr + 12);
+    table->function_count = read32(ptr + 16);
+    table->strings_size = read32(ptr + 20);
+    entries_size = ((uint64_t)table->line_count + table->function_count) * LINES_ENTRY_SIZE;
+    if (LINES_HEADER_SIZE + entries_size + table->strings_size != size)
+        return -1;
+    table->lines = ptr + LINES_HEADER_SIZE;
+    table->functions = table->lines + (size_t)table->line_count * LINES_ENTRY_SIZE;
+    table->strings = (const char*)(table->functions + (size_t)table->function_count * LINES_ENTRY_SIZE);
+    // Every string must be terminated, so it is enough to check the last byte
+    if (table->strings_size > 0 && table->strings[table->strings_size - 1] != '\0')
+        return -1;
+    return 0;
+}
+
+int ccvmLinesLookup(const CCVMLineTable* table, uint32_t pc, CCVMLineInfo* info)
+{
+    int64_t index;
+    const uint8_t* entry;
+
+    memset(info, 0, sizeof(*info));
+
+    index = findEntry(table->functions, table->function_count, pc);
+    if (index >= 0) {
+        entry = table->functions + (size_t)index * LINES_ENTRY_SIZE;
+        if (pc < read32(entry + 4)) {
+            info->function = getString(table, read32(entry + 8));
+            info->function_begin = read32(entry);
+        }
+    }
+
+    index = findEntry(table->lines, table->line_count, pc);
+    if (index >= 0) {
+        entry = table->lines + (size_t)index * LINES_ENTRY_SIZE;
+        info->line = read32(entry + 8);
+        if (info->line != 0) {
+            info->file = getString(table, read32(entry + 4));
+        }
+    }
+
+    return (info->line != 0 || info->function != NULL) ? 0 : -1;
+}
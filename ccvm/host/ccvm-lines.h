@@ -0,0 +1,38 @@
+#ifndef _CCVM_LINES_H_
+#define _CCVM_LINES_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Program counter to source line lookup for the host, e.g. for a sampling profiler.
+ *
+ * The table is generated by the linker ("--lines" option, see bytecode/lines.ts) from
+ * the debug information of code compiled with "-g". The library does not allocate memory
+ * and does not copy the table, so the data must be valid as long as the table is used.
+ * All lookups are O(log n).
+ */
+
+typedef struct CCVMLineTable {
+    const uint8_t* lines;
+    const uint8_t* functions;
+    const char* strings;
+    uint32_t line_count;
+    uint32_t function_count;
+    uint32_t strings_size;
+} CCVMLineTable;
+
+typedef struct CCVMLineInfo {
+    const char* file;         // source file name, NULL if unknown
+    uint32_t line;            // source line number, 0 if unknown
+    const char* function;     // function name, NULL if the address is outside any function
+    uint32_t function_begin;  // function address, valid only if "function" is not NULL
+} CCVMLineInfo;
+
+/* Validates the table content, returns 0 on success, -1 if the data is corrupted. */
+int ccvmLinesInit(CCVMLineTable* table, const void* data, size_t size);
+
+/* Finds source location of the program counter, returns 0 if found, -1 if the address is unknown. */
+int ccvmLinesLookup(const CCVMLineTable* table, uint32_t pc, CCVMLineInfo* info);
+
+#endif // _CCVM_LINES_H_
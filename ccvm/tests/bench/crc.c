@@ -0,0 +1,85 @@
+/*
+ * Benchmark: CRC-32 (table driven and bitwise) and CRC-16/CCITT with a constant table.
+ */
+
+typedef unsigned char uint8_t;
+typedef unsigned short uint16_t;
+typedef unsigned int uint32_t;
+
+#define BUFFER_SIZE 1024
+
+static const uint16_t crc16_table[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+};
+
+static uint32_t crc32_table[256];
+static uint8_t buffer[BUFFER_SIZE];
+
+static void crc32_init(void)
+{
+    uint32_t i, j, c;
+    for (i = 0; i < 256; i++) {
+        c = i;
+        for (j = 0; j < 8; j++)
+            c = (c & 1) ? (c >> 1) ^ 0xEDB88320u : c >> 1;
+        crc32_table[i] = c;
+    }
+}
+
+static uint32_t crc32(const uint8_t *data, int size)
+{
+    uint32_t crc = 0xFFFFFFFFu;
+    while (size--)
+        crc = crc32_table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static uint32_t crc32_bitwise(const uint8_t *data, int size)
+{
+    uint32_t crc = 0xFFFFFFFFu;
+    int i;
+    while (size--) {
+        crc ^= *data++;
+        for (i = 0; i < 8; i++)
+            crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1));
+    }
+    return ~crc;
+}
+
+/* CRC-16/CCITT-FALSE, 4 bits at a time */
+static uint16_t crc16(const uint8_t *data, int size)
+{
+    uint16_t crc = 0xFFFF;
+    while (size--) {
+        crc = (crc << 4) ^ crc16_table[(crc >> 12) ^ (*data >> 4)];
+        crc = (crc << 4) ^ crc16_table[(crc >> 12) ^ (*data & 0x0F)];
+        data++;
+    }
+    return crc;
+}
+
+static uint32_t run(void)
+{
+    static const uint8_t check[] = "123456789";
+    uint32_t seed = 1;
+    uint32_t result;
+    int i;
+
+    crc32_init();
+    if (crc32(check, 9) != 0xCBF43926u || crc32_bitwise(check, 9) != 0xCBF43926u || crc16(check, 9) != 0x29B1)
+        return 0;
+    for (i = 0; i < BUFFER_SIZE; i++) {
+        seed = seed * 1103515245u + 12345u;
+        buffer[i] = seed >> 16;
+    }
+    result = crc32(buffer, BUFFER_SIZE);
+    if (result != crc32_bitwise(buffer, BUFFER_SIZE))
+        return 0;
+    return result ^ crc16(buffer, BUFFER_SIZE);
+}
+
+int main(void)
+{
+    return run() != 0x6A19C416u;
+}
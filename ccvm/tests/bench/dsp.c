@@ -0,0 +1,115 @@
+/*
+ * Benchmark: Q15 fixed-point DSP, a FIR low-pass filter with 64-bit accumulation,
+ * a direct form I biquad, saturation and an integer square root for the RMS level.
+ */
+
+typedef short int16_t;
+typedef int int32_t;
+typedef unsigned int uint32_t;
+typedef long long int64_t;
+
+#define SAMPLES 256
+#define TAPS 16
+
+/* symmetric low-pass in Q15 */
+static const int16_t fir_taps[TAPS] = {
+    -120, -245, -189, 301, 1268, 2569, 3817, 4583,
+    4583, 3817, 2569, 1268, 301, -189, -245, -120,
+};
+
+/* b0, b1, b2, a1, a2 in Q14 */
+static const int16_t biquad_coefs[5] = { 1024, 2048, 1024, -22209, 9922 };
+
+static int16_t input[SAMPLES];
+static int16_t fir_output[SAMPLES];
+static int16_t iir_output[SAMPLES];
+
+static int16_t saturate(int32_t x)
+{
+    if (x > 32767)
+        return 32767;
+    if (x < -32768)
+        return -32768;
+    return (int16_t)x;
+}
+
+static void fir(const int16_t *in, int16_t *out, int count)
+{
+    int n, k;
+    int64_t acc;
+    for (n = 0; n < count; n++) {
+        acc = 0;
+        for (k = 0; k < TAPS && k <= n; k++)
+            acc += (int32_t)fir_taps[k] * in[n - k];
+        out[n] = saturate((int32_t)(acc >> 15));
+    }
+}
+
+static void biquad(const int16_t *in, int16_t *out, int count)
+{
+    int32_t x1 = 0, x2 = 0, y1 = 0, y2 = 0, acc;
+    int n;
+    for (n = 0; n < count; n++) {
+        acc = biquad_coefs[0] * in[n] + biquad_coefs[1] * x1 + biquad_coefs[2] * x2
+            - biquad_coefs[3] * y1 - biquad_coefs[4] * y2;
+        x2 = x1;
+        x1 = in[n];
+        y2 = y1;
+        y1 = saturate(acc >> 14);
+        out[n] = (int16_t)y1;
+    }
+}
+
+static uint32_t isqrt(uint32_t x)
+{
+    uint32_t result = 0, bit = 1u << 30;
+    while (bit > x)
+        bit >>= 2;
+    while (bit) {
+        if (x >= result + bit) {
+            x -= result + bit;
+            result = (result >> 1) + bit;
+        } else {
+            result >>= 1;
+        }
+        bit >>= 2;
+    }
+    return result;
+}
+
+static uint32_t rms(const int16_t *signal, int count)
+{
+    int64_t sum = 0;
+    int n;
+    for (n = 0; n < count; n++)
+        sum += (int32_t)signal[n] * signal[n];
+    return isqrt((uint32_t)(sum / count));
+}
+
+/* square wave with a triangle on top, all in Q15 */
+static void generate(int16_t *out, int count)
+{
+    int n, phase;
+    for (n = 0; n < count; n++) {
+        phase = n & 31;
+        out[n] = saturate(((n & 16) ? 12000 : -12000) + (phase < 16 ? phase : 32 - phase) * 1500 - 12000);
+    }
+}
+
+static uint32_t run(void)
+{
+    uint32_t result = 0;
+    int n;
+
+    generate(input, SAMPLES);
+    fir(input, fir_output, SAMPLES);
+    biquad(input, iir_output, SAMPLES);
+    for (n = 0; n < SAMPLES; n++)
+        result = result * 33 + (uint32_t)(fir_output[n] ^ iir_output[n]);
+    return result ^ rms(input, SAMPLES) << 16 ^ rms(fir_output, SAMPLES) ^ rms(iir_output, SAMPLES) << 8;
+}
+
+int main(void)
+{
+    return run() != 0xDA646E7Bu;
+}
@@ -0,0 +1,195 @@
+/*
+ * Benchmark: state machines, a switch based decoder of SLIP framed packets with
+ * a checksum and a table driven lexer of integer and identifier lists.
+ */
+
+typedef unsigned char uint8_t;
+typedef unsigned int uint32_t;
+
+#define SLIP_END 0xC0
+#define SLIP_ESC 0xDB
+#define SLIP_ESC_END 0xDC
+#define SLIP_ESC_ESC 0xDD
+
+#define MAX_PACKET 64
+#define STREAM_SIZE 2048
+
+enum { STATE_IDLE, STATE_DATA, STATE_ESCAPE, STATE_DROP };
+
+typedef struct Decoder {
+    int state;
+    int length;
+    uint8_t packet[MAX_PACKET];
+    int packets;
+    int errors;
+    uint32_t digest;
+} Decoder;
+
+static uint8_t stream[STREAM_SIZE];
+
+/* the last byte of a packet is the XOR of the other bytes */
+static void packet_done(Decoder *dec)
+{
+    uint8_t sum = 0;
+    int i;
+    if (dec->length < 2) {
+        dec->errors++;
+        return;
+    }
+    for (i = 0; i < dec->length; i++)
+        sum ^= dec->packet[i];
+    if (sum) {
+        dec->errors++;
+        return;
+    }
+    dec->packets++;
+    for (i = 0; i < dec->length - 1; i++)
+        dec->digest = (dec->digest << 3 | dec->digest >> 29) + dec->packet[i];
+}
+
+static void append(Decoder *dec, uint8_t byte)
+{
+    if (dec->length == MAX_PACKET) {
+        dec->errors++;
+        dec->state = STATE_DROP;
+    } else {
+        dec->packet[dec->length++] = byte;
+        dec->state = STATE_DATA;
+    }
+}
+
+static void slip_decode(Decoder *dec, uint8_t byte)
+{
+    switch (dec->state) {
+        case STATE_IDLE:
+            dec->length = 0;
+            if (byte == SLIP_END)
+                break;
+            dec->state = STATE_DATA;
+            /* fallthrough */
+        case STATE_DATA:
+            if (byte == SLIP_END) {
+                packet_done(dec);
+                dec->state = STATE_IDLE;
+            } else if (byte == SLIP_ESC) {
+                dec->state = STATE_ESCAPE;
+            } else {
+                append(dec, byte);
+            }
+            break;
+        case STATE_ESCAPE:
+            if (byte == SLIP_ESC_END) {
+                append(dec, SLIP_END);
+            } else if (byte == SLIP_ESC_ESC) {
+                append(dec, SLIP_ESC);
+            } else {
+                dec->errors++;
+                dec->state = STATE_DROP;
+            }
+            break;
+        case STATE_DROP:
+            if (byte == SLIP_END)
+                dec->state = STATE_IDLE;
+            break;
+    }
+}
+
+static int slip_put(uint8_t *out, uint8_t byte)
+{
+    if (byte == SLIP_END || byte == SLIP_ESC) {
+        out[0] = SLIP_ESC;
+        out[1] = byte == SLIP_END ? SLIP_ESC_END : SLIP_ESC_ESC;
+        return 2;
+    }
+    out[0] = byte;
+    return 1;
+}
+
+/* fills the stream with packets, every 7th one has a bad checksum */
+static int slip_encode_stream(uint8_t *out, int size)
+{
+    uint32_t seed = 7;
+    int pos = 0, count = 0, length, i;
+    uint8_t byte, sum;
+    while (pos + 2 * MAX_PACKET + 2 < size) {
+        seed = seed * 1664525u + 1013904223u;
+        length = 1 + (seed >> 24) % (MAX_PACKET - 1);
+        sum = 0;
+        for (i = 0; i < length; i++) {
+            seed = seed * 1664525u + 1013904223u;
+            byte = (seed >> 16) % 8 == 0 ? SLIP_END : (seed >> 16) % 8 == 1 ? SLIP_ESC : seed >> 20;
+            sum ^= byte;
+            pos += slip_put(out + pos, byte);
+        }
+        pos += slip_put(out + pos, ++count % 7 ? sum : sum ^ 1);
+        out[pos++] = SLIP_END;
+    }
+    return pos;
+}
+
+enum { CLASS_DIGIT, CLASS_ALPHA, CLASS_SPACE, CLASS_COMMA, CLASS_OTHER, CLASS_COUNT };
+enum { LEX_START, LEX_NUMBER, LEX_IDENT, LEX_ERROR, LEX_STATE_COUNT };
+
+/* next state, a token ends when the state changes away from NUMBER or IDENT */
+static const uint8_t lex_next[LEX_STATE_COUNT][CLASS_COUNT] = {
+    /* START  */ { LEX_NUMBER, LEX_IDENT, LEX_START, LEX_START, LEX_ERROR },
+    /* NUMBER */ { LEX_NUMBER, LEX_ERROR, LEX_START, LEX_START, LEX_ERROR },
+    /* IDENT  */ { LEX_IDENT, LEX_IDENT, LEX_START, LEX_START, LEX_ERROR },
+    /* ERROR  */ { LEX_ERROR, LEX_ERROR, LEX_START, LEX_START, LEX_ERROR },
+};
+
+static int char_class(char c)
+{
+    if (c >= '0' && c <= '9')
+        return CLASS_DIGIT;
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_')
+        return CLASS_ALPHA;
+    if (c == ' ' || c == '\t' || c == '\n')
+        return CLASS_SPACE;
+    return c == ',' ? CLASS_COMMA : CLASS_OTHER;
+}
+
+static uint32_t lex(const char *text)
+{
+    int state = LEX_START, next, value = 0;
+    uint32_t result = 0, numbers = 0, idents = 0, errors = 0;
+    do {
+        next = *text ? lex_next[state][char_class(*text)] : LEX_START;
+        if (next == LEX_NUMBER)
+            value = value * 10 + (*text - '0');
+        if (next != state) {
+            if (state == LEX_NUMBER) {
+                numbers++;
+                result += value;
+            } else if (state == LEX_IDENT) {
+                idents++;
+            } else if (next == LEX_ERROR) {
+                errors++;
+            }
+            value = next == LEX_NUMBER ? *text - '0' : 0;
+        }
+        state = next;
+    } while (*text++);
+    return result ^ numbers << 16 ^ idents << 24 ^ errors << 28;
+}
+
+static uint32_t run(void)
+{
+    static const char text[] =
+        "alpha, 12, beta_2, 345 gamma,6789,\n"
+        "  delta 0, 1x, $bad, epsilon, 42, 7, zeta9, 1000000, eta\n";
+    Decoder dec = { STATE_IDLE };
+    int size, i;
+
+    size = slip_encode_stream(stream, STREAM_SIZE);
+    for (i = 0; i < size; i++)
+        slip_decode(&dec, stream[i]);
+    if (dec.state != STATE_IDLE || dec.packets == 0 || dec.errors == 0)
+        return 0;
+    return dec.digest ^ (uint32_t)dec.packets << 20 ^ (uint32_t)dec.errors << 12 ^ lex(text);
+}
+
+int main(void)
+{
+    return run() != 0xE5082405u;
+}
@@ -0,0 +1,153 @@
+/*
+ * Benchmark: FNV-1a and MurmurHash3 (x86, 32-bit) string hashes and an open addressing
+ * hash table of generated keys.
+ */
+
+typedef unsigned char uint8_t;
+typedef unsigned int uint32_t;
+
+#define TABLE_SIZE 1024 /* power of two */
+#define KEY_COUNT 600
+#define KEY_LENGTH 12
+
+typedef struct Entry {
+    char key[KEY_LENGTH];
+    uint32_t value;
+    int used;
+} Entry;
+
+static Entry table[TABLE_SIZE];
+
+static uint32_t fnv1a(const char *str)
+{
+    uint32_t hash = 0x811C9DC5u;
+    while (*str) {
+        hash ^= (uint8_t)*str++;
+        hash *= 0x01000193u;
+    }
+    return hash;
+}
+
+static uint32_t rotl32(uint32_t x, int r)
+{
+    return (x << r) | (x >> (32 - r));
+}
+
+static uint32_t murmur3(const uint8_t *data, int size, uint32_t seed)
+{
+    uint32_t h = seed, k;
+    int i, blocks = size / 4;
+    const uint8_t *tail;
+
+    for (i = 0; i < blocks; i++) {
+        k = data[4 * i] | data[4 * i + 1] << 8 | data[4 * i + 2] << 16 | (uint32_t)data[4 * i + 3] << 24;
+        k *= 0xCC9E2D51u;
+        k = rotl32(k, 15);
+        k *= 0x1B873593u;
+        h ^= k;
+        h = rotl32(h, 13);
+        h = h * 5 + 0xE6546B64u;
+    }
+    tail = data + 4 * blocks;
+    k = 0;
+    switch (size & 3) {
+        case 3: k ^= tail[2] << 16;
+        case 2: k ^= tail[1] << 8;
+        case 1: k ^= tail[0];
+            k *= 0xCC9E2D51u;
+            k = rotl32(k, 15);
+            k *= 0x1B873593u;
+            h ^= k;
+    }
+    h ^= size;
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35u;
+    h ^= h >> 16;
+    return h;
+}
+
+static int str_equal(const char *a, const char *b)
+{
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+static void str_copy(char *dest, const char *src)
+{
+    while ((*dest++ = *src++) != 0) {
+    }
+}
+
+static int str_length(const char *str)
+{
+    const char *s = str;
+    while (*s)
+        s++;
+    return s - str;
+}
+
+/* writes "key" followed by the number in base 36 */
+static void make_key(char *key, int n)
+{
+    static const char digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+    char tmp[8];
+    int len = 0;
+    str_copy(key, "key");
+    key += 3;
+    do {
+        tmp[len++] = digits[n % 36];
+        n /= 36;
+    } while (n);
+    while (len)
+        *key++ = tmp[--len];
+    *key = 0;
+}
+
+static Entry *lookup(const char *key, int insert)
+{
+    uint32_t i = fnv1a(key) & (TABLE_SIZE - 1);
+    while (table[i].used) {
+        if (str_equal(table[i].key, key))
+            return &table[i];
+        i = (i + 1) & (TABLE_SIZE - 1);
+    }
+    if (!insert)
+        return 0;
+    table[i].used = 1;
+    str_copy(table[i].key, key);
+    return &table[i];
+}
+
+static uint32_t run(void)
+{
+    char key[KEY_LENGTH];
+    uint32_t result = 0;
+    Entry *entry;
+    int i;
+
+    if (fnv1a("foobar") != 0xBF9CF968u || murmur3((const uint8_t *)"hello", 5, 0) != 0x248BFA47u)
+        return 0;
+    for (i = 0; i < KEY_COUNT; i++) {
+        make_key(key, i * 7919);
+        lookup(key, 1)->value = murmur3((const uint8_t *)key, str_length(key), 0x9747B28Cu);
+    }
+    for (i = 0; i < 2 * KEY_COUNT; i++) {
+        make_key(key, i * 7919);
+        entry = lookup(key, 0);
+        if ((entry != 0) != (i < KEY_COUNT))
+            return 0;
+        if (entry)
+            result = rotl32(result, 5) ^ entry->value;
+    }
+    return result;
+}
+
+int main(void)
+{
+    return run() != 0xDBA0BC04u;
+}
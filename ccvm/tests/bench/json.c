@@ -0,0 +1,227 @@
+/*
+ * Benchmark: JSON tokenizer with string escapes, numbers and literals, and nesting checks.
+ */
+
+typedef unsigned int uint32_t;
+
+typedef enum TokenType {
+    TOKEN_END,
+    TOKEN_ERROR,
+    TOKEN_BEGIN_OBJECT,
+    TOKEN_END_OBJECT,
+    TOKEN_BEGIN_ARRAY,
+    TOKEN_END_ARRAY,
+    TOKEN_COLON,
+    TOKEN_COMMA,
+    TOKEN_STRING,
+    TOKEN_NUMBER,
+    TOKEN_TRUE,
+    TOKEN_FALSE,
+    TOKEN_NULL,
+    TOKEN_TYPE_COUNT,
+} TokenType;
+
+typedef struct Token {
+    TokenType type;
+    const char *begin;
+    int length;
+    int value;      /* integer part of a number */
+    uint32_t hash;  /* of the decoded string */
+} Token;
+
+typedef struct Tokenizer {
+    const char *pos;
+} Tokenizer;
+
+#define MAX_DEPTH 16
+
+static const char document[] =
+    "{\n"
+    "  \"name\": \"ccvm benchmark\",\n"
+    "  \"version\": 3,\n"
+    "  \"ratio\": -0.125e+2,\n"
+    "  \"enabled\": true,\n"
+    "  \"parent\": null,\n"
+    "  \"tags\": [\"fast\", \"small\", \"esc\\\"aped\\\\\", \"\\u00e9t\\u00e9\", \"tab\\there\"],\n"
+    "  \"matrix\": [[1, 2, 3], [4, 5, 6], [7, 8, 9]],\n"
+    "  \"nested\": {\"a\": {\"b\": {\"c\": [false, true, null, {}, []]}}},\n"
+    "  \"items\": [\n"
+    "    {\"id\": 1, \"price\": 19.99, \"count\": 10},\n"
+    "    {\"id\": 2, \"price\": 5.5, \"count\": 200},\n"
+    "    {\"id\": 3, \"price\": 1e3, \"count\": 0}\n"
+    "  ]\n"
+    "}\n";
+
+static int is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static int hex_value(char c)
+{
+    if (is_digit(c))
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static int match(Tokenizer *tok, const char *literal)
+{
+    const char *p = tok->pos;
+    while (*literal) {
+        if (*p++ != *literal++)
+            return 0;
+    }
+    tok->pos = p;
+    return 1;
+}
+
+static TokenType scan_string(Tokenizer *tok, Token *token)
+{
+    const char *p = tok->pos + 1;
+    uint32_t hash = 5381, ch;
+    int i, digit;
+    while (*p != '"') {
+        if ((unsigned char)*p < 0x20)
+            return TOKEN_ERROR;
+        if (*p == '\\') {
+            p++;
+            switch (*p) {
+                case '"': case '\\': case '/': ch = *p; break;
+                case 'b': ch = '\b'; break;
+                case 'f': ch = '\f'; break;
+                case 'n': ch = '\n'; break;
+                case 'r': ch = '\r'; break;
+                case 't': ch = '\t'; break;
+                case 'u':
+                    ch = 0;
+                    for (i = 0; i < 4; i++) {
+                        digit = hex_value(*++p);
+                        if (digit < 0)
+                            return TOKEN_ERROR;
+                        ch = ch << 4 | digit;
+                    }
+                    break;
+                default:
+                    return TOKEN_ERROR;
+            }
+        } else {
+            ch = (unsigned char)*p;
+        }
+        hash = hash * 33 + ch;
+        p++;
+    }
+    token->hash = hash;
+    tok->pos = p + 1;
+    return TOKEN_STRING;
+}
+
+static TokenType scan_number(Tokenizer *tok, Token *token)
+{
+    const char *p = tok->pos;
+    int negative = 0, value = 0;
+    if (*p == '-') {
+        negative = 1;
+        p++;
+    }
+    if (!is_digit(*p))
+        return TOKEN_ERROR;
+    if (*p == '0') {
+        p++;
+    } else {
+        while (is_digit(*p))
+            value = value * 10 + (*p++ - '0');
+    }
+    if (*p == '.') {
+        p++;
+        if (!is_digit(*p))
+            return TOKEN_ERROR;
+        while (is_digit(*p))
+            p++;
+    }
+    if (*p == 'e' || *p == 'E') {
+        p++;
+        if (*p == '+' || *p == '-')
+            p++;
+        if (!is_digit(*p))
+            return TOKEN_ERROR;
+        while (is_digit(*p))
+            p++;
+    }
+    token->value = negative ? -value : value;
+    tok->pos = p;
+    return TOKEN_NUMBER;
+}
+
+static TokenType scan(Tokenizer *tok, Token *token)
+{
+    while (*tok->pos == ' ' || *tok->pos == '\t' || *tok->pos == '\n' || *tok->pos == '\r')
+        tok->pos++;
+    token->begin = tok->pos;
+    token->value = 0;
+    token->hash = 0;
+    switch (*tok->pos) {
+        case 0: return TOKEN_END;
+        case '{': tok->pos++; return TOKEN_BEGIN_OBJECT;
+        case '}': tok->pos++; return TOKEN_END_OBJECT;
+        case '[': tok->pos++; return TOKEN_BEGIN_ARRAY;
+        case ']': tok->pos++; return TOKEN_END_ARRAY;
+        case ':': tok->pos++; return TOKEN_COLON;
+        case ',': tok->pos++; return TOKEN_COMMA;
+        case '"': return scan_string(tok, token);
+        case 't': return match(tok, "true") ? TOKEN_TRUE : TOKEN_ERROR;
+        case 'f': return match(tok, "false") ? TOKEN_FALSE : TOKEN_ERROR;
+        case 'n': return match(tok, "null") ? TOKEN_NULL : TOKEN_ERROR;
+    }
+    return scan_number(tok, token);
+}
+
+static int next_token(Tokenizer *tok, Token *token)
+{
+    token->type = scan(tok, token);
+    token->length = tok->pos - token->begin;
+    return token->type != TOKEN_END && token->type != TOKEN_ERROR;
+}
+
+/* 0 on error, otherwise a digest of all tokens */
+static uint32_t tokenize(const char *text)
+{
+    Tokenizer tok = { text };
+    Token token;
+    char stack[MAX_DEPTH];
+    int depth = 0, counts[TOKEN_TYPE_COUNT] = { 0 }, i;
+    uint32_t digest = 0;
+
+    while (next_token(&tok, &token)) {
+        counts[token.type]++;
+        if (token.type == TOKEN_BEGIN_OBJECT || token.type == TOKEN_BEGIN_ARRAY) {
+            if (depth == MAX_DEPTH)
+                return 0;
+            stack[depth++] = token.type == TOKEN_BEGIN_OBJECT ? '}' : ']';
+        } else if (token.type == TOKEN_END_OBJECT || token.type == TOKEN_END_ARRAY) {
+            if (depth == 0 || stack[--depth] != (token.type == TOKEN_END_OBJECT ? '}' : ']'))
+                return 0;
+        }
+        digest = (digest << 7 | digest >> 25) ^ (token.type + token.length * 16 + token.value) ^ token.hash;
+    }
+    if (token.type == TOKEN_ERROR || depth != 0)
+        return 0;
+    for (i = 0; i < TOKEN_TYPE_COUNT; i++)
+        digest += counts[i] << (2 * i);
+    return digest;
+}
+
+static uint32_t run(void)
+{
+    if (tokenize("[1, \"unterminated]") != 0 || tokenize("{\"a\": [1}") != 0 || tokenize("[01x]") != 0)
+        return 0;
+    return tokenize(document);
+}
+
+int main(void)
+{
+    return run() != 0x526BD0AAu;
+}
@@ -0,0 +1,132 @@
+/*
+ * Benchmark: insertion sort, recursive quicksort and heapsort of pseudo-random integers.
+ */
+
+typedef unsigned int uint32_t;
+
+#define COUNT 512
+
+static int source[COUNT];
+static int work[COUNT];
+static uint32_t random_state = 2463534242u;
+
+static uint32_t next_random(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+static void copy(int *dest, const int *src, int count)
+{
+    int i;
+    for (i = 0; i < count; i++)
+        dest[i] = src[i];
+}
+
+static void insertion_sort(int *arr, int count)
+{
+    int i, j, value;
+    for (i = 1; i < count; i++) {
+        value = arr[i];
+        for (j = i; j > 0 && arr[j - 1] > value; j--)
+            arr[j] = arr[j - 1];
+        arr[j] = value;
+    }
+}
+
+static void swap(int *a, int *b)
+{
+    int t = *a;
+    *a = *b;
+    *b = t;
+}
+
+static void quick_sort(int *arr, int count)
+{
+    int pivot, i, last;
+    while (count > 16) {
+        swap(&arr[0], &arr[count / 2]);
+        pivot = arr[0];
+        last = 0;
+        for (i = 1; i < count; i++) {
+            if (arr[i] < pivot)
+                swap(&arr[++last], &arr[i]);
+        }
+        swap(&arr[0], &arr[last]);
+        /* recursion on the smaller part keeps the stack shallow */
+        if (last < count - last - 1) {
+            quick_sort(arr, last);
+            arr += last + 1;
+            count -= last + 1;
+        } else {
+            quick_sort(arr + last + 1, count - last - 1);
+            count = last;
+        }
+    }
+    insertion_sort(arr, count);
+}
+
+static void sift_down(int *arr, int root, int count)
+{
+    int child;
+    while ((child = 2 * root + 1) < count) {
+        if (child + 1 < count && arr[child] < arr[child + 1])
+            child++;
+        if (arr[root] >= arr[child])
+            return;
+        swap(&arr[root], &arr[child]);
+        root = child;
+    }
+}
+
+static void heap_sort(int *arr, int count)
+{
+    int i;
+    for (i = count / 2 - 1; i >= 0; i--)
+        sift_down(arr, i, count);
+    for (i = count - 1; i > 0; i--) {
+        swap(&arr[0], &arr[i]);
+        sift_down(arr, 0, i);
+    }
+}
+
+/* 0 if not sorted, otherwise a position weighted checksum */
+static uint32_t checksum(const int *arr, int count)
+{
+    uint32_t sum = 0;
+    int i;
+    for (i = 0; i < count; i++) {
+        if (i > 0 && arr[i - 1] > arr[i])
+            return 0;
+        sum = sum * 31 + (uint32_t)arr[i];
+    }
+    return sum;
+}
+
+static uint32_t run(void)
+{
+    uint32_t result;
+    int i;
+
+    for (i = 0; i < COUNT; i++)
+        source[i] = (int)(next_random() % 100000) - 50000;
+    copy(work, source, COUNT);
+    insertion_sort(work, COUNT);
+    result = checksum(work, COUNT);
+    copy(work, source, COUNT);
+    quick_sort(work, COUNT);
+    if (checksum(work, COUNT) != result)
+        return 0;
+    copy(work, source, COUNT);
+    heap_sort(work, COUNT);
+    if (checksum(work, COUNT) != result)
+        return 0;
+    return result;
+}
+
+int main(void)
+{
+    return run() != 0x3D018752u;
+}
@@ -0,0 +1,371 @@
+/*
+ * Compile speed benchmark of the whole compiler.
+ *
+ * Generates large translation units in <work dir>: many small functions, a huge
+ * initializer, deeply nested macros and a tree of headers. Compiles each of them and
+ * each of the given real files N times with "ccvm-tcc -bench", and reports lines/s
+ * and MB/s (as counted by -bench, including headers) and the peak RSS of the
+ * compiler. Times are wall clock of the whole process, the median of the runs.
+ *
+ *   bench_compile [-n runs] [-t percent] <compiler> <baseline> <work dir> [file...]
+ *       fails if a workload is slower or uses more memory than the baseline
+ *       by more than the tolerance (default 20%)
+ *   bench_compile -u [-n runs] <compiler> <baseline> <work dir> [file...]
+ *       writes a new baseline
+ *
+ * The baseline depends on the machine, update it after moving to another one.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define MAX_WORKLOADS 64
+#define MAX_RUNS 50
+#define MAX_NAME 64
+#define MAX_PATH 1024
+
+typedef struct Result {
+    char name[MAX_NAME];
+    double lines_per_s;
+    double mb_per_s;
+    long peak_rss_kb;
+} Result;
+
+static const char *compiler;
+static const char *work_dir;
+
+static FILE *create_file(const char *name)
+{
+    char path[MAX_PATH];
+    FILE *f;
+    snprintf(path, sizeof(path), "%s/%s", work_dir, name);
+    f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "bench_compile: cannot write %s\n", path);
+        exit(1);
+    }
+    return f;
+}
+
+/* many small functions with locals, loops and calls */
+static void generate_functions(const char *name)
+{
+    FILE *f = create_file(name);
+    int i;
+    fprintf(f, "struct point { int x, y; };\n");
+    for (i = 0; i < 4000; i++) {
+        fprintf(f, "static int func%d(struct point *p, int n)\n{\n", i);
+        fprintf(f, "    int i, sum = %d;\n", i);
+        fprintf(f, "    for (i = 0; i < n; i++)\n");
+        fprintf(f, "        sum += p[i].x * %d - (p[i].y >> %d);\n", i % 17 + 1, i % 5);
+        fprintf(f, "    if (sum > %d)\n        sum ^= n << 2;\n", i * 3);
+        if (i > 0)
+            fprintf(f, "    return sum + func%d(p, n - 1);\n}\n\n", i - 1);
+        else
+            fprintf(f, "    return sum;\n}\n\n");
+    }
+    fprintf(f, "int entry(struct point *p, int n)\n{\n    return func%d(p, n);\n}\n", i - 1);
+    fclose(f);
+}
+
+/* big tables of integers, strings and structures */
+static void generate_initializer(const char *name)
+{
+    FILE *f = create_file(name);
+    unsigned seed = 1;
+    int i;
+    fprintf(f, "const unsigned table[] = {\n");
+    for (i = 0; i < 100000; i++) {
+        seed = seed * 1103515245u + 12345u;
+        fprintf(f, "%s0x%08Xu,%s", i % 8 ? " " : "    ", seed, i % 8 == 7 ? "\n" : "");
+    }
+    fprintf(f, "};\n\nstruct entry { const char *name; int id; short flags[4]; };\n\n");
+    fprintf(f, "const struct entry entries[] = {\n");
+    for (i = 0; i < 10000; i++)
+        fprintf(f, "    { \"entry_%d\", %d, { %d, %d, %d, %d } },\n", i, i * 7, i & 1, i & 3, i & 7, -i);
+    fprintf(f, "};\n");
+    fclose(f);
+}
+
+/* macros nested 32 levels deep, expanded many times, with pasting and stringizing */
+static void generate_macros(const char *name)
+{
+    FILE *f = create_file(name);
+    int i;
+    fprintf(f, "#define CAT(a, b) a##b\n#define STR(a) #a\n#define XSTR(a) STR(a)\n");
+    fprintf(f, "#define M0(x) ((x) + 1)\n");
+    for (i = 1; i < 32; i++)
+        fprintf(f, "#define M%d(x) M%d((x) * 2 + %d)\n", i, i - 1, i);
+    fprintf(f, "#define ADD(a, b) ((a) + (b))\n");
+    fprintf(f, "#define ADD4(a, b, c, d) ADD(ADD(a, b), ADD(c, d))\n");
+    fprintf(f, "#define ADD16(a, b, c, d) ADD4(ADD4(a, b, c, d), ADD4(b, c, d, a), ADD4(c, d, a, b), ADD4(d, a, b, c))\n\n");
+    for (i = 0; i < 400; i++) {
+        fprintf(f, "int CAT(value, %d)(int a, int b)\n{\n", i);
+        fprintf(f, "    const char *s = XSTR(M%d(a));\n", i % 32);
+        fprintf(f, "    return M31(a) + ADD16(a, b, %d, M%d(b)) + s[%d];\n}\n\n", i, i % 32, i % 7);
+    }
+    fclose(f);
+}
+
+#define TREE_DEPTH 5
+#define TREE_WIDTH 4
+
+/* header h<id>.h with declarations, including its children in the tree */
+static int generate_header(int id, int depth)
+{
+    char name[MAX_NAME];
+    FILE *f;
+    int i, next = id + 1, child;
+    snprintf(name, sizeof(name), "h%d.h", id);
+    f = create_file(name);
+    fprintf(f, "#ifndef H%d_H\n#define H%d_H\n\n", id, id);
+    if (depth < TREE_DEPTH) {
+        for (i = 0; i < TREE_WIDTH; i++) {
+            child = next;
+            next = generate_header(child, depth + 1);
+            fprintf(f, "#include \"h%d.h\"\n", child);
+        }
+    }
+    /* every header is also included by its siblings, guards skip it */
+    fprintf(f, "#include \"h%d.h\"\n\n", id > 0 ? id - 1 : 0);
+    fprintf(f, "typedef struct s%d { int a, b; struct s%d *next; } s%d_t;\n", id, id, id);
+    for (i = 0; i < 8; i++)
+        fprintf(f, "int h%d_func%d(s%d_t *p, int x);\n", id, i, id);
+    fprintf(f, "#define H%d_VALUE(x) ((x) + %d)\n", id, id);
+    fprintf(f, "enum { H%d_A = %d, H%d_B, H%d_C };\n\n#endif\n", id, id * 3, id, id);
+    fclose(f);
+    return next;
+}
+
+static void generate_includes(const char *name)
+{
+    FILE *f;
+    int count = generate_header(0, 0), i;
+    f = create_file(name);
+    fprintf(f, "#include \"h0.h\"\n\n");
+    for (i = 0; i < count; i += 7)
+        fprintf(f, "int use%d(s%d_t *p) { return h%d_func0(p, H%d_VALUE(H%d_B)); }\n", i, i, i, i, i);
+    fclose(f);
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* runs the compiler once, returns 0 on success */
+static int compile(const char *file, double *time, long *lines, long *bytes, long *rss_kb)
+{
+    char output[MAX_PATH], include[MAX_PATH], text[4096];
+    int pipe_fd[2], status, null_fd;
+    struct rusage usage;
+    double start;
+    pid_t pid;
+    size_t len = 0;
+    ssize_t n;
+    const char *p;
+
+    snprintf(output, sizeof(output), "%s/out.o", work_dir);
+    snprintf(include, sizeof(include), "-I%s", work_dir);
+    if (pipe(pipe_fd) != 0)
+        return -1;
+    start = now_s();
+    pid = fork();
+    if (pid == 0) {
+        /* the compiler listing goes to stdout, statistics to stderr */
+        null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, 1);
+        dup2(pipe_fd[1], 2);
+        close(pipe_fd[0]);
+        execl(compiler, compiler, "-bench", "-I../include", include, "-c", file, "-o", output, (char *)NULL);
+        _exit(127);
+    }
+    close(pipe_fd[1]);
+    if (pid < 0) {
+        close(pipe_fd[0]);
+        return -1;
+    }
+    while ((n = read(pipe_fd[0], text + len, sizeof(text) - 1 - len)) > 0)
+        len += n;
+    text[len] = 0;
+    close(pipe_fd[0]);
+    if (wait4(pid, &status, 0, &usage) < 0)
+        return -1;
+    *time = now_s() - start;
+    *rss_kb = usage.ru_maxrss;
+    p = strstr(text, " idents, ");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || !p
+        || sscanf(p, " idents, %ld lines, %ld bytes", lines, bytes) != 2) {
+        fprintf(stderr, "bench_compile: compilation of %s failed:\n%s", file, text);
+        return -1;
+    }
+    return 0;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int measure(const char *file, int runs, Result *result)
+{
+    double times[MAX_RUNS], time;
+    long lines = 0, bytes = 0, rss_kb;
+    const char *base = strrchr(file, '/');
+    const char *dot;
+    int i;
+
+    base = base ? base + 1 : file;
+    dot = strrchr(base, '.');
+    snprintf(result->name, sizeof(result->name), "%.*s", dot ? (int)(dot - base) : (int)strlen(base), base);
+    result->peak_rss_kb = 0;
+    for (i = 0; i < runs; i++) {
+        if (compile(file, &times[i], &lines, &bytes, &rss_kb) != 0)
+            return -1;
+        if (rss_kb > result->peak_rss_kb)
+            result->peak_rss_kb = rss_kb;
+    }
+    qsort(times, runs, sizeof(times[0]), compare_double);
+    time = runs % 2 ? times[runs / 2] : (times[runs / 2 - 1] + times[runs / 2]) / 2;
+    result->lines_per_s = lines / time;
+    result->mb_per_s = bytes / time / 1e6;
+    return 0;
+}
+
+/* returns number of entries read, -1 if the file cannot be opened */
+static int read_baseline(const char *file, Result *baseline, int max)
+{
+    char line[256];
+    int count = 0;
+    FILE *f = fopen(file, "r");
+    if (!f)
+        return -1;
+    while (count < max && fgets(line, sizeof(line), f)) {
+        Result *r = &baseline[count];
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        if (sscanf(line, "%63s %lf %lf %ld", r->name, &r->lines_per_s, &r->mb_per_s, &r->peak_rss_kb) == 4)
+            count++;
+    }
+    fclose(f);
+    return count;
+}
+
+static int write_baseline(const char *file, const Result *results, int count)
+{
+    int i;
+    FILE *f = fopen(file, "w");
+    if (!f) {
+        fprintf(stderr, "bench_compile: cannot write %s\n", file);
+        return -1;
+    }
+    fprintf(f, "# ccvm-tcc compile speed baseline, update with \"make bench_compile_update\"\n");
+    fprintf(f, "# name lines/s MB/s peak_rss_kb\n");
+    for (i = 0; i < count; i++)
+        fprintf(f, "%s %.0f %.2f %ld\n", results[i].name, results[i].lines_per_s, results[i].mb_per_s, results[i].peak_rss_kb);
+    fclose(f);
+    return 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: bench_compile [-u] [-n runs] [-t percent] <compiler> <baseline> <work dir> [file...]\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct {
+        const char *file;
+        void (*generate)(const char *name);
+    } generated[] = {
+        { "functions.c", generate_functions },
+        { "initializer.c", generate_initializer },
+        { "macros.c", generate_macros },
+        { "includes.c", generate_includes },
+    };
+    static Result results[MAX_WORKLOADS], baseline[MAX_WORKLOADS];
+    char path[MAX_PATH];
+    const char *baseline_file;
+    int update = 0, runs = 5, tolerance = 20, count = 0, base_count, i, j, failed = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "un:t:")) != -1) {
+        switch (opt) {
+            case 'u': update = 1; break;
+            case 'n': runs = atoi(optarg); break;
+            case 't': tolerance = atoi(optarg); break;
+            default: usage();
+        }
+    }
+    if (argc - optind < 3 || runs < 1 || runs > MAX_RUNS || tolerance < 0)
+        usage();
+    compiler = argv[optind];
+    baseline_file = argv[optind + 1];
+    work_dir = argv[optind + 2];
+    if (argc - optind - 3 + (int)(sizeof(generated) / sizeof(generated[0])) > MAX_WORKLOADS)
+        usage();
+    mkdir(work_dir, 0777);
+
+    for (i = 0; i < (int)(sizeof(generated) / sizeof(generated[0])); i++) {
+        generated[i].generate(generated[i].file);
+        snprintf(path, sizeof(path), "%s/%s", work_dir, generated[i].file);
+        if (measure(path, runs, &results[count++]) != 0)
+            return 1;
+    }
+    for (i = optind + 3; i < argc; i++) {
+        if (measure(argv[i], runs, &results[count++]) != 0)
+            return 1;
+    }
+    if (update)
+        return write_baseline(baseline_file, results, count) != 0;
+
+    base_count = read_baseline(baseline_file, baseline, MAX_WORKLOADS);
+    if (base_count < 0) {
+        fprintf(stderr, "bench_compile: cannot read %s\n", baseline_file);
+        base_count = 0;
+        failed = 1;
+    }
+    printf("%-14s %10s %8s %8s %8s %11s %8s\n", "workload", "lines/s", "", "MB/s", "", "peak RSS kB", "");
+    for (i = 0; i < count; i++) {
+        Result *r = &results[i];
+        Result *b = NULL;
+        for (j = 0; j < base_count; j++) {
+            if (strcmp(baseline[j].name, r->name) == 0)
+                b = &baseline[j];
+        }
+        printf("%-14s %10.0f", r->name, r->lines_per_s);
+        if (b) {
+            printf(" %+7.1f%% %8.2f %+7.1f%% %11ld %+7.1f%%", (r->lines_per_s / b->lines_per_s - 1) * 100,
+                   r->mb_per_s, (r->mb_per_s / b->mb_per_s - 1) * 100,
+                   r->peak_rss_kb, ((double)r->peak_rss_kb / b->peak_rss_kb - 1) * 100);
+        } else {
+            printf(" %8s %8.2f %8s %11ld %8s", "", r->mb_per_s, "", r->peak_rss_kb, "");
+        }
+        if (!b) {
+            printf(" not in baseline");
+            failed = 1;
+        } else if (r->lines_per_s * 100 < b->lines_per_s * (100 - tolerance)
+                   || r->peak_rss_kb * 100 > b->peak_rss_kb * (100 + tolerance)) {
+            printf(" REGRESSION");
+            failed = 1;
+        }
+        printf("\n");
+    }
+    if (failed)
+        fprintf(stderr, "bench_compile: FAILED, if the change is expected, run \"make bench_compile_update\"\n");
+    else
+        fprintf(stderr, "bench_compile: %d workloads OK\n", count);
+    return failed;
+}
@@ -0,0 +1,161 @@
+/*
+ * Benchmark of the ccvm runtime heap allocator (lib/ccvm/malloc.c) built for the host.
+ *
+ * It simulates per message allocations: a pool of live blocks where each step frees
+ * a random block and allocates a new one of a random size, mostly small with some big ones.
+ * The pool size changes from run to run, so the time per operation should stay
+ * the same if the allocator is constant time. "live MB" is the peak of the allocated bytes and
+ * "heap MB" the highest heap address used, the difference is the fragmentation. Times include
+ * the clock reading. The content of the blocks is verified, so the benchmark is also a test
+ * of the allocator.
+ */
+
+#define HEAP_SIZE (64 * 1024 * 1024)
+
+/* end marker block is written as a whole Block struct, keep the host compiler happy */
+static char bench_heap[HEAP_SIZE + sizeof(void*) * 4];
+
+#define CCVM_HEAP_BEGIN bench_heap
+#define CCVM_HEAP_END (bench_heap + HEAP_SIZE)
+#define malloc ccvm_malloc
+#define free ccvm_free
+#define realloc ccvm_realloc
+#define calloc ccvm_calloc
+
+#include "../../lib/ccvm/malloc.c"
+
+#undef malloc
+#undef free
+#undef realloc
+#undef calloc
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define STEPS 2000000
+
+typedef struct Slot {
+    unsigned char* ptr;
+    size_t size;
+} Slot;
+
+static uint32_t random_state = 12345;
+
+static uint32_t next_random(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+static size_t random_size(void)
+{
+    uint32_t r = next_random();
+    if (r % 100 < 90) return 8 + r % 256;
+    if (r % 100 < 99) return 256 + r % 4096;
+    return 4096 + r % 65536;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void fill(Slot* slot)
+{
+    memset(slot->ptr, (int)(slot->size & 0xFF), slot->size);
+}
+
+static int check(Slot* slot)
+{
+    size_t i;
+    for (i = 0; i < slot->size; i++) {
+        if (slot->ptr[i] != (slot->size & 0xFF)) return 0;
+    }
+    return 1;
+}
+
+static int run(int live)
+{
+    Slot* slots = calloc(live, sizeof(Slot));
+    uint64_t start, time, worst = 0, total = 0;
+    size_t used = 0, peak = 0, top = 0;
+    long failed = 0;
+    int i, errors = 0;
+
+    memset(&heap, 0, sizeof(heap));
+
+    for (i = 0; i < STEPS; i++) {
+        Slot* slot = &slots[next_random() % live];
+        size_t size = random_size();
+        int resize = slot->ptr && next_random() % 8 == 0;
+        unsigned char* ptr;
+        if (slot->ptr && !check(slot)) errors++;
+        start = now_ns();
+        if (resize) {
+            ptr = ccvm_realloc(slot->ptr, size);
+        } else {
+            ccvm_free(slot->ptr);
+            ptr = ccvm_malloc(size);
+        }
+        time = now_ns() - start;
+        if (resize && ptr) {
+            size_t keep = size < slot->size ? size : slot->size;
+            size_t j;
+            for (j = 0; j < keep; j++) {
+                if (ptr[j] != (slot->size & 0xFF)) { errors++; break; }
+            }
+        }
+        if (ptr) {
+            used = used - slot->size + size;
+            slot->ptr = ptr;
+            slot->size = size;
+            fill(slot);
+            if ((size_t)(ptr + size - (unsigned char*)bench_heap) > top) top = ptr + size - (unsigned char*)bench_heap;
+        } else {
+            if (!resize) {
+                used -= slot->size;
+                slot->ptr = NULL;
+                slot->size = 0;
+            }
+            failed++;
+        }
+        if (used > peak) peak = used;
+        total += time;
+        if (time > worst) worst = time;
+    }
+
+    printf("%8d %10.1f %10.1f %10.1f %10.1f %8ld\n", live, (double)total / STEPS, (double)worst / 1000.0,
+           (double)peak / (1024 * 1024), (double)top / (1024 * 1024), failed);
+
+    for (i = 0; i < live; i++) {
+        if (slots[i].ptr && !check(&slots[i])) errors++;
+        ccvm_free(slots[i].ptr);
+    }
+    free(slots);
+    return errors;
+}
+
+int main()
+{
+    static const int live_counts[] = { 100, 1000, 10000, 40000 };
+    int errors = 0;
+    unsigned i;
+    // Touch the heap first, so page faults are not measured
+    memset(bench_heap, 0, sizeof(bench_heap));
+    printf("%8s %10s %10s %10s %10s %8s\n", "blocks", "avg ns", "worst us", "live MB", "heap MB", "failed");
+    for (i = 0; i < sizeof(live_counts) / sizeof(live_counts[0]); i++) {
+        errors += run(live_counts[i]);
+    }
+    if (errors) {
+        printf("bench_malloc: %d corrupted blocks\n", errors);
+        return 1;
+    }
+    return 0;
+}
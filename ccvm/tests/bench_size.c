@@ -0,0 +1,208 @@
+/*
+ * Code size regression check of the ccvm backend.
+ *
+ * Reads object files compiled from tests/bench/ and compares them with a checked-in
+ * baseline. For each benchmark it reports bytes of the text sections, bytes of
+ * the read-only data sections and the number of instructions. Text bytes include
+ * label pseudo-instructions, the instruction count does not, nor does it count
+ * instructions removed by the optimizer.
+ *
+ *   bench_size <baseline> <object>...      fails if any number grew or a benchmark is new
+ *   bench_size -u <baseline> <object>...   writes a new baseline
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "elf.h"
+#include "ccvm/ccvm-instr.h"
+#include "test_utils.h"
+
+#define INSTR_SIZE 12
+
+#define MAX_NAME 64
+#define MAX_BENCHMARKS 256
+
+typedef struct Result {
+    char name[MAX_NAME];
+    long text;
+    long rodata;
+    long instructions;
+} Result;
+
+static int starts_with(const char *str, const char *prefix)
+{
+    return strncmp(str, prefix, strlen(prefix)) == 0;
+}
+
+static unsigned read32(const unsigned char *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (unsigned)p[3] << 24;
+}
+
+static int count_instructions(const unsigned char *code, long size)
+{
+    int count = 0;
+    long i;
+    for (i = 0; i + INSTR_SIZE <= size; i += INSTR_SIZE) {
+        switch (code[i]) {
+            case INSTR_LABEL_RELATIVE:
+            case INSTR_LABEL_ABSOLUTE:
+            case INSTR_LABEL_ALIAS:
+                break;
+            case INSTR_NOOP:
+                if (read32(code + i + 4) != 0)
+                    count++;
+                break;
+            default:
+                count++;
+                break;
+        }
+    }
+    return count;
+}
+
+/* returns 0 on success */
+static int measure(const char *file, Result *result)
+{
+    const char *base = strrchr(file, '/');
+    const char *dot;
+    const char *names;
+    Elf32_Ehdr *ehdr;
+    Elf32_Shdr *shdr;
+    long size;
+    int i;
+    char *data = read_file(file, &size);
+
+    memset(result, 0, sizeof(*result));
+    base = base ? base + 1 : file;
+    dot = strrchr(base, '.');
+    snprintf(result->name, sizeof(result->name), "%.*s", dot ? (int)(dot - base) : (int)strlen(base), base);
+    if (!data) {
+        fprintf(stderr, "bench_size: cannot read %s\n", file);
+        return -1;
+    }
+    ehdr = (Elf32_Ehdr *)data;
+    if (size < (long)sizeof(*ehdr) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0
+        || ehdr->e_ident[EI_CLASS] != ELFCLASS32 || ehdr->e_shoff + (long)ehdr->e_shnum * sizeof(*shdr) > (unsigned long)size) {
+        fprintf(stderr, "bench_size: %s is not a ccvm object file\n", file);
+        free(data);
+        return -1;
+    }
+    shdr = (Elf32_Shdr *)(data + ehdr->e_shoff);
+    names = data + shdr[ehdr->e_shstrndx].sh_offset;
+    for (i = 1; i < ehdr->e_shnum; i++) {
+        const char *name = names + shdr[i].sh_name;
+        if (strcmp(name, ".text") == 0 || starts_with(name, ".text.")) {
+            result->text += shdr[i].sh_size;
+            result->instructions += count_instructions((unsigned char *)data + shdr[i].sh_offset, shdr[i].sh_size);
+        } else if (strcmp(name, ".data.ro") == 0 || starts_with(name, ".data.ro.")) {
+            result->rodata += shdr[i].sh_size;
+        }
+    }
+    free(data);
+    return 0;
+}
+
+/* returns number of entries read, -1 if the file cannot be opened */
+static int read_baseline(const char *file, Result *baseline, int max)
+{
+    char line[256];
+    int count = 0;
+    FILE *f = fopen(file, "r");
+    if (!f)
+        return -1;
+    while (count < max && fgets(line, sizeof(line), f)) {
+        Result *r = &baseline[count];
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        if (sscanf(line, "%63s %ld %ld %ld", r->name, &r->text, &r->rodata, &r->instructions) == 4)
+            count++;
+    }
+    fclose(f);
+    return count;
+}
+
+static int write_baseline(const char *file, const Result *results, int count)
+{
+    int i;
+    FILE *f = fopen(file, "w");
+    if (!f) {
+        fprintf(stderr, "bench_size: cannot write %s\n", file);
+        return -1;
+    }
+    fprintf(f, "# ccvm code size baseline, update with \"make bench_size_update\"\n");
+    fprintf(f, "# name text rodata instructions\n");
+    for (i = 0; i < count; i++)
+        fprintf(f, "%s %ld %ld %ld\n", results[i].name, results[i].text, results[i].rodata, results[i].instructions);
+    fclose(f);
+    return 0;
+}
+
+static void print_value(long value, long base, int has_base)
+{
+    char delta[32] = "";
+    if (has_base && value != base)
+        snprintf(delta, sizeof(delta), "(%+ld)", value - base);
+    printf(" %8ld %-8s", value, delta);
+}
+
+int main(int argc, char **argv)
+{
+    static Result results[MAX_BENCHMARKS], baseline[MAX_BENCHMARKS];
+    int update = 0, count, base_count, i, j, failed = 0, improved = 0;
+
+    if (argc > 1 && strcmp(argv[1], "-u") == 0) {
+        update = 1;
+        argc--;
+        argv++;
+    }
+    if (argc < 3 || argc - 2 > MAX_BENCHMARKS) {
+        fprintf(stderr, "usage: bench_size [-u] <baseline> <object>...\n");
+        return 1;
+    }
+    count = argc - 2;
+    for (i = 0; i < count; i++) {
+        if (measure(argv[i + 2], &results[i]) != 0)
+            return 1;
+    }
+    if (update)
+        return write_baseline(argv[1], results, count) != 0;
+
+    base_count = read_baseline(argv[1], baseline, MAX_BENCHMARKS);
+    if (base_count < 0) {
+        fprintf(stderr, "bench_size: cannot read %s\n", argv[1]);
+        base_count = 0;
+        failed = 1;
+    }
+    printf("%-12s %8s %-8s %8s %-8s %8s %-8s\n", "benchmark", "text", "", "rodata", "", "instr", "");
+    for (i = 0; i < count; i++) {
+        Result *r = &results[i];
+        Result *b = NULL;
+        for (j = 0; j < base_count; j++) {
+            if (strcmp(baseline[j].name, r->name) == 0)
+                b = &baseline[j];
+        }
+        printf("%-12s", r->name);
+        print_value(r->text, b ? b->text : 0, b != NULL);
+        print_value(r->rodata, b ? b->rodata : 0, b != NULL);
+        print_value(r->instructions, b ? b->instructions : 0, b != NULL);
+        if (!b) {
+            printf(" not in baseline");
+            failed = 1;
+        } else if (r->text > b->text || r->rodata > b->rodata || r->instructions > b->instructions) {
+            printf(" REGRESSION");
+            failed = 1;
+        } else if (r->text < b->text || r->rodata < b->rodata || r->instructions < b->instructions) {
+            improved = 1;
+        }
+        printf("\n");
+    }
+    if (failed)
+        fprintf(stderr, "bench_size: FAILED, if the change is expected, run \"make bench_size_update\"\n");
+    else if (improved)
+        fprintf(stderr, "bench_size: %d benchmarks OK, smaller than the baseline, run \"make bench_size_update\"\n", count);
+    else
+        fprintf(stderr, "bench_size: %d benchmarks OK\n", count);
+    return failed;
+}
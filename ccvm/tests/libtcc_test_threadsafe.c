@@ -0,0 +1,245 @@
+/*
+ * Thread safety test for libtcc with the ccvm backend
+ *
+ * Compiles the same program in many threads, each thread with its own TCCState,
+ * and checks that every output is identical to the output of a single state
+ * created before the threads were started. tcc_compile() itself is serialized by
+ * the compile semaphore (the tccgen and tccpp globals are shared), so this shows
+ * that states can be used from several threads, not that they compile in parallel. Each thread also preprocesses the
+ * program (-E) and passes an assembler file, which the ccvm backend rejects with
+ * an error, so states that never generate code are covered too.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "libtcc.h"
+#include "test_utils.h"
+
+#define M 20 /* number of threads */
+#define N 4  /* number of compilations in each thread */
+
+#ifdef _WIN32
+#include <windows.h>
+#define TF_TYPE(func, param) DWORD WINAPI func(void *param)
+typedef TF_TYPE(ThreadFunc, x);
+HANDLE hh[M];
+void create_thread(ThreadFunc f, int n)
+{
+    DWORD tid;
+    hh[n] = CreateThread(NULL, 0, f, (void*)(size_t)n, 0, &tid);
+}
+void wait_threads(int n)
+{
+    WaitForMultipleObjects(n, hh, TRUE, INFINITE);
+    while (n)
+        CloseHandle(hh[--n]);
+}
+#else
+#include <pthread.h>
+#define TF_TYPE(func, param) void* func(void *param)
+typedef TF_TYPE(ThreadFunc, x);
+pthread_t hh[M];
+void create_thread(ThreadFunc f, int n)
+{
+    pthread_create(&hh[n], NULL, f, (void*)(size_t)n);
+}
+void wait_threads(int n)
+{
+    while (n)
+        pthread_join(hh[--n], NULL);
+}
+#endif
+
+const char my_program[] =
+"#define CCVM_IMPORT(index, name) \\\n"
+"    __attribute__((section(\".ccvm.import.\" #index \".\" #name))) \\\n"
+"    static void __cc_vm__export_indicator_##name##_() {}\n"
+"CCVM_IMPORT(1, add);\n"
+"int add(int a, int b);\n"
+"int fib(int n)\n"
+"{\n"
+"    if (n <= 2)\n"
+"        return 1;\n"
+"    else\n"
+"        return add(fib(n-1), fib(n-2));\n"
+"}\n"
+"int sum(int *arr, int n)\n"
+"{\n"
+"    int i, s = 0;\n"
+"    for (i = 0; i < n; i++)\n"
+"        s += arr[i] > 0 ? arr[i] : -arr[i];\n"
+"    return s;\n"
+"}\n"
+"int foo(int n)\n"
+"{\n"
+"    int arr[4] = { n, -n, fib(n), 3 };\n"
+"    switch (n) {\n"
+"        case 1: return 7;\n"
+"        case 5: return sum(arr, 2);\n"
+"        default: return sum(arr, 4);\n"
+"    }\n"
+"}\n";
+
+const char my_asm[] = "nop\n";
+
+int g_argc; char **g_argv;
+const char *g_output_dir;
+char g_asm_file[1024];
+int errors[M];
+
+void handle_error(void *opaque, const char *msg)
+{
+    fprintf(stderr, "%s\n", msg);
+}
+
+/* counts errors that are expected */
+void count_error(void *opaque, const char *msg)
+{
+    ++*(int *)opaque;
+}
+
+TCCState *new_state(void)
+{
+    TCCState *s;
+    int i;
+
+    s = tcc_new();
+    if (!s)
+        return NULL;
+    tcc_set_error_func(s, NULL, handle_error);
+    for (i = 1; i < g_argc; ++i) {
+        if (g_argv[i][0] == '-' && g_argv[i][1] == 'I')
+            tcc_add_include_path(s, g_argv[i] + 2);
+    }
+    return s;
+}
+
+/* compiles the program into an object file, returns 0 on success */
+int compile(const char *output)
+{
+    TCCState *s;
+    int ret;
+
+    s = new_state();
+    if (!s)
+        return -1;
+    /* profile instrumentation adds its own state and compiles extra code on output */
+    tcc_set_options(s, "-w -fprofile-arcs -fprofile-functions");
+    tcc_set_output_type(s, TCC_OUTPUT_OBJ);
+    ret = tcc_compile_string(s, my_program);
+    if (ret >= 0)
+        ret = tcc_output_file(s, output);
+    tcc_delete(s);
+    return ret < 0 ? -1 : 0;
+}
+
+/* preprocesses the program to stdout, returns 0 on success */
+int preprocess(void)
+{
+    TCCState *s;
+    int ret;
+
+    s = new_state();
+    if (!s)
+        return -1;
+    tcc_set_output_type(s, TCC_OUTPUT_PREPROCESS);
+    ret = tcc_compile_string(s, my_program);
+    tcc_delete(s);
+    return ret < 0 ? -1 : 0;
+}
+
+/* the ccvm backend has no assembler, returns 0 if the file fails with an error */
+int assemble(void)
+{
+    TCCState *s;
+    int ret, nb_errors = 0;
+
+    s = new_state();
+    if (!s)
+        return -1;
+    tcc_set_error_func(s, &nb_errors, count_error);
+    tcc_set_output_type(s, TCC_OUTPUT_OBJ);
+    ret = tcc_add_file(s, g_asm_file);
+    tcc_delete(s);
+    return ret < 0 && nb_errors > 0 ? 0 : -1;
+}
+
+/* returns 0 if both files have the same content */
+int compare_files(const char *a, const char *b)
+{
+    long size_a, size_b;
+    char *data_a = read_file(a, &size_a);
+    char *data_b = read_file(b, &size_b);
+    int ret = !data_a || !data_b || size_a != size_b || memcmp(data_a, data_b, size_a) != 0;
+    free(data_a);
+    free(data_b);
+    return ret;
+}
+
+TF_TYPE(thread_test, vn)
+{
+    int n = (size_t)vn;
+    int i;
+    char output[1024];
+
+    for (i = 0; i < N; i++) {
+        snprintf(output, sizeof(output), "%s/mt_%d_%d.o", g_output_dir, n, i);
+        if (compile(output) != 0 || preprocess() != 0 || assemble() != 0) {
+            errors[n]++;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int n, i, failed = 0;
+    char reference[1024];
+    char output[1024];
+    FILE *f;
+
+    g_argc = argc;
+    g_argv = argv;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: libtcc_test_threadsafe <output directory> <options>\n");
+        return 1;
+    }
+    g_output_dir = argv[1];
+
+    snprintf(g_asm_file, sizeof(g_asm_file), "%s/mt_asm.s", g_output_dir);
+    f = fopen(g_asm_file, "w");
+    if (!f || fputs(my_asm, f) < 0 || fclose(f) != 0) {
+        fprintf(stderr, "cannot write %s\n", g_asm_file);
+        return 1;
+    }
+
+    snprintf(reference, sizeof(reference), "%s/mt_reference.o", g_output_dir);
+    if (compile(reference) != 0) {
+        fprintf(stderr, "reference compilation failed\n");
+        return 1;
+    }
+
+    for (n = 0; n < M; ++n)
+        create_thread(thread_test, n);
+    wait_threads(n);
+
+    for (n = 0; n < M; ++n) {
+        if (errors[n]) {
+            fprintf(stderr, "thread %d: %d compilations failed\n", n, errors[n]);
+            failed = 1;
+            continue;
+        }
+        for (i = 0; i < N; i++) {
+            snprintf(output, sizeof(output), "%s/mt_%d_%d.o", g_output_dir, n, i);
+            if (compare_files(reference, output) != 0) {
+                fprintf(stderr, "%s differs from the reference\n", output);
+                failed = 1;
+            }
+        }
+    }
+
+    fprintf(stderr, failed ? "libtcc_test_threadsafe: FAILED\n" : "libtcc_test_threadsafe: %d states OK\n", M * N);
+    return failed;
+}
@@ -0,0 +1,230 @@
+/*
+ * Test of the ccvm runtime heap allocator (lib/ccvm/malloc.c) built for the host.
+ *
+ * The heap is placed in a big reserved mapping, only the block headers and the memory
+ * the test writes are touched. It covers heaps and grown regions bigger than the first
+ * level size classes, heap growth through the host, and calloc() size overflow. After
+ * each step the physical block chain and the free lists are checked against each other.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+static char *test_heap_begin;
+static char *test_heap_end;
+static char *test_heap_limit;
+static size_t test_grow_min; /* the host gives at least this many bytes on each grow */
+
+static void *test_heap_grow(size_t size);
+
+#define CCVM_HEAP_BEGIN test_heap_begin
+#define CCVM_HEAP_END test_heap_end
+#define CCVM_HEAP_GROW test_heap_grow
+#define malloc ccvm_malloc
+#define free ccvm_free
+#define realloc ccvm_realloc
+#define calloc ccvm_calloc
+
+#include "../../lib/ccvm/malloc.c"
+
+#undef malloc
+#undef free
+#undef realloc
+#undef calloc
+
+#define MB ((size_t)1024 * 1024)
+#define RESERVED_SIZE (3072 * MB)
+
+static int checks, errors;
+
+static void *test_heap_grow(size_t size)
+{
+    if (size < test_grow_min)
+        size = test_grow_min;
+    if (size > (size_t)(test_heap_limit - test_heap_end))
+        return 0;
+    test_heap_end += size;
+    return test_heap_end;
+}
+
+static void expect(int ok, const char *what)
+{
+    checks++;
+    if (!ok) {
+        printf("malloc_test: %s failed\n", what);
+        errors++;
+    }
+}
+
+/* 1 if 'block' is in the free list of its size class */
+static int in_free_list(Block *block)
+{
+    int fl, sl;
+    Block *p;
+    mapping_insert(block_size(block), &fl, &sl);
+    if (fl < 0 || fl >= FL_INDEX_COUNT)
+        return 0;
+    for (p = heap.blocks[fl][sl]; p; p = p->next_free) {
+        if (p == block)
+            return 1;
+    }
+    return 0;
+}
+
+/* walks the physical blocks, every free block must be listed and every listed block free */
+static void check_heap(const char *what)
+{
+    char *begin = (char *)(((size_t)test_heap_begin + ALIGN_SIZE - 1) & -ALIGN_SIZE);
+    Block *block, *prev = 0, *p;
+    int nb_free = 0, nb_listed = 0, fl, sl, ok = 1;
+
+    for (block = (Block *)begin; ok && block != heap.last; block = block_next(block)) {
+        if (block->prev_phys != prev || (char *)block >= (char *)heap.last)
+            ok = 0;
+        else if ((block->size & BLOCK_FREE) && !in_free_list(block))
+            ok = 0;
+        nb_free += (block->size & BLOCK_FREE) != 0;
+        prev = block;
+    }
+    if (ok && heap.last->prev_phys != prev)
+        ok = 0;
+    for (fl = 0; fl < FL_INDEX_COUNT; fl++) {
+        for (sl = 0; sl < SL_INDEX_COUNT; sl++) {
+            for (p = heap.blocks[fl][sl]; p; p = p->next_free)
+                nb_listed++;
+            if (!heap.blocks[fl][sl] != !(heap.sl_bitmap[fl] & (1u << sl)))
+                ok = 0;
+        }
+    }
+    expect(ok && nb_free == nb_listed, what);
+}
+
+static void reset_heap(size_t size, size_t limit, size_t grow_min)
+{
+    memset(&heap, 0, sizeof(heap));
+    test_heap_end = test_heap_begin + size;
+    test_heap_limit = test_heap_begin + limit;
+    test_grow_min = grow_min;
+}
+
+/* a heap bigger than the biggest size class */
+static void test_big_heap(void)
+{
+    void *p[4];
+    int i;
+
+    reset_heap(2560 * MB, 2560 * MB, 0);
+    p[0] = ccvm_malloc(16);
+    check_heap("big heap: init");
+    ccvm_free(p[0]);
+    for (i = 0; i < 4; i++)
+        p[i] = ccvm_malloc(BLOCK_SIZE_MAX);
+    expect(p[0] && p[1] && p[2] && p[3], "big heap: malloc(BLOCK_SIZE_MAX)");
+    check_heap("big heap: allocated");
+    /* neighbours are merged only up to BLOCK_SIZE_MAX */
+    ccvm_free(p[0]);
+    ccvm_free(p[2]);
+    ccvm_free(p[1]);
+    ccvm_free(p[3]);
+    check_heap("big heap: freed");
+    for (i = 0; i < 4; i++)
+        p[i] = ccvm_malloc(BLOCK_SIZE_MAX);
+    expect(p[0] && p[1] && p[2] && p[3], "big heap: malloc(BLOCK_SIZE_MAX) after free");
+    for (i = 0; i < 4; i++)
+        ccvm_free(p[i]);
+    check_heap("big heap: freed again");
+}
+
+/* growing heap, in small steps and in steps bigger than the biggest size class */
+static void test_heap_grow_steps(void)
+{
+    unsigned char *p[64], *big[4], *rest[4];
+    int i, n, ok = 1;
+
+    reset_heap(64 * 1024, RESERVED_SIZE, 0);
+    for (i = 0; i < 64; i++) {
+        p[i] = ccvm_malloc(4000);
+        if (p[i])
+            memset(p[i], i, 4000);
+    }
+    expect(test_heap_end > test_heap_begin + 64 * 1024, "heap grow: heap grown");
+    for (i = 0; i < 64; i++)
+        ok &= p[i] && p[i][0] == i && p[i][3999] == i;
+    expect(ok, "heap grow: small blocks");
+    check_heap("heap grow: small steps");
+
+    /* the host gives more than asked, the new region is split */
+    test_grow_min = 1280 * MB;
+    big[0] = ccvm_malloc(BLOCK_SIZE_MAX);
+    expect(big[0] != 0, "heap grow: malloc(BLOCK_SIZE_MAX)");
+    check_heap("heap grow: big step");
+    for (i = 0; i < 64; i += 2)
+        ccvm_free(p[i]);
+    ccvm_free(big[0]);
+    check_heap("heap grow: freed");
+
+    /* the free end of the heap is merged with the grown region */
+    for (i = 0; i < 4; i++)
+        big[i] = ccvm_malloc(BLOCK_SIZE_MAX);
+    expect(big[0] && big[1] && big[2] && big[3], "heap grow: merged with the free end");
+    check_heap("heap grow: merged");
+
+    /* the host has no more memory, what is left in the heap is used up first */
+    test_heap_limit = test_heap_end;
+    for (n = 0; n < 4 && (rest[n] = ccvm_malloc(BLOCK_SIZE_MAX)); n++)
+        ;
+    expect(n < 4 && test_heap_end == test_heap_limit, "heap grow: host out of memory");
+    check_heap("heap grow: out of memory");
+    for (i = 0; i < 4; i++)
+        ccvm_free(big[i]);
+    for (i = 0; i < n; i++)
+        ccvm_free(rest[i]);
+    for (i = 1; i < 64; i += 2)
+        ccvm_free(p[i]);
+    check_heap("heap grow: all freed");
+}
+
+static void test_calloc(void)
+{
+    unsigned char *p;
+    size_t i;
+    int zero = 1;
+
+    reset_heap(1 * MB, 1 * MB, 0);
+    expect(ccvm_calloc((size_t)-1 / 2 + 2, 2) == 0, "calloc: count * size wraps around");
+    expect(ccvm_calloc(2, (size_t)-1 / 2 + 2) == 0, "calloc: size * count wraps around");
+    expect(ccvm_calloc(BLOCK_SIZE_MAX / 8 + 1, 8) == 0, "calloc: above BLOCK_SIZE_MAX");
+    expect(ccvm_calloc(0x10000, 0x10000) == 0, "calloc: 4 GB");
+    p = ccvm_malloc(1200);
+    memset(p, 0xAA, 1200);
+    ccvm_free(p);
+    p = ccvm_calloc(100, 12);
+    expect(p != 0, "calloc: 100 * 12");
+    for (i = 0; p && i < 1200; i++)
+        zero &= p[i] == 0;
+    expect(zero, "calloc: zeroed");
+    ccvm_free(p);
+    check_heap("calloc");
+}
+
+int main(void)
+{
+    test_heap_begin = mmap(0, RESERVED_SIZE, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (test_heap_begin == MAP_FAILED) {
+        printf("malloc_test: cannot reserve %u MB, skipped\n", (unsigned)(RESERVED_SIZE / MB));
+        return 0;
+    }
+    test_big_heap();
+    test_heap_grow_steps();
+    test_calloc();
+    munmap(test_heap_begin, RESERVED_SIZE);
+    if (errors) {
+        printf("malloc_test: %d of %d checks FAILED\n", errors, checks);
+        return 1;
+    }
+    printf("malloc_test: %d checks OK\n", checks);
+    return 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * -O1 test: local variables that the -O1 peephole pass must keep in memory, or may
+ * forward and remove. Each case returns a value that depends on every write.
+ */
+
+typedef unsigned int uint32_t;
+
+static void set(int *p, int value)
+{
+    *p = value;
+}
+
+static int get(const int *p)
+{
+    return *p;
+}
+
+/* writes through a pointer to the local between its direct accesses */
+static int address_taken(int n)
+{
+    int x = 1;
+    int *p = &x;
+    x = n;
+    set(p, x + 1);
+    x = x * 2;
+    *p += 3;
+    return x;
+}
+
+/* write that looks dead, but is read through a pointer before the next write */
+static int read_through_pointer(int n)
+{
+    int x, y;
+    int *p = &x;
+    x = n;
+    y = *p;
+    x = n * 3;
+    y += get(p);
+    x = 7;
+    return x + y;
+}
+
+/* address taken after the accesses, the pass sees the whole function */
+static int address_taken_late(int n)
+{
+    int x = n, y;
+    x = x + 1;
+    y = x;
+    set(&x, y * 5);
+    return x + y;
+}
+
+/* volatile local, every access must stay */
+static int volatile_local(int n)
+{
+    volatile int v;
+    int i, sum = 0;
+    v = n;
+    v = n + 1;
+    for (i = 0; i < 4; i++) {
+        v = v + i;
+        sum += v;
+    }
+    return sum;
+}
+
+/* array elements are written and read through the array address */
+static int local_array(int n)
+{
+    int a[4], i, sum = 0;
+    a[0] = n;
+    a[1] = n + 1;
+    a[0] = a[1] * 2;
+    a[2] = a[0] + a[1];
+    a[3] = 9;
+    for (i = 0; i < 4; i++)
+        sum = sum * 7 + a[i];
+    return sum;
+}
+
+/* narrow write into a word that is then read as a whole */
+static uint32_t partial_write(uint32_t n)
+{
+    union {
+        uint32_t word;
+        unsigned char bytes[4];
+    } u;
+    u.word = n;
+    u.bytes[1] = 0x5A;
+    return u.word;
+}
+
+/* values known in one block are not known after a label */
+static int across_blocks(int n)
+{
+    int x = 5, y = 0, i;
+    for (i = 0; i < n; i++) {
+        if (i & 1)
+            x = x + i;
+        else
+            y = x;
+        x = x * 3;
+    }
+    return x - y;
+}
+
+/* constants and dead writes inside one block */
+static int one_block(int n)
+{
+    int a, b, c;
+    a = 3;
+    b = a + 4;
+    a = b * 2;
+    c = a - n;
+    b = c << 2;
+    b = b ^ a;
+    return a + b + c;
+}
+
+/* compare and condition codes after folded constants */
+static int conditions(int n)
+{
+    int a = 7, b;
+    b = a - 7;
+    if (b == 0 && n > a)
+        return n - a;
+    b = n < 0 ? -n : n;
+    return b + a;
+}
+
+static int long_long(int n)
+{
+    long long a = n, b, c;
+    a = a * 0x200000000LL;
+    b = a + 0x123456789LL;
+    a = b / 3;
+    /* the old value of the pair stays on the value stack while the operation writes it */
+    c = a++ + (b -= 0x7FFFFFFFFLL);
+    c ^= b++ - a * 8;
+    return (int)(a ^ (a >> 32) ^ b ^ c ^ (c >> 32));
+}
+
+static uint32_t run(void)
+{
+    uint32_t sum = 0;
+    int i;
+    for (i = -3; i < 12; i++) {
+        sum = sum * 31 + address_taken(i);
+        sum = sum * 31 + read_through_pointer(i);
+        sum = sum * 31 + address_taken_late(i);
+        sum = sum * 31 + volatile_local(i);
+        sum = sum * 31 + local_array(i);
+        sum = sum * 31 + partial_write(i * 0x01020304u);
+        sum = sum * 31 + across_blocks(i);
+        sum = sum * 31 + one_block(i);
+        sum = sum * 31 + conditions(i);
+        sum = sum * 31 + long_long(i);
+    }
+    return sum;
+}
+
+int main(void)
+{
+    return run() != 0x6485EDB7u;
+}
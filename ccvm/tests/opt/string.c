@@ -0,0 +1,88 @@
+/*
+ * -O1 test: memory and string functions of lib/ccvm/string.c at every alignment and for
+ * short and long lengths, checked against byte loops. Calls with constant offsets from a
+ * global array pass "symbol + offset" addresses in registers.
+ */
+
+typedef __SIZE_TYPE__ size_t;
+
+void *memcpy(void *dest, const void *src, size_t n);
+void *memset(void *dest, int c, size_t n);
+size_t strlen(const char *s);
+int strcmp(const char *s1, const char *s2);
+
+static unsigned char src[96], dst[96], ref[96];
+
+static void fill(unsigned char *p, int n, int seed)
+{
+    int i;
+    for (i = 0; i < n; i++)
+        p[i] = 'a' + (i * 7 + seed) % 26;
+}
+
+static int same(const unsigned char *a, const unsigned char *b, int n)
+{
+    int i;
+    for (i = 0; i < n; i++)
+        if (a[i] != b[i])
+            return 0;
+    return 1;
+}
+
+static int check_memcpy(int d, int s, int n)
+{
+    int i;
+    fill(src, sizeof(src), n);
+    fill(dst, sizeof(dst), d);
+    fill(ref, sizeof(ref), d);
+    for (i = 0; i < n; i++)
+        ref[d + i] = src[s + i];
+    return memcpy(dst + d, src + s, n) == dst + d && same(dst, ref, sizeof(dst));
+}
+
+static int check_memset(int d, int n)
+{
+    int i;
+    fill(dst, sizeof(dst), d);
+    fill(ref, sizeof(ref), d);
+    for (i = 0; i < n; i++)
+        ref[d + i] = 0xA5;
+    return memset(dst + d, 0x1A5, n) == dst + d && same(dst, ref, sizeof(dst));
+}
+
+static int check_strings(int s, int n)
+{
+    fill(src, sizeof(src), 0);
+    fill(dst, sizeof(dst), 0);
+    src[s + n] = 0;
+    dst[s + n] = 0;
+    if (strlen((char *)src + s) != n || strcmp((char *)src + s, (char *)dst + s) != 0)
+        return 0;
+    if (n == 0)
+        return 1;
+    dst[s + n - 1] = 'z' + 1;
+    return strcmp((char *)src + s, (char *)dst + s) < 0 && strcmp((char *)dst + s, (char *)src + s) > 0;
+}
+
+int main(void)
+{
+    int d, s, n;
+    for (n = 0; n < 40; n += n < 8 ? 1 : 7) {
+        for (d = 0; d < 4; d++) {
+            for (s = 0; s < 4; s++)
+                if (!check_memcpy(d, s, n))
+                    return 1;
+            if (!check_memset(d, n) || !check_strings(d, n))
+                return 2;
+        }
+    }
+    /* constant addresses */
+    fill(src, sizeof(src), 3);
+    memcpy(dst + 1, src + 2, 50);
+    if (!same(dst + 1, src + 2, 50))
+        return 3;
+    memset(dst + 3, 0, 21);
+    if (dst[2] != src[3] || dst[3] != 0 || dst[23] != 0 || dst[24] != src[25])
+        return 4;
+    return 0;
+}
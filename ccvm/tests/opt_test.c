@@ -0,0 +1,831 @@
+/*
+ * Checks that -O1 code computes the same results as -O0 code.
+ *
+ * Runs pairs of object files compiled from the same program with -O0 and -O1 and
+ * compares the value returned by main() and the final content of the global variables.
+ * Test programs are self-checking, main() must also return 0. Library objects given
+ * with -l are linked to every program, e.g. memset() from bin/lib/string.o.
+ *
+ *   opt_test [-l <library object>]... <object -O0> <object -O1> ...
+ *
+ * The interpreter below is only as complete as the tests need: no host calls, no
+ * floating point. It follows doc/calling.md for calls and frames, registers are
+ * mapped at the beginning of the data memory as in ccvm-gen.c, and every BIN_OP sets
+ * the flags (N, Z, C, V) as a subtraction or addition would, C is the borrow after
+ * a subtraction. Labels are resolved per function as bytecode/expand.ts does.
+ */
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "elf.h"
+#include "ccvm/ccvm-instr.h"
+#include "ccvm/ccvm-reloc.h"
+#include "test_utils.h"
+
+#define INSTR_SIZE 12
+
+#define DATA_SIZE 0x100000      /* data memory, the stack is at its end */
+#define DATA_BEGIN 0x100        /* registers and other internal variables are below */
+#define PROG_BASE 0x40000000    /* read-only data and code */
+#define PROG_SIZE 0x100000
+
+#define SP_ADDR (8 * 4)
+#define BP_ADDR (10 * 4)
+
+#define RETURN_ADDRESS 0xFFFFFFF0 /* return address of main(), stops the program */
+#define MAX_STEPS 500000000
+#define MAX_OBJECTS 16
+#define MAX_SECTIONS 64
+#define MAX_GLOBALS 1024
+#define MAX_LABEL_GROUP 256
+
+typedef struct Object {
+    const char *file;
+    char *elf;
+    long size;
+    Elf32_Ehdr *ehdr;
+    Elf32_Shdr *shdr;
+    uint32_t addr[MAX_SECTIONS]; /* load address of each section, 0 if not loaded */
+} Object;
+
+typedef struct Global {
+    const char *name;
+    uint32_t addr;
+} Global;
+
+typedef struct Machine {
+    uint8_t data[DATA_SIZE];
+    uint8_t prog[PROG_SIZE];
+    uint32_t data_end;          /* end of globals */
+    uint32_t rodata_end;        /* end of read-only data in program memory */
+    uint32_t text_begin;        /* code begins here and is the last in program memory */
+    uint32_t text_end;
+    int32_t *target;            /* resolved label of each instruction */
+    Global globals[MAX_GLOBALS];
+    int global_count;
+    int n, z, c, v;             /* flags */
+    long steps;
+    char error[256];
+    jmp_buf on_error;
+} Machine;
+
+static void fail(Machine *m, const char *format, ...)
+{
+    va_list ap;
+    va_start(ap, format);
+    vsnprintf(m->error, sizeof(m->error), format, ap);
+    va_end(ap);
+    longjmp(m->on_error, 1);
+}
+
+static int starts_with(const char *str, const char *prefix)
+{
+    return strncmp(str, prefix, strlen(prefix)) == 0;
+}
+
+/******************************************************************************
+ * Loading
+ */
+
+enum { SEC_NONE, SEC_DATA, SEC_RODATA, SEC_TEXT };
+
+static int section_kind(Object *o, int i)
+{
+    Elf32_Shdr *sh = &o->shdr[i];
+    const char *name = o->elf + o->shdr[o->ehdr->e_shstrndx].sh_offset + sh->sh_name;
+    if (!(sh->sh_flags & SHF_ALLOC) || starts_with(name, ".ccvm."))
+        return SEC_NONE;
+    if (sh->sh_flags & SHF_EXECINSTR)
+        return SEC_TEXT;
+    if (starts_with(name, ".data.ro") || starts_with(name, ".rodata") || strstr(name, ".ro.")
+        || (strlen(name) > 3 && strcmp(name + strlen(name) - 3, ".ro") == 0))
+        return SEC_RODATA;
+    return SEC_DATA;
+}
+
+static uint8_t *image(Machine *m, uint32_t addr, uint32_t size)
+{
+    if (addr < DATA_SIZE && size <= DATA_SIZE - addr)
+        return m->data + addr;
+    if (addr >= PROG_BASE && addr - PROG_BASE < PROG_SIZE && size <= PROG_SIZE - (addr - PROG_BASE))
+        return m->prog + (addr - PROG_BASE);
+    fail(m, "address 0x%08X out of the image", addr);
+    return NULL;
+}
+
+static void open_object(Machine *m, Object *o, const char *file)
+{
+    memset(o, 0, sizeof(*o));
+    o->file = file;
+    o->elf = read_file(file, &o->size);
+    if (!o->elf)
+        fail(m, "cannot read %s", file);
+    o->ehdr = (Elf32_Ehdr *)o->elf;
+    if (o->size < (long)sizeof(*o->ehdr) || memcmp(o->ehdr->e_ident, ELFMAG, SELFMAG) != 0
+        || o->ehdr->e_ident[EI_CLASS] != ELFCLASS32 || o->ehdr->e_shnum > MAX_SECTIONS
+        || o->ehdr->e_shoff + (long)o->ehdr->e_shnum * sizeof(*o->shdr) > (unsigned long)o->size)
+        fail(m, "%s is not a ccvm object file", file);
+    o->shdr = (Elf32_Shdr *)(o->elf + o->ehdr->e_shoff);
+}
+
+/* assigns addresses to the sections of 'kind' and copies their content */
+static void place_sections(Machine *m, Object *o, int kind, uint32_t *pos)
+{
+    int i;
+    for (i = 1; i < o->ehdr->e_shnum; i++) {
+        Elf32_Shdr *sh = &o->shdr[i];
+        uint32_t align = sh->sh_addralign > 4 ? sh->sh_addralign : 4;
+        if (section_kind(o, i) != kind)
+            continue;
+        if (kind != SEC_TEXT)
+            *pos = (*pos + align - 1) & ~(align - 1);
+        if (kind == SEC_TEXT && sh->sh_size % INSTR_SIZE)
+            fail(m, "%s: code section size is not a multiple of the instruction size", o->file);
+        o->addr[i] = *pos;
+        if (sh->sh_type != SHT_NOBITS)
+            memcpy(image(m, *pos, sh->sh_size), o->elf + sh->sh_offset, sh->sh_size);
+        *pos += sh->sh_size;
+    }
+}
+
+static Elf32_Sym *symbols(Object *o, int *count, const char **names)
+{
+    int i;
+    for (i = 1; i < o->ehdr->e_shnum; i++) {
+        if (o->shdr[i].sh_type == SHT_SYMTAB) {
+            *count = o->shdr[i].sh_size / sizeof(Elf32_Sym);
+            *names = o->elf + o->shdr[o->shdr[i].sh_link].sh_offset;
+            return (Elf32_Sym *)(o->elf + o->shdr[i].sh_offset);
+        }
+    }
+    *count = 0;
+    return NULL;
+}
+
+static int find_global(Machine *m, const char *name, uint32_t *addr)
+{
+    int i;
+    for (i = 0; i < m->global_count; i++) {
+        if (strcmp(m->globals[i].name, name) == 0) {
+            *addr = m->globals[i].addr;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void add_globals(Machine *m, Object *o)
+{
+    int i, count;
+    const char *names;
+    uint32_t addr;
+    Elf32_Sym *sym = symbols(o, &count, &names);
+    for (i = 1; i < count; i++) {
+        int bind = ELF32_ST_BIND(sym[i].st_info);
+        if ((bind != STB_GLOBAL && bind != STB_WEAK) || sym[i].st_shndx == SHN_UNDEF
+            || sym[i].st_shndx >= SHN_LORESERVE || !o->addr[sym[i].st_shndx])
+            continue;
+        if (find_global(m, names + sym[i].st_name, &addr))
+            continue; /* the first definition wins, programs are loaded before libraries */
+        if (m->global_count == MAX_GLOBALS)
+            fail(m, "too many global symbols");
+        m->globals[m->global_count].name = names + sym[i].st_name;
+        m->globals[m->global_count++].addr = o->addr[sym[i].st_shndx] + sym[i].st_value;
+    }
+}
+
+static uint32_t symbol_address(Machine *m, Object *o, int index)
+{
+    int count;
+    const char *names;
+    uint32_t addr;
+    Elf32_Sym *sym = symbols(o, &count, &names);
+    if (index <= 0 || index >= count)
+        fail(m, "%s: invalid symbol index %u", o->file, index);
+    sym += index;
+    if (sym->st_shndx == SHN_ABS)
+        return sym->st_value;
+    if (sym->st_shndx != SHN_UNDEF && sym->st_shndx < SHN_LORESERVE && o->addr[sym->st_shndx])
+        return o->addr[sym->st_shndx] + sym->st_value;
+    if (find_global(m, names + sym->st_name, &addr))
+        return addr;
+    fail(m, "undefined symbol %s", names + sym->st_name);
+    return 0;
+}
+
+static void relocate(Machine *m, Object *o)
+{
+    int i, j;
+    for (i = 1; i < o->ehdr->e_shnum; i++) {
+        Elf32_Shdr *sh = &o->shdr[i];
+        Elf32_Rel *rel = (Elf32_Rel *)(o->elf + sh->sh_offset);
+        if (sh->sh_type != SHT_REL || sh->sh_info >= MAX_SECTIONS || !o->addr[sh->sh_info])
+            continue;
+        for (j = 0; j < (int)(sh->sh_size / sizeof(Elf32_Rel)); j++) {
+            uint32_t value, where = o->addr[sh->sh_info] + rel[j].r_offset;
+            switch (ELF32_R_TYPE(rel[j].r_info)) {
+                case RELOC_INSTR: where += 4; break;
+                case RELOC_DATA: break;
+                default: fail(m, "%s: unknown relocation type %u", o->file, ELF32_R_TYPE(rel[j].r_info));
+            }
+            memcpy(&value, image(m, where, 4), 4);
+            value += symbol_address(m, o, ELF32_R_SYM(rel[j].r_info));
+            memcpy(image(m, where, 4), &value, 4);
+        }
+    }
+}
+
+static CCVMInstr *instr_at(Machine *m, int index)
+{
+    return (CCVMInstr *)(m->prog + (m->text_begin - PROG_BASE) + index * INSTR_SIZE);
+}
+
+/* Resolves 'label' used by an instruction of the function [begin, end). All labels connected
+   with LABEL_ALIAS are the same label, exactly one of them must be defined. Returns the
+   instruction index for relative labels, or the value of an absolute label. */
+static int32_t resolve_label(Machine *m, int begin, int end, uint32_t label)
+{
+    uint32_t group[MAX_LABEL_GROUP];
+    int count = 1, defined = 0, i, j, k;
+    int32_t result = 0;
+
+    group[0] = label;
+    for (k = 0; k < count; k++) {
+        for (i = begin; i < end; i++) {
+            CCVMInstr *instr = instr_at(m, i);
+            uint32_t other;
+            if (instr->opcode != INSTR_LABEL_ALIAS)
+                continue;
+            if (instr->label == group[k])
+                other = instr->labelAlias;
+            else if ((uint32_t)instr->labelAlias == group[k])
+                other = instr->label;
+            else
+                continue;
+            for (j = 0; j < count && group[j] != other; j++)
+                ;
+            if (j == count) {
+                if (count == MAX_LABEL_GROUP)
+                    fail(m, "too many aliases of label %u", label);
+                group[count++] = other;
+            }
+        }
+    }
+    for (i = begin; i < end; i++) {
+        CCVMInstr *instr = instr_at(m, i);
+        if (instr->opcode != INSTR_LABEL_RELATIVE && instr->opcode != INSTR_LABEL_ABSOLUTE)
+            continue;
+        for (j = 0; j < count && group[j] != instr->label; j++)
+            ;
+        if (j == count)
+            continue;
+        defined++;
+        if (instr->opcode == INSTR_LABEL_ABSOLUTE)
+            result = instr->address_offset;
+        else if (instr->address_offset % INSTR_SIZE || i + instr->address_offset / INSTR_SIZE < begin
+            || i + instr->address_offset / INSTR_SIZE >= end)
+            fail(m, "invalid offset of label %u", instr->label);
+        else
+            result = i + instr->address_offset / INSTR_SIZE;
+    }
+    if (defined != 1)
+        fail(m, defined ? "multiple definitions of label %u" : "undefined label %u", label);
+    return result;
+}
+
+static void resolve_labels(Machine *m, Object *o)
+{
+    int i, j, count;
+    const char *names;
+    Elf32_Sym *sym = symbols(o, &count, &names);
+    for (i = 1; i < count; i++) {
+        int begin, end;
+        if (ELF32_ST_TYPE(sym[i].st_info) != STT_FUNC || sym[i].st_shndx == SHN_UNDEF
+            || sym[i].st_shndx >= SHN_LORESERVE || section_kind(o, sym[i].st_shndx) != SEC_TEXT)
+            continue;
+        begin = (o->addr[sym[i].st_shndx] + sym[i].st_value - m->text_begin) / INSTR_SIZE;
+        end = begin + sym[i].st_size / INSTR_SIZE;
+        for (j = begin; j < end; j++) {
+            CCVMInstr *instr = instr_at(m, j);
+            if (instr->opcode == INSTR_JUMP_LABEL || instr->opcode == INSTR_JUMP_COND_LABEL
+                || instr->opcode == INSTR_PUSH_BLOCK_LABEL)
+                m->target[j] = resolve_label(m, begin, end, instr->label);
+        }
+    }
+}
+
+/* loads 'count' objects, returns address of main() */
+static uint32_t load(Machine *m, const char **files, int count)
+{
+    static Object objects[MAX_OBJECTS];
+    uint32_t pos, main_addr;
+    int i;
+
+    for (i = 0; i < count; i++)
+        open_object(m, &objects[i], files[i]);
+    pos = DATA_BEGIN;
+    for (i = 0; i < count; i++)
+        place_sections(m, &objects[i], SEC_DATA, &pos);
+    m->data_end = pos;
+    pos = PROG_BASE;
+    for (i = 0; i < count; i++)
+        place_sections(m, &objects[i], SEC_RODATA, &pos);
+    m->rodata_end = pos;
+    m->text_begin = pos = (pos + 3) & ~3;
+    for (i = 0; i < count; i++)
+        place_sections(m, &objects[i], SEC_TEXT, &pos);
+    m->text_end = pos;
+    for (i = 0; i < count; i++)
+        add_globals(m, &objects[i]);
+    for (i = 0; i < count; i++)
+        relocate(m, &objects[i]);
+    m->target = calloc((m->text_end - m->text_begin) / INSTR_SIZE + 1, sizeof(int32_t));
+    for (i = 0; i < count; i++)
+        resolve_labels(m, &objects[i]);
+    if (!find_global(m, "main", &main_addr))
+        fail(m, "no main() function");
+    for (i = 0; i < count; i++)
+        free(objects[i].elf);
+    return main_addr;
+}
+
+/******************************************************************************
+ * Execution
+ */
+
+static uint32_t *reg(Machine *m, int r)
+{
+    if (r > 7)
+        fail(m, "invalid register %u", r);
+    /* R0, X0, R1, X1, ... */
+    return (uint32_t *)(m->data + (r < 4 ? r * 8 : (r - 4) * 8 + 4));
+}
+
+static uint32_t read_mem(Machine *m, uint32_t addr, int bytes)
+{
+    uint32_t value = 0;
+    memcpy(&value, image(m, addr, bytes), bytes);
+    return value;
+}
+
+static void write_mem(Machine *m, uint32_t addr, uint32_t value, int bytes)
+{
+    if (addr >= PROG_BASE)
+        fail(m, "write to program memory at 0x%08X", addr);
+    memcpy(image(m, addr, bytes), &value, bytes);
+}
+
+static void push(Machine *m, uint32_t value, int bytes)
+{
+    uint32_t sp = *(uint32_t *)(m->data + SP_ADDR) - bytes;
+    if (sp < m->data_end)
+        fail(m, "stack overflow, SP = 0x%08X", sp);
+    *(uint32_t *)(m->data + SP_ADDR) = sp;
+    write_mem(m, sp, value, bytes);
+}
+
+static uint32_t pop(Machine *m, int bytes)
+{
+    uint32_t sp = *(uint32_t *)(m->data + SP_ADDR);
+    *(uint32_t *)(m->data + SP_ADDR) = sp + bytes;
+    return read_mem(m, sp, bytes);
+}
+
+static void push_block(Machine *m, int r, uint32_t size)
+{
+    uint32_t sp = *(uint32_t *)(m->data + SP_ADDR) - size;
+    if (sp < m->data_end || sp > DATA_SIZE)
+        fail(m, "stack overflow, SP = 0x%08X", sp);
+    *(uint32_t *)(m->data + SP_ADDR) = sp;
+    *reg(m, r) = sp;
+}
+
+static int condition(Machine *m, int cond)
+{
+    switch (cond) {
+        case CMP_OP_ULT: return m->c;
+        case CMP_OP_UGE: return !m->c;
+        case CMP_OP_EQ: return m->z;
+        case CMP_OP_NE: return !m->z;
+        case CMP_OP_ULE: return m->c || m->z;
+        case CMP_OP_UGT: return !m->c && !m->z;
+        case CMP_OP_Nset: return m->n;
+        case CMP_OP_Nclear: return !m->n;
+        case CMP_OP_LT: return m->n != m->v;
+        case CMP_OP_GE: return m->n == m->v;
+        case CMP_OP_LE: return m->z || m->n != m->v;
+        case CMP_OP_GT: return !m->z && m->n == m->v;
+    }
+    fail(m, "unknown condition 0x%02X", cond);
+    return 0;
+}
+
+/* 32-bit operation, the high word of multiplication and the remainder go to 'x' */
+static uint32_t bin_op(Machine *m, int op, uint32_t a, uint32_t b, uint32_t *x)
+{
+    uint32_t r;
+    int c = 0, v = 0, carry = m->c;
+    switch (op) {
+        case BIN_OP_ADD: r = a + b; c = r < a; v = (~(a ^ b) & (a ^ r)) >> 31; break;
+        case BIN_OP_ADDC: r = a + b + carry; c = carry ? r <= a : r < a; v = (~(a ^ b) & (a ^ r)) >> 31; break;
+        case BIN_OP_SUB:
+        case BIN_OP_CMP: r = a - b; c = a < b; v = ((a ^ b) & (a ^ r)) >> 31; break;
+        case BIN_OP_SUBC: r = a - b - carry; c = carry ? a <= b : a < b; v = ((a ^ b) & (a ^ r)) >> 31; break;
+        case BIN_OP_BITAND: r = a & b; break;
+        case BIN_OP_BITOR: r = a | b; break;
+        case BIN_OP_BITXOR: r = a ^ b; break;
+        case BIN_OP_MUL: r = a * b; *x = (uint32_t)(((uint64_t)a * b) >> 32); break;
+        case BIN_OP_SHL: r = a << (b & 31); break;
+        case BIN_OP_SHR: r = a >> (b & 31); break;
+        case BIN_OP_SAR: r = (uint32_t)((int32_t)a >> (b & 31)); break;
+        case BIN_OP_DIV:
+            if (b == 0)
+                fail(m, "division by zero");
+            if ((int32_t)a == INT32_MIN && (int32_t)b == -1) {
+                r = a;
+                *x = 0;
+            } else {
+                r = (uint32_t)((int32_t)a / (int32_t)b);
+                *x = (uint32_t)((int32_t)a % (int32_t)b);
+            }
+            break;
+        case BIN_OP_UDIV:
+            if (b == 0)
+                fail(m, "division by zero");
+            r = a / b;
+            *x = a % b;
+            break;
+        default:
+            fail(m, "unknown operator 0x%02X", op);
+            return 0;
+    }
+    m->n = r >> 31;
+    m->z = r == 0;
+    m->c = c;
+    m->v = v;
+    return r;
+}
+
+static uint64_t bin_op64(Machine *m, int op, uint64_t a, uint64_t b)
+{
+    uint64_t r;
+    int c = 0, v = 0, carry = m->c;
+    switch (op) {
+        case BIN_OP_ADD: r = a + b; c = r < a; v = (~(a ^ b) & (a ^ r)) >> 63; break;
+        case BIN_OP_ADDC: r = a + b + carry; c = carry ? r <= a : r < a; v = (~(a ^ b) & (a ^ r)) >> 63; break;
+        case BIN_OP_SUB:
+        case BIN_OP_CMP: r = a - b; c = a < b; v = ((a ^ b) & (a ^ r)) >> 63; break;
+        case BIN_OP_SUBC: r = a - b - carry; c = carry ? a <= b : a < b; v = ((a ^ b) & (a ^ r)) >> 63; break;
+        case BIN_OP_BITAND: r = a & b; break;
+        case BIN_OP_BITOR: r = a | b; break;
+        case BIN_OP_BITXOR: r = a ^ b; break;
+        case BIN_OP_MUL: r = a * b; break;
+        case BIN_OP_SHL: r = a << (b & 63); break;
+        case BIN_OP_SHR: r = a >> (b & 63); break;
+        case BIN_OP_SAR: r = (uint64_t)((int64_t)a >> (b & 63)); break;
+        case BIN_OP_DIV:
+        case BIN_OP_MOD:
+        case BIN_OP_UDIV:
+        case BIN_OP_UMOD:
+            if (b == 0)
+                fail(m, "division by zero");
+            if (op == BIN_OP_UDIV)
+                r = a / b;
+            else if (op == BIN_OP_UMOD)
+                r = a % b;
+            else if ((int64_t)a == INT64_MIN && (int64_t)b == -1)
+                r = op == BIN_OP_DIV ? a : 0;
+            else if (op == BIN_OP_DIV)
+                r = (uint64_t)((int64_t)a / (int64_t)b);
+            else
+                r = (uint64_t)((int64_t)a % (int64_t)b);
+            break;
+        default:
+            fail(m, "unknown operator 0x%02X", op);
+            return 0;
+    }
+    m->n = r >> 63;
+    m->z = r == 0;
+    m->c = c;
+    m->v = v;
+    return r;
+}
+
+static uint64_t get_pair(Machine *m, int r)
+{
+    return (uint64_t)*reg(m, r + 4) << 32 | *reg(m, r);
+}
+
+static void set_pair(Machine *m, int r, uint64_t value)
+{
+    *reg(m, r) = (uint32_t)value;
+    *reg(m, r + 4) = (uint32_t)(value >> 32);
+}
+
+/* READ and WRITE instructions */
+static void access(Machine *m, CCVMInstr *instr, uint32_t addr)
+{
+    int read = instr->opcode == INSTR_READ_CONST || instr->opcode == INSTR_READ_REG
+        || instr->opcode == INSTR_READ_REG_OFFSET || instr->opcode == INSTR_READ_REG_INDEX;
+    int bytes = 1 << (instr->op2 & 3);
+    uint32_t value;
+
+    if (bytes == 8) {
+        if (instr->reg > 3)
+            fail(m, "64-bit access to register %u", instr->reg);
+        if (read) {
+            *reg(m, instr->reg) = read_mem(m, addr, 4);
+            *reg(m, instr->reg + 4) = read_mem(m, addr + 4, 4);
+        } else {
+            write_mem(m, addr, *reg(m, instr->reg), 4);
+            write_mem(m, addr + 4, *reg(m, instr->reg + 4), 4);
+        }
+        return;
+    }
+    if (read) {
+        value = read_mem(m, addr, bytes);
+        if ((instr->op2 & 0x80) && bytes < 4 && (value >> (bytes * 8 - 1)))
+            value |= ~0u << (bytes * 8);
+        *reg(m, instr->reg) = value;
+    } else {
+        write_mem(m, addr, *reg(m, instr->reg), bytes);
+    }
+}
+
+static uint32_t jump_target(Machine *m, uint32_t addr)
+{
+    if (addr < m->text_begin || addr >= m->text_end || (addr - m->text_begin) % INSTR_SIZE)
+        fail(m, "jump to invalid address 0x%08X", addr);
+    return (addr - m->text_begin) / INSTR_SIZE;
+}
+
+/* runs main(), returns its result */
+static uint32_t run(Machine *m, uint32_t main_addr)
+{
+    uint32_t *sp = (uint32_t *)(m->data + SP_ADDR);
+    uint32_t *bp = (uint32_t *)(m->data + BP_ADDR);
+    uint32_t pc, addr, x = 0, size;
+    uint64_t value64;
+
+    *sp = DATA_SIZE;
+    push(m, RETURN_ADDRESS, 4);
+    push(m, *bp, 4);
+    *bp = *sp;
+    pc = jump_target(m, main_addr);
+
+    for (;;) {
+        CCVMInstr *instr = instr_at(m, pc);
+        uint32_t next = pc + 1;
+        if (++m->steps > MAX_STEPS)
+            fail(m, "too many instructions, infinite loop?");
+        switch (instr->opcode) {
+            case INSTR_NOOP:
+            case INSTR_LABEL_RELATIVE:
+            case INSTR_LABEL_ABSOLUTE:
+            case INSTR_LABEL_ALIAS:
+                m->steps--;
+                break;
+            case INSTR_MOV_REG:
+                *reg(m, instr->dstReg) = *reg(m, instr->srcReg);
+                break;
+            case INSTR_MOV_CONST:
+                *reg(m, instr->reg) = instr->value;
+                break;
+            case INSTR_READ_CONST:
+            case INSTR_WRITE_CONST:
+                access(m, instr, instr->value + ((instr->op2 & 0x40) ? *bp : 0));
+                break;
+            case INSTR_READ_REG:
+            case INSTR_WRITE_REG:
+                access(m, instr, *reg(m, instr->addrReg));
+                break;
+            case INSTR_READ_REG_OFFSET:
+            case INSTR_WRITE_REG_OFFSET:
+                access(m, instr, *reg(m, instr->addrReg) + instr->value);
+                break;
+            case INSTR_READ_REG_INDEX:
+            case INSTR_WRITE_REG_INDEX:
+                addr = *reg(m, instr->indexReg) << ((instr->op2 & RW_SCALE_MASK) >> RW_SCALE_SHIFT);
+                access(m, instr, *reg(m, instr->addrReg) + addr);
+                break;
+            case INSTR_JUMP_COND_LABEL:
+                if (condition(m, instr->op2))
+                    next = m->target[pc];
+                break;
+            case INSTR_JUMP_LABEL:
+                next = m->target[pc];
+                break;
+            case INSTR_JUMP_CONST:
+                next = jump_target(m, instr->value);
+                break;
+            case INSTR_JUMP_REG:
+                next = jump_target(m, *reg(m, instr->reg));
+                break;
+            case INSTR_CALL_CONST:
+            case INSTR_CALL_REG:
+                addr = instr->opcode == INSTR_CALL_CONST ? instr->value : *reg(m, instr->reg);
+                push(m, m->text_begin + next * INSTR_SIZE, 4);
+                next = jump_target(m, addr);
+                push(m, *bp, 4);
+                *bp = *sp;
+                break;
+            case INSTR_RETURN:
+                *sp = *bp;
+                *bp = pop(m, 4);
+                addr = pop(m, 4);
+                *sp += 4 * instr->value;
+                if (addr == RETURN_ADDRESS)
+                    return *reg(m, 0);
+                next = jump_target(m, addr);
+                break;
+            case INSTR_PUSH:
+                if (instr->op2 < 1 || instr->op2 > 4)
+                    fail(m, "invalid PUSH size %u", instr->op2);
+                push(m, *reg(m, instr->reg), instr->op2);
+                break;
+            case INSTR_POP:
+                if (instr->op2 < 1 || instr->op2 > 4)
+                    fail(m, "invalid POP size %u", instr->op2);
+                *reg(m, instr->reg) = pop(m, instr->op2);
+                break;
+            case INSTR_PUSH_BLOCK_CONST:
+            case INSTR_PUSH_BLOCK_LABEL:
+                size = instr->opcode == INSTR_PUSH_BLOCK_CONST ? instr->value : (uint32_t)m->target[pc];
+                if (size || !instr->op2)
+                    push_block(m, instr->reg, size);
+                break;
+            case INSTR_PUSH_BLOCK_REG:
+                push_block(m, instr->dstReg, *reg(m, instr->srcReg));
+                break;
+            case INSTR_POP_BLOCK_CONST:
+                *sp += instr->value;
+                break;
+            case INSTR_BIN_OP:
+            case INSTR_BIN_OP_CONST:
+                x = *reg(m, (instr->dstReg & 3) + 4);
+                addr = bin_op(m, instr->op2, *reg(m, instr->dstReg),
+                    instr->opcode == INSTR_BIN_OP ? *reg(m, instr->srcReg) : instr->value, &x);
+                if (instr->op2 != BIN_OP_CMP) {
+                    *reg(m, instr->dstReg) = addr;
+                    if (instr->dstReg < 4)
+                        *reg(m, instr->dstReg + 4) = x;
+                }
+                break;
+            case INSTR_BIN_OP64:
+            case INSTR_BIN_OP64_CONST:
+                if (instr->dstReg > 3 || (instr->opcode == INSTR_BIN_OP64 && instr->srcReg > 3))
+                    fail(m, "invalid register pair %u", instr->dstReg);
+                if (instr->opcode == INSTR_BIN_OP64_CONST)
+                    value64 = (uint64_t)(uint32_t)instr->valueHigh << 32 | instr->value;
+                else if (instr->op2 == BIN_OP_SHL || instr->op2 == BIN_OP_SHR || instr->op2 == BIN_OP_SAR)
+                    value64 = *reg(m, instr->srcReg);
+                else
+                    value64 = get_pair(m, instr->srcReg);
+                value64 = bin_op64(m, instr->op2, get_pair(m, instr->dstReg), value64);
+                if (instr->op2 != BIN_OP_CMP)
+                    set_pair(m, instr->dstReg, value64);
+                break;
+            case INSTR_SETCC:
+                *reg(m, instr->reg) = condition(m, instr->op2);
+                break;
+            case INSTR_SELECT:
+                if (condition(m, instr->op2))
+                    *reg(m, instr->dstReg) = *reg(m, instr->srcReg);
+                break;
+            case INSTR_BFX:
+                size = (uint32_t)instr->bitSize;
+                if (instr->value >= 32 || size < 1 || size > 32 - instr->value)
+                    fail(m, "invalid bit field size %u", size);
+                addr = *reg(m, instr->reg) >> instr->value;
+                if (size < 32) {
+                    addr &= (1u << size) - 1;
+                    if (instr->op2 && (addr >> (size - 1)))
+                        addr |= ~0u << size;
+                }
+                *reg(m, instr->reg) = addr;
+                break;
+            case INSTR_BFI:
+                size = (uint32_t)instr->bitSize;
+                if (instr->value >= 32 || size < 1 || size > 32 - instr->value)
+                    fail(m, "invalid bit field size %u", size);
+                addr = (size < 32 ? (1u << size) - 1 : ~0u) << instr->value;
+                *reg(m, instr->dstReg) = (*reg(m, instr->dstReg) & ~addr) | ((*reg(m, instr->srcReg) << instr->value) & addr);
+                break;
+            case INSTR_COUNT:
+                if (instr->op2 == 3) {
+                    value64 = (uint64_t)read_mem(m, instr->value + 4, 4) << 32 | read_mem(m, instr->value, 4);
+                    value64++;
+                    write_mem(m, instr->value, (uint32_t)value64, 4);
+                    write_mem(m, instr->value + 4, (uint32_t)(value64 >> 32), 4);
+                } else {
+                    write_mem(m, instr->value, read_mem(m, instr->value, 4) + 1, 4);
+                }
+                break;
+            default:
+                fail(m, "unsupported instruction %u", instr->opcode);
+        }
+        if (next * INSTR_SIZE >= m->text_end - m->text_begin)
+            fail(m, "execution past the end of code at 0x%08X", m->text_begin + pc * INSTR_SIZE);
+        pc = next;
+    }
+}
+
+/******************************************************************************
+ * Test
+ */
+
+typedef struct Result {
+    int ok;
+    uint32_t value;
+    long steps;
+    uint32_t data_end;
+    uint8_t *globals;
+} Result;
+
+static void execute(const char *file, const char **libs, int lib_count, Result *result)
+{
+    static Machine m;
+    const char *files[MAX_OBJECTS];
+    uint32_t main_addr;
+
+    memset(&m, 0, sizeof(m));
+    memset(result, 0, sizeof(*result));
+    files[0] = file;
+    memcpy(files + 1, libs, lib_count * sizeof(*libs));
+    if (setjmp(m.on_error)) {
+        fprintf(stderr, "opt_test: %s: %s\n", file, m.error);
+        free(m.target);
+        return;
+    }
+    main_addr = load(&m, files, lib_count + 1);
+    result->value = run(&m, main_addr);
+    result->steps = m.steps;
+    result->data_end = m.data_end;
+    result->globals = malloc(m.data_end - DATA_BEGIN);
+    memcpy(result->globals, m.data + DATA_BEGIN, m.data_end - DATA_BEGIN);
+    result->ok = 1;
+    free(m.target);
+}
+
+/* file name without directory and extensions */
+static const char *program_name(const char *file, char *name, int size)
+{
+    const char *base = strrchr(file, '/');
+    base = base ? base + 1 : file;
+    snprintf(name, size, "%.*s", (int)strcspn(base, "."), base);
+    return name;
+}
+
+int main(int argc, char **argv)
+{
+    const char *libs[MAX_OBJECTS - 1];
+    int lib_count = 0, i, count = 0, failed = 0;
+
+    for (i = 1; i + 1 < argc && strcmp(argv[i], "-l") == 0; i += 2) {
+        if (lib_count == MAX_OBJECTS - 1) {
+            fprintf(stderr, "opt_test: too many libraries\n");
+            return 1;
+        }
+        libs[lib_count++] = argv[i + 1];
+    }
+    if (i == argc || (argc - i) % 2) {
+        fprintf(stderr, "usage: opt_test [-l <library object>]... <object -O0> <object -O1> ...\n");
+        return 1;
+    }
+    printf("%-12s %10s %10s %8s\n", "program", "-O0 instr", "-O1 instr", "");
+    for (; i < argc; i += 2, count++) {
+        Result r0, r1;
+        const char *error = NULL;
+        char name[64];
+        execute(argv[i], libs, lib_count, &r0);
+        execute(argv[i + 1], libs, lib_count, &r1);
+        if (!r0.ok || !r1.ok)
+            error = "FAILED to run";
+        else if (r0.value != r1.value)
+            error = "DIFFERENT result";
+        else if (r0.data_end != r1.data_end
+            || memcmp(r0.globals, r1.globals, r0.data_end - DATA_BEGIN) != 0)
+            error = "DIFFERENT globals";
+        else if (r0.value != 0)
+            error = "self-check FAILED";
+        printf("%-12s %10ld %10ld", program_name(argv[i], name, sizeof(name)), r0.steps, r1.steps);
+        if (r0.ok && r1.ok && r0.steps)
+            printf(" %+7.1f%%", 100.0 * (r1.steps - r0.steps) / r0.steps);
+        if (error) {
+            printf(" %s, main() returned %d and %d", error, (int)r0.value, (int)r1.value);
+            failed = 1;
+        }
+        printf("\n");
+        free(r0.globals);
+        free(r1.globals);
+    }
+    if (failed)
+        fprintf(stderr, "opt_test: FAILED\n");
+    else
+        fprintf(stderr, "opt_test: %d programs OK\n", count);
+    return failed;
+}
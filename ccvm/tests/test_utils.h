@@ -0,0 +1,30 @@
+/*
+ * Helpers shared by the host test programs in this directory
+ */
+
+#ifndef _CCVM_TEST_UTILS_H_
+#define _CCVM_TEST_UTILS_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* reads the whole file into a newly allocated buffer, returns NULL on failure */
+static char *read_file(const char *name, long *size)
+{
+    char *data;
+    FILE *f = fopen(name, "rb");
+    if (!f)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    data = malloc(*size + 1);
+    if (data && fread(data, 1, *size, f) != (size_t)*size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    return data;
+}
+
+#endif // _CCVM_TEST_UTILS_H_
@@ -0,0 +1,389 @@
+/*
+ *  TCC runtime library for ccvm: heap allocator.
+ *
+ *  Copying and distribution of this file, with or without modification,
+ *  are permitted in any medium without royalty provided the copyright
+ *  notice and this notice are preserved.  This file is offered as-is,
+ *  without any warranty.
+ *
+ *  Two-level segregated fit (TLSF) allocator over the heap region placed
+ *  by the linker.  Free blocks are kept in lists by size class: the first
+ *  level is the power of two of the size, the second level splits it into
+ *  16 linear classes.  Two levels of bitmaps find a non-empty list that
+ *  fits, so malloc, free and realloc take constant time, independent of
+ *  the number of blocks.  A returned block is at most 1/16 bigger than
+ *  requested, which bounds the internal fragmentation.  Freed blocks are
+ *  merged with their free neighbours immediately.
+ *
+ *  Each block has a header with the previous physical block and the size.
+ *  The lowest bit of the size marks a free block.  The heap ends with
+ *  a used block of size zero, so merging never goes past the end.  Free
+ *  blocks must fit the first level classes, so big regions are split into
+ *  blocks of at most BLOCK_SIZE_MAX and merging stops at that size.
+ *
+ *  When the heap is full, __ccvm_heap_grow() is called.  The default one
+ *  fails, a program on a host with growable memory can provide its own,
+ *  e.g. a host function imported with CCVM_IMPORT.
+ */
+
+typedef __SIZE_TYPE__ size_t;
+typedef unsigned int uint32_t;
+
+void *memcpy(void *dest, const void *src, size_t n);
+void *memset(void *dest, int c, size_t n);
+
+#ifndef CCVM_HEAP_BEGIN
+extern char __ccvm_section_heap_begin__[];
+extern char __ccvm_section_heap_end__[];
+#define CCVM_HEAP_BEGIN __ccvm_section_heap_begin__
+#define CCVM_HEAP_END __ccvm_section_heap_end__
+#endif
+
+#define ALIGN_LOG2 3
+#define ALIGN_SIZE (1 << ALIGN_LOG2)
+#define SL_INDEX_COUNT_LOG2 4
+#define SL_INDEX_COUNT (1 << SL_INDEX_COUNT_LOG2)
+#define FL_INDEX_SHIFT (SL_INDEX_COUNT_LOG2 + ALIGN_LOG2)
+#define FL_INDEX_MAX 30
+#define FL_INDEX_COUNT (FL_INDEX_MAX - FL_INDEX_SHIFT + 1)
+#define SMALL_BLOCK_SIZE (1 << FL_INDEX_SHIFT)
+
+/* rounding up to a size class must stay below 1 << FL_INDEX_MAX */
+#define BLOCK_SIZE_MAX ((size_t)1 << (FL_INDEX_MAX - 1))
+
+#define BLOCK_FREE 1
+
+typedef struct Block {
+    struct Block *prev_phys;
+    size_t size;
+    /* payload starts here, links are valid only in free blocks */
+    struct Block *next_free;
+    struct Block *prev_free;
+} Block;
+
+#define HEADER_SIZE ((sizeof(Block *) + sizeof(size_t) + ALIGN_SIZE - 1) & -ALIGN_SIZE)
+#define BLOCK_SIZE_MIN ((2 * sizeof(Block *) + ALIGN_SIZE - 1) & -ALIGN_SIZE)
+
+static struct {
+    uint32_t fl_bitmap;
+    uint32_t sl_bitmap[FL_INDEX_COUNT];
+    Block *blocks[FL_INDEX_COUNT][SL_INDEX_COUNT];
+    Block *last; /* zero sized block at the end of the heap */
+    int initialized;
+} heap;
+
+#ifndef CCVM_HEAP_GROW
+/* Asks the host for at least 'size' more bytes right after the current
+   end of the heap.  Returns the new end of the heap or NULL. */
+__attribute__((weak))
+void *__ccvm_heap_grow(size_t size)
+{
+    (void)size;
+    return 0;
+}
+#define CCVM_HEAP_GROW __ccvm_heap_grow
+#endif
+
+/* index of the highest set bit, -1 if none */
+static int tlsf_fls(uint32_t x)
+{
+    int n = 0;
+    if (!x)
+        return -1;
+    if (x & 0xFFFF0000) { n += 16; x >>= 16; }
+    if (x & 0xFF00) { n += 8; x >>= 8; }
+    if (x & 0xF0) { n += 4; x >>= 4; }
+    if (x & 0xC) { n += 2; x >>= 2; }
+    if (x & 0x2) { n += 1; }
+    return n;
+}
+
+static int tlsf_ffs(uint32_t x)
+{
+    return tlsf_fls(x & -x);
+}
+
+static size_t block_size(Block *block)
+{
+    return block->size & ~(size_t)BLOCK_FREE;
+}
+
+static void *block_to_ptr(Block *block)
+{
+    return (char *)block + HEADER_SIZE;
+}
+
+static Block *block_from_ptr(void *ptr)
+{
+    return (Block *)((char *)ptr - HEADER_SIZE);
+}
+
+static Block *block_next(Block *block)
+{
+    return (Block *)((char *)block + HEADER_SIZE + block_size(block));
+}
+
+static void mapping_insert(size_t size, int *fl, int *sl)
+{
+    int f;
+    if (size < SMALL_BLOCK_SIZE) {
+        *fl = 0;
+        *sl = (int)size >> ALIGN_LOG2;
+    } else {
+        f = tlsf_fls((uint32_t)size);
+        *sl = (int)(size >> (f - SL_INDEX_COUNT_LOG2)) ^ SL_INDEX_COUNT;
+        *fl = f - (FL_INDEX_SHIFT - 1);
+    }
+}
+
+/* like mapping_insert(), but rounds up to the next class, so any block
+   of the found list fits */
+static void mapping_search(size_t size, int *fl, int *sl)
+{
+    if (size >= SMALL_BLOCK_SIZE)
+        size += ((size_t)1 << (tlsf_fls((uint32_t)size) - SL_INDEX_COUNT_LOG2)) - 1;
+    mapping_insert(size, fl, sl);
+}
+
+static void insert_free(Block *block)
+{
+    int fl, sl;
+    Block *first;
+    mapping_insert(block_size(block), &fl, &sl);
+    first = heap.blocks[fl][sl];
+    block->size |= BLOCK_FREE;
+    block->next_free = first;
+    block->prev_free = 0;
+    if (first)
+        first->prev_free = block;
+    heap.blocks[fl][sl] = block;
+    heap.fl_bitmap |= 1u << fl;
+    heap.sl_bitmap[fl] |= 1u << sl;
+}
+
+static void remove_free(Block *block)
+{
+    int fl, sl;
+    mapping_insert(block_size(block), &fl, &sl);
+    if (block->next_free)
+        block->next_free->prev_free = block->prev_free;
+    if (block->prev_free) {
+        block->prev_free->next_free = block->next_free;
+    } else {
+        heap.blocks[fl][sl] = block->next_free;
+        if (!block->next_free) {
+            heap.sl_bitmap[fl] &= ~(1u << sl);
+            if (!heap.sl_bitmap[fl])
+                heap.fl_bitmap &= ~(1u << fl);
+        }
+    }
+    block->size &= ~(size_t)BLOCK_FREE;
+}
+
+static Block *find_free(size_t size)
+{
+    int fl, sl;
+    uint32_t map;
+    mapping_search(size, &fl, &sl);
+    if (fl >= FL_INDEX_COUNT)
+        return 0;
+    map = heap.sl_bitmap[fl] & (~0u << sl);
+    if (!map) {
+        map = heap.fl_bitmap & (~0u << (fl + 1));
+        if (!map)
+            return 0;
+        fl = tlsf_ffs(map);
+        map = heap.sl_bitmap[fl];
+    }
+    sl = tlsf_ffs(map);
+    return heap.blocks[fl][sl];
+}
+
+/* 1 if 'block' and the next physical block 'next' merged stay within the size classes */
+static int can_merge(Block *block, Block *next)
+{
+    return block_size(block) + HEADER_SIZE + block_size(next) <= BLOCK_SIZE_MAX;
+}
+
+/* merge free 'block' into its previous physical block 'prev' */
+static Block *merge_prev(Block *prev, Block *block)
+{
+    prev->size += HEADER_SIZE + block_size(block);
+    block_next(prev)->prev_phys = prev;
+    return prev;
+}
+
+/* cut the end of used 'block' beyond 'size' and return it to free lists */
+static void trim_used(Block *block, size_t size)
+{
+    Block *rest, *next;
+    if (block_size(block) < size + HEADER_SIZE + BLOCK_SIZE_MIN)
+        return;
+    rest = (Block *)((char *)block_to_ptr(block) + size);
+    rest->size = block_size(block) - size - HEADER_SIZE;
+    rest->prev_phys = block;
+    block->size = size;
+    next = block_next(rest);
+    next->prev_phys = rest;
+    if ((next->size & BLOCK_FREE) && can_merge(rest, next)) {
+        remove_free(next);
+        merge_prev(rest, next);
+    }
+    insert_free(rest);
+}
+
+/* make free blocks of the memory from 'block' to the end marker, 'block->prev_phys'
+   must be set */
+static void insert_region(Block *block)
+{
+    size_t size = (char *)heap.last - (char *)block - HEADER_SIZE;
+    Block *next;
+    while (size > BLOCK_SIZE_MAX) {
+        /* the rest must still hold a block */
+        block->size = size - HEADER_SIZE - BLOCK_SIZE_MIN < BLOCK_SIZE_MAX
+            ? size - HEADER_SIZE - BLOCK_SIZE_MIN : BLOCK_SIZE_MAX;
+        size -= HEADER_SIZE + block->size;
+        insert_free(block);
+        next = block_next(block);
+        next->prev_phys = block;
+        block = next;
+    }
+    block->size = size;
+    insert_free(block);
+    heap.last->prev_phys = block;
+}
+
+static void heap_init(void)
+{
+    char *begin = (char *)(((size_t)CCVM_HEAP_BEGIN + ALIGN_SIZE - 1) & -ALIGN_SIZE);
+    char *end = (char *)((size_t)CCVM_HEAP_END & -ALIGN_SIZE);
+    Block *block = (Block *)begin;
+    heap.initialized = 1;
+    if (end < begin + 2 * HEADER_SIZE + BLOCK_SIZE_MIN) {
+        heap.last = 0;
+        return;
+    }
+    heap.last = (Block *)(end - HEADER_SIZE);
+    heap.last->size = 0;
+    block->prev_phys = 0;
+    insert_region(block);
+}
+
+/* extend the heap, so that a block of 'size' bytes is free */
+static int heap_grow(size_t size)
+{
+    char *end;
+    Block *block;
+    if (!heap.last)
+        return 0;
+    /* find_free() rounds up to the next size class */
+    end = CCVM_HEAP_GROW(size + (size >> (SL_INDEX_COUNT_LOG2 - 1)) + HEADER_SIZE);
+    end = (char *)((size_t)end & -ALIGN_SIZE);
+    if (!end || end < (char *)heap.last + 2 * HEADER_SIZE + BLOCK_SIZE_MIN)
+        return 0;
+    /* the old end marker becomes a free block, merged with a free block before it */
+    block = heap.last;
+    heap.last = (Block *)(end - HEADER_SIZE);
+    heap.last->size = 0;
+    if (block->prev_phys && (block->prev_phys->size & BLOCK_FREE)) {
+        block = block->prev_phys;
+        remove_free(block);
+    }
+    insert_region(block);
+    return 1;
+}
+
+static size_t adjust_size(size_t size)
+{
+    if (size > BLOCK_SIZE_MAX)
+        return 0;
+    size = (size + ALIGN_SIZE - 1) & -ALIGN_SIZE;
+    return size < BLOCK_SIZE_MIN ? BLOCK_SIZE_MIN : size;
+}
+
+void *malloc(size_t size)
+{
+    Block *block;
+    size = adjust_size(size);
+    if (!size)
+        return 0;
+    if (!heap.initialized)
+        heap_init();
+    block = find_free(size);
+    if (!block) {
+        if (!heap_grow(size))
+            return 0;
+        block = find_free(size);
+        if (!block)
+            return 0;
+    }
+    remove_free(block);
+    trim_used(block, size);
+    return block_to_ptr(block);
+}
+
+void free(void *ptr)
+{
+    Block *block, *next;
+    if (!ptr)
+        return;
+    block = block_from_ptr(ptr);
+    next = block_next(block);
+    if ((next->size & BLOCK_FREE) && can_merge(block, next)) {
+        remove_free(next);
+        block->size += HEADER_SIZE + block_size(next);
+        block_next(block)->prev_phys = block;
+    }
+    if (block->prev_phys && (block->prev_phys->size & BLOCK_FREE) && can_merge(block->prev_phys, block)) {
+        remove_free(block->prev_phys);
+        block = merge_prev(block->prev_phys, block);
+    }
+    insert_free(block);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    Block *block, *next;
+    size_t adjusted;
+    void *result;
+    if (!ptr)
+        return malloc(size);
+    if (!size) {
+        free(ptr);
+        return 0;
+    }
+    adjusted = adjust_size(size);
+    if (!adjusted)
+        return 0;
+    block = block_from_ptr(ptr);
+    if (adjusted > block_size(block)) {
+        /* grow in place if the next block is free and big enough */
+        next = block_next(block);
+        if ((next->size & BLOCK_FREE)
+            && block_size(block) + HEADER_SIZE + block_size(next) >= adjusted) {
+            remove_free(next);
+            block->size += HEADER_SIZE + block_size(next);
+            block_next(block)->prev_phys = block;
+        } else {
+            result = malloc(size);
+            if (result) {
+                memcpy(result, ptr, block_size(block));
+                free(ptr);
+            }
+            return result;
+        }
+    }
+    trim_used(block, adjusted);
+    return ptr;
+}
+
+void *calloc(size_t count, size_t size)
+{
+    void *result;
+    if (size && count > BLOCK_SIZE_MAX / size)
+        return 0;
+    result = malloc(count * size);
+    if (result)
+        memset(result, 0, count * size);
+    return result;
+}
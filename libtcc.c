@@ -296,6 +296,8 @@ typedef struct MemDebugHeader {
     uint64_t words;
     const char* trace;
     struct MemDebugHeader* next;
+    TCCState *bench_state; /* -bench=json state that counts this block */
+    int bench_phase;
     uint64_t *magic2;
     uint64_t magic1[16];
 } MemDebugHeader;
@@ -342,12 +344,25 @@ uint64_t magic_free[] = {
 };
 
 
+/* The trace and the last allocation are kept per thread, so states used
+   concurrently by different threads do not disturb each other checks. */
+#if defined __GNUC__ && !defined __TINYC__
+# define MEM_THREAD_LOCAL __thread
+#else
+# define MEM_THREAD_LOCAL
+#endif
+
 MemDebugHeader* first = &tmp.h;
-MemDebugHeader* last = &tmp.h;
+static MEM_THREAD_LOCAL MemDebugHeader* last_allocated = NULL;
 
-char traceText[65536];
-char* traceText2 = traceText;
-int traceSize = 0;
+MEM_THREAD_LOCAL char traceText[65536];
+MEM_THREAD_LOCAL int traceSize = 0;
+
+/* Checked blocks: the static one and the last allocated by the current thread */
+static MemDebugHeader* memNext(MemDebugHeader* h)
+{
+    return h == first ? last_allocated : NULL;
+}
 
 void memError(const char * t, const char * trace)
 {
@@ -390,10 +405,52 @@ void globalMemCheck()
             if (memcmp(h->magic1, magic_allocated, sizeof(magic_allocated))) memError("Magic 1 on allocated", h->trace);
             if (memcmp(h->magic2, magic_allocated, sizeof(magic_allocated))) memError("Magic 2 on allocated", h->trace);
         }
-        h = h->next;
+        h = memNext(h);
     }
 }
 
+/* State benchmarked with -bench=json in this thread, it gets the allocations */
+static MEM_THREAD_LOCAL TCCState *bench_state;
+
+static unsigned long long bench_clock_ns(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (unsigned long long)((double)count.QuadPart * 1e9 / freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static void bench_alloc(MemDebugHeader *h)
+{
+    TCCState *s1 = h->bench_state;
+    BenchPhase *p = &s1->bench[s1->bench_phase];
+    unsigned long size = 8 * h->words;
+    h->bench_phase = s1->bench_phase;
+    p->nb_allocs++;
+    p->alloc_bytes += size;
+    p->cur_bytes += size;
+    if (p->cur_bytes > p->peak_bytes)
+        p->peak_bytes = p->cur_bytes;
+    s1->heap_cur += size;
+    if (s1->heap_cur > s1->heap_peak)
+        s1->heap_peak = s1->heap_cur;
+}
+
+static void bench_free(MemDebugHeader *h)
+{
+    TCCState *s1 = h->bench_state;
+    unsigned long size = 8 * h->words;
+    s1->bench[s1->bench_phase].nb_frees++;
+    s1->bench[h->bench_phase].cur_bytes -= size;
+    s1->heap_cur -= size;
+}
+
 PUB_FUNC void tcc_free(void *ptr)
 {
     globalMemCheck();
@@ -401,6 +458,8 @@ PUB_FUNC void tcc_free(void *ptr)
     MemDebugHeader* h = (MemDebugHeader*)ptr - 1;
     uint64_t* data = (uint64_t*)(h + 1);
     if (h->free) memError("Double free", h->trace);
+    if (h->bench_state && h->bench_state == bench_state)
+        bench_free(h);
     h->free = 1;
     for (int i = 0; i < h->words; i++) {
         data[i] = MEM_DEBUG_MAGIC_FREE;
@@ -419,7 +478,10 @@ PUB_FUNC void *tcc_malloc(unsigned long size)
     h->words = size / 8;
     h->next = NULL;
     h->trace = tcc_strdup2(traceText);
-    last->next = h;
+    h->bench_state = bench_state;
+    if (bench_state)
+        bench_alloc(h);
+    last_allocated = h;
     memcpy(h->magic1, magic_allocated, sizeof(magic_allocated));
     h->magic2 = (uint64_t*)(h + 1) + h->words;
     memcpy(h->magic2, magic_allocated, sizeof(magic_allocated));
@@ -483,12 +545,12 @@ void my_memset(void* to, int from, size_t size)
         char* to_begin = to;
         char* to_end = to_begin + size;
         if (h->free) {
-            if (invalidOrOverlapping(to_begin, to_end, h, h->magic2 + sizeof(magic_allocated))) return memError("memset on free", h->trace);
+            if (invalidOrOverlapping(to_begin, to_end, h, (uint8_t*)h->magic2 + sizeof(magic_allocated))) return memError("memset on free", h->trace);
         } else {
             if (invalidOrOverlapping(to_begin, to_end, h, data)) return memError("memset overlapping", h->trace);
-            if (invalidOrOverlapping(to_begin, to_end, h->magic2, h->magic2 + sizeof(magic_allocated))) return memError("memset overlapping", h->trace);
+            if (invalidOrOverlapping(to_begin, to_end, h->magic2, (uint8_t*)h->magic2 + sizeof(magic_allocated))) return memError("memset overlapping", h->trace);
         }
-        h = h->next;
+        h = memNext(h);
     }
 #undef memset
     memset(to, from, size);
@@ -950,11 +1012,13 @@ static int tcc_compile(TCCState *s1, int filetype, const char *str, int fd)
        Alternatively we could use thread local storage for those global
        variables, which may or may not have advantages */
 
+    int phase;
+
     tcc_enter_state(s1);
-    s1->error_set_jmp_enabled = 0;
+    s1->error_set_jmp_enabled = 1;
+    phase = tcc_bench_phase(s1, BENCH_GEN);
 
-    //if (setjmp(s1->error_jmp_buf) == 0)
-    {
+    if (setjmp(s1->error_jmp_buf) == 0) {
         s1->nb_errors = 0;
 
         if (fd == -1) {
@@ -970,10 +1034,12 @@ static int tcc_compile(TCCState *s1, int filetype, const char *str, int fd)
         tccgen_init(s1);
 
         if (s1->output_type == TCC_OUTPUT_PREPROCESS) {
+            tcc_bench_phase(s1, BENCH_PP);
             tcc_preprocess(s1);
         } else {
             tccelf_begin_file(s1);
             if (filetype & (AFF_TYPE_ASM | AFF_TYPE_ASMPP)) {
+                tcc_bench_phase(s1, BENCH_ASM);
                 tcc_assemble(s1, !!(filetype & AFF_TYPE_ASMPP));
             } else {
                 tccgen_compile(s1);
@@ -983,6 +1049,7 @@ static int tcc_compile(TCCState *s1, int filetype, const char *str, int fd)
     }
     tccgen_finish(s1);
     preprocess_end(s1);
+    tcc_bench_phase(s1, phase);
     s1->error_set_jmp_enabled = 0;
     tcc_exit_state(s1);
     return s1->nb_errors != 0 ? -1 : 0;
@@ -1078,6 +1145,10 @@ LIBTCCAPI void tcc_delete(TCCState *s1)
     tcc_free(s1->deps_outfile);
 #if defined TCC_TARGET_MACHO
     tcc_free(s1->install_name);
+#endif
+#ifdef TCC_TARGET_CCVM
+    tcc_free(s1->profile_use);
+    ccvm_delete(s1);
 #endif
     dynarray_reset(&s1->files, &s1->nb_files);
     dynarray_reset(&s1->target_deps, &s1->nb_target_deps);
@@ -1093,6 +1164,8 @@ LIBTCCAPI void tcc_delete(TCCState *s1)
 #endif
     /* free loaded dlls array */
     dynarray_reset(&s1->loaded_dlls, &s1->nb_loaded_dlls);
+    if (bench_state == s1)
+        bench_state = NULL;
     tcc_free(s1);
 #ifdef MEM_DEBUG
     tcc_memcheck(-1);
@@ -1236,8 +1309,9 @@ ST_FUNC int tcc_add_file_internal(TCCState *s1, const char *filename, int flags)
     s1->current_filename = filename;
     if (flags & AFF_TYPE_BIN) {
         ElfW(Ehdr) ehdr;
-        int obj_type;
+        int obj_type, phase;
 
+        phase = tcc_bench_phase(s1, BENCH_LINK);
         obj_type = tcc_object_type(fd, &ehdr);
         lseek(fd, 0, SEEK_SET);
 
@@ -1319,6 +1393,7 @@ check_success:
             break;
 #endif
         }
+        tcc_bench_phase(s1, phase);
         close(fd);
     } else {
         /* update target deps */
@@ -1780,7 +1855,7 @@ static const TCCOption tcc_options[] = {
     { "L", TCC_OPTION_L, TCC_OPTION_HAS_ARG },
     { "B", TCC_OPTION_B, TCC_OPTION_HAS_ARG },
     { "l", TCC_OPTION_l, TCC_OPTION_HAS_ARG },
-    { "bench", TCC_OPTION_bench, 0 },
+    { "bench", TCC_OPTION_bench, TCC_OPTION_HAS_ARG | TCC_OPTION_NOSEP },
 #ifdef CONFIG_TCC_BACKTRACE
     { "bt", TCC_OPTION_bt, TCC_OPTION_HAS_ARG | TCC_OPTION_NOSEP },
 #endif
@@ -1881,6 +1956,10 @@ static const FlagDef options_f[] = {
     { offsetof(TCCState, ms_extensions), 0, "ms-extensions" },
     { offsetof(TCCState, dollars_in_identifiers), 0, "dollars-in-identifiers" },
     { offsetof(TCCState, test_coverage), 0, "test-coverage" },
+#ifdef TCC_TARGET_CCVM
+    { offsetof(TCCState, profile_arcs), 0, "profile-arcs" },
+    { offsetof(TCCState, profile_functions), 0, "profile-functions" },
+#endif
     { 0, 0, NULL }
 };
 
@@ -2134,7 +2213,15 @@ dorun:
             s->option_pthread = 1;
             break;
         case TCC_OPTION_bench:
-            s->do_bench = 1;
+            if (*optarg == '\0') {
+                s->do_bench = 1;
+            } else if (0 == strcmp(optarg, "=json")) {
+                s->do_bench = 2;
+                s->bench_clock = bench_clock_ns();
+                bench_state = s;
+            } else {
+                goto unsupported_option;
+            }
             break;
 #ifdef CONFIG_TCC_BACKTRACE
         case TCC_OPTION_bt:
@@ -2235,6 +2322,13 @@ dorun:
             ++noaction;
             break;
         case TCC_OPTION_f:
+#ifdef TCC_TARGET_CCVM
+            if (strstart("profile-use=", &optarg)) {
+                tcc_free(s->profile_use);
+                s->profile_use = tcc_strdup(optarg);
+                break;
+            }
+#endif
             if (set_flag(s, options_f, optarg) < 0)
                 goto unsupported_option;
             break;
@@ -2399,8 +2493,60 @@ LIBTCCAPI int tcc_set_options(TCCState *s, const char *r)
     return ret < 0 ? ret : 0;
 }
 
+/* Switches the phase that gets the time and the allocations with
+   -bench=json, returns the previous phase. */
+ST_FUNC int tcc_bench_phase(TCCState *s1, int phase)
+{
+    int prev = s1->bench_phase;
+    unsigned long long now;
+    if (s1->do_bench < 2 || phase == prev)
+        return prev;
+    now = bench_clock_ns();
+    s1->bench[prev].time_ns += now - s1->bench_clock;
+    s1->bench_clock = now;
+    s1->bench_phase = phase;
+    return prev;
+}
+
+static void print_stats_json(TCCState *s1, unsigned total_time)
+{
+    static const char * const names[BENCH_PHASES] = {
+        "other", "preprocess", "parse_codegen", "assemble", "link", "output"
+    };
+    unsigned long long now = bench_clock_ns();
+    unsigned nb_allocs = 0, nb_frees = 0;
+    int i;
+
+    s1->bench[s1->bench_phase].time_ns += now - s1->bench_clock;
+    s1->bench_clock = now;
+    for (i = 0; i < BENCH_PHASES; i++) {
+        nb_allocs += s1->bench[i].nb_allocs;
+        nb_frees += s1->bench[i].nb_frees;
+    }
+    fprintf(stderr, "{\"time_ms\": %u, \"idents\": %d, \"lines\": %d, \"bytes\": %u,\n",
+            total_time, total_idents, total_lines, total_bytes);
+    fprintf(stderr, " \"output\": {\"text\": %u, \"data_rw\": %u, \"data_ro\": %u, \"bss\": %u},\n",
+            s1->total_output[0], s1->total_output[1], s1->total_output[2], s1->total_output[3]);
+    fprintf(stderr, " \"heap\": {\"peak_bytes\": %lu, \"allocs\": %u, \"frees\": %u,"
+                    " \"tal_allocs\": %u, \"tal_missed\": %u},\n",
+            s1->heap_peak, nb_allocs, nb_frees, s1->tal_allocs, s1->tal_missed);
+    fprintf(stderr, " \"phases\": {");
+    for (i = 0; i < BENCH_PHASES; i++) {
+        BenchPhase *p = &s1->bench[i];
+        fprintf(stderr, "%s\n  \"%s\": {\"time_ms\": %.3f, \"allocs\": %u, \"frees\": %u,"
+                        " \"alloc_bytes\": %llu, \"peak_bytes\": %lu}",
+                i ? "," : "", names[i], p->time_ns / 1e6, p->nb_allocs, p->nb_frees,
+                p->alloc_bytes, p->peak_bytes);
+    }
+    fprintf(stderr, "\n }\n}\n");
+}
+
 PUB_FUNC void tcc_print_stats(TCCState *s1, unsigned total_time)
 {
+    if (s1->do_bench == 2) {
+        print_stats_json(s1, total_time);
+        return;
+    }
     if (!total_time)
         total_time = 1;
     fprintf(stderr, "# %d idents, %d lines, %u bytes\n"
@@ -40,7 +40,7 @@ static const char help[] =
     "  -v --version show version\n"
     "  -vv          show search paths or loaded files\n"
     "  -h -hh       show this, show more help\n"
-    "  -bench       show compilation statistics\n"
+    "  -bench[=json] show compilation statistics, per phase in JSON\n"
     "  -            use stdin pipe as infile\n"
     "  @listfile    read arguments from listfile\n"
     "Preprocessor options:\n"
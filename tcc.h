@@ -747,6 +747,25 @@ typedef struct ASMOperand {
 } ASMOperand;
 #endif
 
+/* compilation phases for -bench=json, see tcc_bench_phase() */
+enum {
+    BENCH_OTHER,    /* options, setup and cleanup */
+    BENCH_PP,       /* preprocessor, tccpp.c */
+    BENCH_GEN,      /* parser and code generator, tccgen.c and <target>-gen.c */
+    BENCH_ASM,      /* assembler, tccasm.c */
+    BENCH_LINK,     /* loading objects and libraries, relocation */
+    BENCH_OUTPUT,   /* writing the output file */
+    BENCH_PHASES
+};
+
+typedef struct BenchPhase {
+    unsigned long long time_ns;
+    unsigned long long alloc_bytes; /* total bytes allocated by tcc_malloc() */
+    unsigned nb_allocs, nb_frees;
+    unsigned long cur_bytes;        /* live bytes allocated in this phase */
+    unsigned long peak_bytes;
+} BenchPhase;
+
 /* extra symbol attributes (not in symbol table) */
 struct sym_attr {
     unsigned got_offset;
@@ -791,7 +810,7 @@ struct TCCState {
     unsigned char warn_num; /* temp var for tcc_warning_c() */
 
     unsigned char option_r; /* option -r */
-    unsigned char do_bench; /* option -bench */
+    unsigned char do_bench; /* option -bench, 2 for -bench=json */
     unsigned char just_deps; /* option -M  */
     unsigned char gen_deps; /* option -MD  */
     unsigned char include_sys_deps; /* option -MD  */
@@ -821,6 +840,11 @@ struct TCCState {
 #ifdef TCC_TARGET_ARM
     unsigned char float_abi; /* float ABI of the generated code*/
 #endif
+#ifdef TCC_TARGET_CCVM
+    unsigned char profile_arcs; /* -fprofile-arcs: count branch edges */
+    unsigned char profile_functions; /* -fprofile-functions: count function calls */
+    char *profile_use; /* -fprofile-use=: branch profile used for code layout */
+#endif
 
     unsigned char has_text_addr;
     addr_t text_addr; /* address of text section */
@@ -942,6 +966,12 @@ struct TCCState {
     Section *tcov_section;
     /* debug state */
     struct _tccdbg *dState;
+#ifdef TCC_TARGET_CCVM
+    /* ccvm backend state */
+    struct _ccvmgen *ccvm_gen;
+    struct _ccvmprofile *ccvm_profile;
+    struct _ccvmlink *ccvm_link;
+#endif
 
     /* Is there a new undefined sym since last new_undef_sym() */
     int new_undef_sym;
@@ -1012,6 +1042,11 @@ struct TCCState {
     int total_lines;
     unsigned int total_bytes;
     unsigned int total_output[4];
+    BenchPhase bench[BENCH_PHASES];
+    int bench_phase;
+    unsigned long long bench_clock;
+    unsigned long heap_cur, heap_peak; /* live bytes of all phases */
+    unsigned tal_allocs, tal_missed; /* tal_realloc() calls, missed fall back to tcc_malloc() */
 
     /* option -dnum (for general development purposes) */
     int g_debug;
@@ -1317,6 +1352,7 @@ ST_FUNC void tcc_add_btstub(TCCState *s1);
 ST_FUNC void tcc_add_pragma_libs(TCCState *s1);
 PUB_FUNC int tcc_add_library_err(TCCState *s, const char *f);
 PUB_FUNC void tcc_print_stats(TCCState *s, unsigned total_time);
+ST_FUNC int tcc_bench_phase(TCCState *s1, int phase);
 PUB_FUNC int tcc_parse_args(TCCState *s, int *argc, char ***argv, int optind);
 #ifdef _WIN32
 ST_FUNC char *normalize_slashes(char *path);
@@ -1733,6 +1769,21 @@ ST_FUNC void gen_cvt_sxtw(void);
 ST_FUNC void gen_increment_tcov (SValue *sv);
 #endif
 
+/* ------------ ccvm-gen.c ------------ */
+#ifdef TCC_TARGET_CCVM
+ST_FUNC void ccvm_init(TCCState *s1);
+ST_FUNC void ccvm_finish(TCCState *s1);
+ST_FUNC void ccvm_delete(TCCState *s1);
+ST_FUNC int gen_cond_select(int cond_ind, int op, SValue *sv, CType *type);
+ST_FUNC void gen_jump_target(void);
+ST_FUNC void gen_opl(int op);
+ST_FUNC void gen_bf_extract(int bit_pos, int bit_size, int is_signed);
+ST_FUNC void gen_bf_insert(int bit_pos, int bit_size);
+ST_FUNC void ccvm_profile_add_file(TCCState *s1);
+ST_FUNC void ccvm_tcov_add_exit(TCCState *s1);
+ST_FUNC void gen_increment_tcov (SValue *sv);
+#endif
+
 /* ------------ c67-gen.c ------------ */
 #ifdef TCC_TARGET_C67
 #endif
@@ -1538,12 +1538,22 @@ static void tcc_compile_string_no_debug(TCCState *s, const char *str)
 {
     int save_do_debug = s->do_debug;
     int save_test_coverage = s->test_coverage;
+#ifdef TCC_TARGET_CCVM
+    int save_profile_arcs = s->profile_arcs;
+    int save_profile_functions = s->profile_functions;
 
+    s->profile_arcs = 0;
+    s->profile_functions = 0;
+#endif
     s->do_debug = 0;
     s->test_coverage = 0;
     tcc_compile_string(s, str);
     s->do_debug = save_do_debug;
     s->test_coverage = save_test_coverage;
+#ifdef TCC_TARGET_CCVM
+    s->profile_arcs = save_profile_arcs;
+    s->profile_functions = save_profile_functions;
+#endif
 }
 
 #ifdef CONFIG_TCC_BACKTRACE
@@ -1667,6 +1677,9 @@ static void tcc_tcov_add_file(TCCState *s1, const char *filename)
 #endif
     cstr_free (&cstr);
 
+#ifdef TCC_TARGET_CCVM
+    ccvm_tcov_add_exit(s1);
+#else
     cstr_new(&cstr);
     cstr_printf(&cstr,
         "extern char *__tcov_data[];"
@@ -1677,6 +1690,7 @@ static void tcc_tcov_add_file(TCCState *s1, const char *filename)
     tcc_compile_string_no_debug(s1, cstr.data);
     cstr_free(&cstr);
     set_local_sym(s1, &"___tcov_data"[!s1->leading_underscore], tcov_section, 0);
+#endif
 }
 
 #if !defined TCC_TARGET_PE && !defined TCC_TARGET_MACHO
@@ -2662,7 +2676,7 @@ static int tcc_output_binary(TCCState *s1, FILE *f,
 static int tcc_write_elf_file(TCCState *s1, const char *filename, int phnum,
                               ElfW(Phdr) *phdr, int file_offset, int *sec_order)
 {
-    int fd, mode, file_type, ret;
+    int fd, mode, file_type, ret, phase;
     FILE *f;
 
     file_type = s1->output_type;
@@ -2676,6 +2690,7 @@ static int tcc_write_elf_file(TCCState *s1, const char *filename, int phnum,
         return tcc_error_noabort("could not write '%s: %s'", filename, strerror(errno));
     if (s1->verbose)
         printf("<- %s\n", filename);
+    phase = tcc_bench_phase(s1, BENCH_OUTPUT);
 #ifdef TCC_TARGET_COFF
     if (s1->output_format == TCC_OUTPUT_FORMAT_COFF)
         tcc_output_coff(s1, f);
@@ -2686,6 +2701,7 @@ static int tcc_write_elf_file(TCCState *s1, const char *filename, int phnum,
     else
         ret = tcc_output_binary(s1, f, sec_order);
     fclose(f);
+    tcc_bench_phase(s1, phase);
 
     return ret;
 }
@@ -3003,19 +3019,28 @@ static int elf_output_obj(TCCState *s1, const char *filename)
 
 LIBTCCAPI int tcc_output_file(TCCState *s, const char *filename)
 {
+    int ret, phase;
+#ifdef TCC_TARGET_CCVM
+    ccvm_profile_add_file(s);
+#endif
     if (s->test_coverage)
         tcc_tcov_add_file(s, filename);
+    /* writing the file switches to BENCH_OUTPUT */
+    phase = tcc_bench_phase(s, BENCH_LINK);
     if (s->output_type == TCC_OUTPUT_OBJ)
-        return elf_output_obj(s, filename);
+        ret = elf_output_obj(s, filename);
+    else
 #ifdef TCC_TARGET_PE
-    return  pe_output_file(s, filename);
+        ret = pe_output_file(s, filename);
 #elif TCC_TARGET_MACHO
-    return macho_output_file(s, filename);
+        ret = macho_output_file(s, filename);
 #elif TCC_TARGET_CCVM
-    return ccvm_output_file(s, filename);
+        ret = ccvm_output_file(s, filename);
 #else
-    return elf_output_file(s, filename);
+        ret = elf_output_file(s, filename);
 #endif
+    tcc_bench_phase(s, phase);
+    return ret;
 }
 
 ST_FUNC ssize_t full_read(int fd, void *buf, size_t count) {
@@ -100,14 +100,19 @@ static struct switch_t {
     SValue sv;
 } *cur_switch; /* current switch */
 
-#define MAX_TEMP_LOCAL_VARIABLE_NUMBER 8
 /*list of temporary local variables on the stack in current function. */
 static struct temp_local_variable {
 	int location; //offset on stack. Svalue.c.i
 	short size;
 	short align;
-} arr_temp_local_vars[MAX_TEMP_LOCAL_VARIABLE_NUMBER];
-static int nb_temp_local_vars;
+} *arr_temp_local_vars;
+static int nb_temp_local_vars, max_temp_local_vars;
+
+#ifdef TCC_TARGET_CCVM
+/* lowest 'loc' reached in current function, 'loc' itself is raised
+   again when a scope ends and its slots become free */
+static int func_min_loc;
+#endif
 
 static struct scope {
     struct scope *prev;
@@ -115,6 +120,9 @@ static struct scope {
     struct { Sym *s; int n; } cl;
     int *bsym, *csym;
     Sym *lstk, *llstk;
+#ifdef TCC_TARGET_CCVM
+    int loc;
+#endif
 } *cur_scope, *loop_scope, *root_scope;
 
 typedef struct {
@@ -178,6 +186,9 @@ static int gind()
   CODE_ON();
   if (debug_modes)
     tcc_tcov_block_begin(tcc_state);
+#ifdef TCC_TARGET_CCVM
+  gen_jump_target();
+#endif
   return t;
 }
 
@@ -393,6 +404,9 @@ ST_FUNC int tccgen_compile(TCCState *s1)
 #ifdef TCC_TARGET_ARM
     arm_init(s1);
 #endif
+#ifdef TCC_TARGET_CCVM
+    ccvm_init(s1);
+#endif
 #ifdef INC_DEBUG
     printf("%s: **** new file\n", file->filename);
 #endif
@@ -411,6 +425,12 @@ ST_FUNC void tccgen_finish(TCCState *s1)
 {
     tcc_debug_end(s1); /* just in case of errors: free memory */
     free_inline_functions(s1);
+    tcc_free(arr_temp_local_vars);
+    arr_temp_local_vars = NULL;
+    nb_temp_local_vars = max_temp_local_vars = 0;
+#ifdef TCC_TARGET_CCVM
+    ccvm_finish(s1);
+#endif
     sym_pop(&global_stack, NULL, 0);
     sym_pop(&local_stack, NULL, 0);
     /* free preprocessor macros */
@@ -1504,13 +1524,15 @@ static int get_temp_local_var(int size,int align){
 	}
 	if(!found){
 		loc = (loc - size) & -align;
-		if(nb_temp_local_vars<MAX_TEMP_LOCAL_VARIABLE_NUMBER){
-			temp_var=&arr_temp_local_vars[i];
-			temp_var->location=loc;
-			temp_var->size=size;
-			temp_var->align=align;
-			nb_temp_local_vars++;
+		if(nb_temp_local_vars>=max_temp_local_vars){
+			max_temp_local_vars=max_temp_local_vars?2*max_temp_local_vars:8;
+			arr_temp_local_vars=tcc_realloc(arr_temp_local_vars,
+				max_temp_local_vars*sizeof(*arr_temp_local_vars));
 		}
+		temp_var=&arr_temp_local_vars[nb_temp_local_vars++];
+		temp_var->location=loc;
+		temp_var->size=size;
+		temp_var->align=align;
 		found_var=loc;
 	}
 	return found_var;
@@ -1520,6 +1542,18 @@ static void clear_temp_local_var_list(){
 	nb_temp_local_vars=0;
 }
 
+#ifdef TCC_TARGET_CCVM
+/* forget temporary local variables placed below 'loc' */
+static void drop_temp_local_vars(int loc){
+	int i,n;
+	for(i=n=0;i<nb_temp_local_vars;i++){
+		if(arr_temp_local_vars[i].location>=loc)
+			arr_temp_local_vars[n++]=arr_temp_local_vars[i];
+	}
+	nb_temp_local_vars=n;
+}
+#endif
+
 /* move register 's' (of type 't') to 'r', and flush previous value of r to memory
    if needed */
 static void move_reg(int r, int s, int t)
@@ -1729,10 +1763,17 @@ static void load_packed_bf(CType *type, int bit_pos, int bit_size)
         n = 8 - bit_pos;
         if (n > bit_size)
             n = bit_size;
-        if (bit_pos)
-            vpushi(bit_pos), gen_op(TOK_SHR), bit_pos = 0; // X B Y
-        if (n < 8)
-            vpushi((1 << n) - 1), gen_op('&');
+#ifdef TCC_TARGET_CCVM
+        if (bit_pos && n < 8) {
+            gen_bf_extract(bit_pos, n, 0), bit_pos = 0; // X B Y
+        } else
+#endif
+        {
+            if (bit_pos)
+                vpushi(bit_pos), gen_op(TOK_SHR), bit_pos = 0; // X B Y
+            if (n < 8)
+                vpushi((1 << n) - 1), gen_op('&');
+        }
         gen_cast(type);
         if (bits)
             vpushi(bits), gen_op(TOK_SHL);
@@ -1741,6 +1782,12 @@ static void load_packed_bf(CType *type, int bit_pos, int bit_size)
         bits += n, bit_size -= n, o = 1;
     } while (bit_size);
     vswap(), vpop();
+#ifdef TCC_TARGET_CCVM
+    if (!(type->t & VT_UNSIGNED) && (type->t & VT_BTYPE) != VT_LLONG) {
+        gen_bf_extract(0, bits, 1);
+        return;
+    }
+#endif
     if (!(type->t & VT_UNSIGNED)) {
         n = ((type->t & VT_BTYPE) == VT_LLONG ? 64 : 32) - bits;
         vpushi(n), gen_op(TOK_SHL);
@@ -1763,18 +1810,26 @@ static void store_packed_bf(int bit_pos, int bit_size)
         vrott(3); // X B V
         if (bits)
             vpushi(bits), gen_op(TOK_SHR);
-        if (bit_pos)
-            vpushi(bit_pos), gen_op(TOK_SHL);
         n = 8 - bit_pos;
         if (n > bit_size)
             n = bit_size;
-        if (n < 8) {
-            m = ((1 << n) - 1) << bit_pos;
-            vpushi(m), gen_op('&'); // X B V1
-            vpushv(vtop-1); // X B V1 B
-            vpushi(m & 0x80 ? ~m & 0x7f : ~m);
-            gen_op('&'); // X B V1 B1
-            gen_op('|'); // X B V2
+#ifdef TCC_TARGET_CCVM
+        if (!c && n < 8 && (vtop->type.t & VT_BTYPE) != VT_LLONG) {
+            vpushv(vtop-1), vswap(); // X B B V
+            gen_bf_insert(bit_pos, n); // X B V2
+        } else
+#endif
+        {
+            if (bit_pos)
+                vpushi(bit_pos), gen_op(TOK_SHL);
+            if (n < 8) {
+                m = ((1 << n) - 1) << bit_pos;
+                vpushi(m), gen_op('&'); // X B V1
+                vpushv(vtop-1); // X B V1 B
+                vpushi(m & 0x80 ? ~m & 0x7f : ~m);
+                gen_op('&'); // X B V1 B1
+                gen_op('|'); // X B V2
+            }
         }
         vdup(), vtop[-1] = vtop[-2]; // X B B V2
         vstore(), vpop(); // X B
@@ -1831,12 +1886,19 @@ ST_FUNC int gv(int rc)
             int bits = (type.t & VT_BTYPE) == VT_LLONG ? 64 : 32;
             /* cast to int to propagate signedness in following ops */
             gen_cast(&type);
-            /* generate shifts */
-            vpushi(bits - (bit_pos + bit_size));
-            gen_op(TOK_SHL);
-            vpushi(bits - bit_size);
-            /* NOTE: transformed to SHR if unsigned */
-            gen_op(TOK_SAR);
+#ifdef TCC_TARGET_CCVM
+            if (bits == 32) {
+                gen_bf_extract(bit_pos, bit_size, !(type.t & VT_UNSIGNED));
+            } else
+#endif
+            {
+                /* generate shifts */
+                vpushi(bits - (bit_pos + bit_size));
+                gen_op(TOK_SHL);
+                vpushi(bits - bit_size);
+                /* NOTE: transformed to SHR if unsigned */
+                gen_op(TOK_SAR);
+            }
         }
         r = gv(rc);
     } else {
@@ -2051,7 +2113,7 @@ static void gv_dup(void)
     vtop->r = r;
 }
 
-#if PTR_SIZE == 4
+#if PTR_SIZE == 4 && !defined TCC_TARGET_CCVM
 /* generate CPU independent (unsigned) long long operations */
 static void gen_opl(int op)
 {
@@ -3693,6 +3755,20 @@ ST_FUNC void vstore(void)
         }
         if (r == VT_STRUCT) {
             store_packed_bf(bit_pos, bit_size);
+#ifdef TCC_TARGET_CCVM
+        } else if (dbt != VT_LLONG
+                   && (vtop->r & (VT_VALMASK | VT_LVAL | VT_SYM)) != VT_CONST) {
+            /* insert source into destination */
+            vswap();
+            vdup();
+            vrott(3);
+            vswap();
+            gen_bf_insert(bit_pos, bit_size);
+            /* store result */
+            vstore();
+            /* ... and discard */
+            vpop();
+#endif
         } else {
             unsigned long long mask = (1ULL << bit_size) - 1;
             if (dbt != VT_BOOL) {
@@ -6417,6 +6493,9 @@ static void expr_cond(void)
     int tt, u, r1, r2, rc, t1, t2, islv, c, g;
     SValue sv;
     CType type;
+#ifdef TCC_TARGET_CCVM
+    int cond_op = 0, cond_ind = 0;
+#endif
 
     expr_lor();
     if (tok == '?') {
@@ -6427,6 +6506,16 @@ static void expr_cond(void)
         if (!g) {
             if (c < 0) {
                 save_regs(1);
+#ifdef TCC_TARGET_CCVM
+                /* compare before the jump (as gvtst() does), so that the flags
+                   can be used by gen_cond_select() instead of the jump */
+                if (vtop->r != VT_CMP) {
+                    vpushi(0);
+                    gen_op(TOK_NE);
+                }
+                if (vtop->r == VT_CMP && !vtop->jtrue && !vtop->jfalse)
+                    cond_op = vtop->cmp_op, cond_ind = ind;
+#endif
                 tt = gvtst(1, 0);
             } else {
                 vpop();
@@ -6488,6 +6577,11 @@ static void expr_cond(void)
             return;
         }
 
+#ifdef TCC_TARGET_CCVM
+        if (cond_op && gen_cond_select(cond_ind, cond_op, &sv, &type))
+            return;
+#endif
+
         /* keep structs lvalue by transforming `(expr ? a : b)` to `*(expr ? &a : &b)` so
            that `(expr ? a : b).mem` does not error  with "lvalue expected" */
         islv = (vtop->r & VT_LVAL) && (sv.r & VT_LVAL) && VT_STRUCT == (type.t & VT_BTYPE);
@@ -6877,9 +6971,36 @@ static void new_scope(struct scope *o)
     /* record local declaration stack position */
     o->lstk = local_stack;
     o->llstk = local_label_stack;
+#ifdef TCC_TARGET_CCVM
+    o->loc = loc;
+#endif
     ++local_scope;
 }
 
+#ifdef TCC_TARGET_CCVM
+/* Give the stack slots of the locals and temporaries of a finished scope
+   back, so that sibling scopes can overlap them.  Not done if something
+   still refers to them: value of a statement expression, saved VLA stack
+   pointers, bound checked regions or values left on the vstack. */
+static void free_scope_locals(struct scope *o, int is_expr)
+{
+    SValue *p;
+    int r;
+
+    if (loc < func_min_loc)
+        func_min_loc = loc;
+    if (is_expr || o->vla.num || tcc_state->do_bounds_check || loc >= o->loc)
+        return;
+    for (p = vstack; p <= vtop; p++) {
+        r = p->r & VT_VALMASK;
+        if ((r == VT_LOCAL || r == VT_LLOCAL) && p->c.i < o->loc)
+            return;
+    }
+    loc = o->loc;
+    drop_temp_local_vars(loc);
+}
+#endif
+
 static void prev_scope(struct scope *o, int is_expr)
 {
     vla_leave(o->prev);
@@ -6900,6 +7021,9 @@ static void prev_scope(struct scope *o, int is_expr)
 
     /* pop locally defined symbols */
     pop_local_syms(o->lstk, is_expr);
+#ifdef TCC_TARGET_CCVM
+    free_scope_locals(o, is_expr);
+#endif
     cur_scope = o->prev;
     --local_scope;
 }
@@ -8339,6 +8463,9 @@ static void gen_function(Sym *sym)
     local_scope = 0;
     rsym = 0;
     clear_temp_local_var_list();
+#ifdef TCC_TARGET_CCVM
+    func_min_loc = loc;
+#endif
     func_vla_arg(sym);
     block(0);
     gsym(rsym);
@@ -8346,6 +8473,11 @@ static void gen_function(Sym *sym)
     nocode_wanted = 0;
     /* reset local stack */
     pop_local_syms(NULL, 0);
+#ifdef TCC_TARGET_CCVM
+    /* the frame must hold the deepest scope */
+    if (func_min_loc < loc)
+        loc = func_min_loc;
+#endif
     tcc_debug_prolog_epilog(tcc_state, 1);
     gfunc_epilog();
 
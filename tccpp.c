@@ -147,11 +147,11 @@ typedef struct TinyAlloc {
     uint8_t *buffer;
     uint8_t *p;
     unsigned  nb_allocs;
+    unsigned  nb_total;
+    unsigned  nb_missed;
     struct TinyAlloc *next, *top;
 #ifdef TAL_INFO
     unsigned  nb_peak;
-    unsigned  nb_total;
-    unsigned  nb_missed;
     uint8_t *peak_p;
 #endif
 } TinyAlloc;
@@ -207,6 +207,8 @@ tail_call:
 #endif
     }
 #endif
+    tcc_state->tal_allocs += al->nb_total;
+    tcc_state->tal_missed += al->nb_missed;
     next = al->next;
     tcc_free(al->buffer);
     tcc_free(al);
@@ -277,8 +279,8 @@ tail_call:
                 al->nb_peak = al->nb_allocs;
             if (al->peak_p < al->p)
                 al->peak_p = al->p;
-            al->nb_total++;
 #endif
+            al->nb_total++;
             return ret;
         } else if (is_own) {
             al->nb_allocs--;
@@ -314,9 +316,7 @@ tail_call:
         goto tail_call;
     } else
         ret = tcc_realloc(p, size);
-#ifdef TAL_INFO
     al->nb_missed++;
-#endif
     return ret;
 }
 
@@ -647,12 +647,14 @@ static int handle_eob(void)
     /* only tries to read if really end of buffer */
     if (bf->buf_ptr >= bf->buf_end) {
         if (bf->fd >= 0) {
+            int phase = tcc_bench_phase(tcc_state, BENCH_PP);
 #if defined(PARSE_DEBUG)
             len = 1;
 #else
             len = IO_BUF_SIZE;
 #endif
             len = read(bf->fd, bf->buffer, len);
+            tcc_bench_phase(tcc_state, phase);
             if (len < 0)
                 len = 0;
         } else {
@@ -2630,10 +2632,12 @@ maybe_newline:
         PEEKC(c, p);
         if ((tok_flags & TOK_FLAG_BOL) && 
             (parse_flags & PARSE_FLAG_PREPROCESS)) {
+            int phase = tcc_bench_phase(tcc_state, BENCH_PP);
             tok_flags &= ~TOK_FLAG_BOL;
             file->buf_ptr = p;
             preprocess(tok_flags & TOK_FLAG_BOF);
             p = file->buf_ptr;
+            tcc_bench_phase(tcc_state, phase);
             goto maybe_newline;
         } else {
             if (c == '#') {
@@ -3502,7 +3506,9 @@ redo:
         Sym *s = define_find(t);
         if (s) {
             Sym *nested_list = NULL;
+            int phase = tcc_bench_phase(tcc_state, BENCH_PP);
             macro_subst_tok(&tokstr_buf, &nested_list, s);
+            tcc_bench_phase(tcc_state, phase);
             tok_str_add(&tokstr_buf, 0);
             begin_macro(&tokstr_buf, 0);
             goto redo;
@@ -0,0 +1,190 @@
+/*
+ * Generated code benchmark: runs each kernel compiled by tcc and by the
+ * reference compiler at -O0 and -O1, checks that they return the same
+ * checksum and reports cycles and instructions of the best of N runs, or
+ * the wall time when the performance counters are not available.
+ * The code tcc generates for -run is the same as for -c.
+ *
+ *   bench [-r runs] [-t]     -t forces wall time
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#include "bench.h"
+
+#define VARIANTS 3
+
+typedef unsigned (*kernel_fn)(unsigned work);
+
+#define X(name, work) unsigned name##_tcc(unsigned); unsigned name##_O0(unsigned); unsigned name##_O1(unsigned);
+BENCH_KERNELS
+#undef X
+
+static const struct kernel {
+    const char *name;
+    unsigned work;
+    kernel_fn fn[VARIANTS];
+} kernels[] = {
+#define X(name, work) { #name, work, { name##_tcc, name##_O0, name##_O1 } },
+    BENCH_KERNELS
+#undef X
+};
+
+static const char *variant_names[VARIANTS] = { "tcc", "cc -O0", "cc -O1" };
+
+struct sample {
+    double cycles;
+    double instructions;
+    double seconds;
+};
+
+static int perf_fd = -1, perf_fd_instr = -1;
+
+#ifdef __linux__
+static int perf_open(unsigned long long config, int group)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.disabled = group < 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+static void perf_init(void)
+{
+    perf_fd = perf_open(PERF_COUNT_HW_CPU_CYCLES, -1);
+    if (perf_fd >= 0) {
+        perf_fd_instr = perf_open(PERF_COUNT_HW_INSTRUCTIONS, perf_fd);
+        if (perf_fd_instr < 0) {
+            close(perf_fd);
+            perf_fd = -1;
+        }
+    }
+}
+#else
+static void perf_init(void)
+{
+}
+#endif
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* returns the checksum, -1 in sample fields that were not measured */
+static unsigned measure(kernel_fn fn, unsigned work, struct sample *s)
+{
+    unsigned result;
+    double start;
+#ifdef __linux__
+    unsigned long long counters[3];
+    if (perf_fd >= 0) {
+        ioctl(perf_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#endif
+    start = now();
+    result = fn(work);
+    s->seconds = now() - start;
+    s->cycles = s->instructions = -1;
+#ifdef __linux__
+    if (perf_fd >= 0) {
+        ioctl(perf_fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        if (read(perf_fd, counters, sizeof(counters)) == sizeof(counters) && counters[0] == 2) {
+            s->cycles = counters[1];
+            s->instructions = counters[2];
+        }
+    }
+#endif
+    return result;
+}
+
+static void print_value(double value, double tcc_value, int is_tcc)
+{
+    if (value < 0)
+        printf(" %12s %6s", "-", "");
+    else if (value >= 1e6)
+        printf(" %11.2fM", value / 1e6);
+    else
+        printf(" %12.0f", value);
+    if (value >= 0 && !is_tcc)
+        printf(" %5.2fx", tcc_value / value);
+    else if (value >= 0)
+        printf(" %6s", "");
+}
+
+int main(int argc, char **argv)
+{
+    int runs = 5, wall_time = 0, failed = 0, opt, i, v, r;
+
+    while ((opt = getopt(argc, argv, "r:t")) != -1) {
+        switch (opt) {
+            case 'r': runs = atoi(optarg); break;
+            case 't': wall_time = 1; break;
+            default: runs = 0; break;
+        }
+    }
+    if (runs < 1) {
+        fprintf(stderr, "usage: bench [-r runs] [-t]\n");
+        return 1;
+    }
+    if (!wall_time)
+        perf_init();
+    printf("%s, best of %d runs, tcc relative to the reference compiler\n",
+           perf_fd >= 0 ? "cycles and instructions" : "wall time in microseconds", runs);
+    printf("%-10s %-7s", "kernel", "variant");
+    if (perf_fd >= 0)
+        printf(" %12s %6s %12s %6s\n", "cycles", "", "instr", "");
+    else
+        printf(" %12s %6s\n", "time", "");
+
+    for (i = 0; i < (int)(sizeof(kernels) / sizeof(kernels[0])); i++) {
+        const struct kernel *k = &kernels[i];
+        struct sample best[VARIANTS];
+        unsigned checksum[VARIANTS];
+        for (v = 0; v < VARIANTS; v++) {
+            for (r = 0; r < runs; r++) {
+                struct sample s;
+                checksum[v] = measure(k->fn[v], k->work, &s);
+                if (r == 0 || s.cycles < best[v].cycles)
+                    best[v].cycles = s.cycles;
+                if (r == 0 || s.instructions < best[v].instructions)
+                    best[v].instructions = s.instructions;
+                if (r == 0 || s.seconds < best[v].seconds)
+                    best[v].seconds = s.seconds;
+            }
+        }
+        for (v = 0; v < VARIANTS; v++) {
+            printf("%-10s %-7s", v == 0 ? k->name : "", variant_names[v]);
+            if (perf_fd >= 0) {
+                print_value(best[v].cycles, best[0].cycles, v == 0);
+                print_value(best[v].instructions, best[0].instructions, v == 0);
+            } else {
+                print_value(best[v].seconds * 1e6, best[0].seconds * 1e6, v == 0);
+            }
+            if (checksum[v] != checksum[1]) {
+                printf(" wrong checksum %08x, expected %08x", checksum[v], checksum[1]);
+                failed = 1;
+            }
+            printf("\n");
+        }
+    }
+    return failed;
+}
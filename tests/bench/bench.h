@@ -0,0 +1,27 @@
+/*
+ * Generated code benchmark, see bench.c
+ *
+ * Each kernel is compiled once for each variant (tcc, cc -O0, cc -O1) with
+ * BENCH_VARIANT set to its name, so all of them can be linked together.
+ * Kernels do not call the C library and return a checksum of their work.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+/* X(name, work) - work is the argument of one run */
+#define BENCH_KERNELS \
+    X(matmul, 6) \
+    X(hashtab, 40) \
+    X(strsearch, 8) \
+    X(sort, 6) \
+    X(bignum, 20)
+
+#define BENCH_CAT_(a, b) a##_##b
+#define BENCH_CAT(a, b) BENCH_CAT_(a, b)
+#define BENCH_FN(name) BENCH_CAT(name, BENCH_VARIANT)
+
+/* simple and reproducible random numbers */
+#define BENCH_RAND(seed) ((seed) = (seed) * 1103515245u + 12345u, (seed) >> 8)
+
+#endif
@@ -0,0 +1,67 @@
+/* multi-precision arithmetic with 32-bit limbs: factorial and schoolbook squaring */
+#include "bench.h"
+
+#define LIMBS 512
+
+typedef unsigned limb;
+typedef unsigned long long dlimb;
+
+static limb fact[LIMBS], square[2 * LIMBS];
+
+/* n *= x, returns new length */
+static int mul_small(limb *n, int len, limb x)
+{
+    dlimb carry = 0;
+    int i;
+    for (i = 0; i < len; i++) {
+        carry += (dlimb)n[i] * x;
+        n[i] = (limb)carry;
+        carry >>= 32;
+    }
+    if (carry && len < LIMBS)
+        n[len++] = (limb)carry;
+    return len;
+}
+
+/* r = n * n */
+static void mul_square(limb *r, const limb *n, int len)
+{
+    int i, j;
+    for (i = 0; i < 2 * len; i++)
+        r[i] = 0;
+    for (i = 0; i < len; i++) {
+        dlimb carry = 0;
+        for (j = 0; j < len; j++) {
+            carry += (dlimb)n[i] * n[j] + r[i + j];
+            r[i + j] = (limb)carry;
+            carry >>= 32;
+        }
+        r[i + len] = (limb)carry;
+    }
+}
+
+/* remainder of n divided by d */
+static limb mod_small(const limb *n, int len, limb d)
+{
+    dlimb rem = 0;
+    int i;
+    for (i = len - 1; i >= 0; i--)
+        rem = ((rem << 32) | n[i]) % d;
+    return (limb)rem;
+}
+
+unsigned BENCH_FN(bignum)(unsigned work)
+{
+    unsigned result = 0, round, x;
+    int len;
+    for (round = 0; round < work; round++) {
+        fact[0] = 1;
+        len = 1;
+        for (x = 2; x < 1000 + round; x++)
+            len = mul_small(fact, len, x);
+        result = result * 3 + mod_small(fact, len, 1000000007u - round);
+        mul_square(square, fact, len < LIMBS / 2 ? len : LIMBS / 2);
+        result = result * 3 + mod_small(square, 2 * (len < LIMBS / 2 ? len : LIMBS / 2), 998244353u);
+    }
+    return result;
+}
@@ -0,0 +1,91 @@
+/* open addressing hash table with string keys: insert, lookup and delete */
+#include "bench.h"
+
+#define SLOTS 4096
+#define KEY_LEN 12
+#define DELETED ((struct entry *)1)
+
+struct entry {
+    char key[KEY_LEN];
+    unsigned value;
+};
+
+static struct entry entries[SLOTS / 2];
+static struct entry *table[SLOTS];
+
+static unsigned hash(const char *key)
+{
+    unsigned h = 2166136261u;
+    while (*key)
+        h = (h ^ (unsigned char)*key++) * 16777619u;
+    return h;
+}
+
+static int equal(const char *a, const char *b)
+{
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+static void make_key(char *key, unsigned n)
+{
+    int i;
+    for (i = 0; i < KEY_LEN - 1; i++) {
+        key[i] = 'a' + n % 26;
+        n = n / 26 + i * 7;
+    }
+    key[i] = 0;
+}
+
+static struct entry **find(const char *key, int for_insert)
+{
+    unsigned i = hash(key) & (SLOTS - 1);
+    struct entry **free_slot = 0;
+    while (table[i]) {
+        if (table[i] == DELETED) {
+            if (!free_slot)
+                free_slot = &table[i];
+        } else if (equal(table[i]->key, key)) {
+            return &table[i];
+        }
+        i = (i + 1) & (SLOTS - 1);
+    }
+    return for_insert && free_slot ? free_slot : &table[i];
+}
+
+unsigned BENCH_FN(hashtab)(unsigned work)
+{
+    unsigned seed = 7, result = 0, round, i;
+    char key[KEY_LEN];
+    for (i = 0; i < SLOTS; i++)
+        table[i] = 0;
+    for (i = 0; i < SLOTS / 2; i++) {
+        make_key(entries[i].key, i * 2654435761u);
+        entries[i].value = i;
+    }
+    for (round = 0; round < work; round++) {
+        for (i = 0; i < SLOTS / 2; i++) {
+            struct entry **slot = find(entries[i].key, 1);
+            if (!*slot || *slot == DELETED)
+                *slot = &entries[i];
+        }
+        for (i = 0; i < SLOTS; i++) {
+            struct entry **slot;
+            make_key(key, (BENCH_RAND(seed) % SLOTS) * 2654435761u);
+            slot = find(key, 0);
+            if (*slot)
+                result += (*slot)->value;
+            else
+                result ^= i;
+        }
+        for (i = round % 3; i < SLOTS / 2; i += 3) {
+            struct entry **slot = find(entries[i].key, 0);
+            if (*slot)
+                *slot = DELETED;
+        }
+    }
+    return result;
+}
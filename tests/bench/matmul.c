@@ -0,0 +1,70 @@
+/* matrix multiply of doubles, naive and blocked by rows */
+#include "bench.h"
+
+#define N 64
+
+static double a[N][N], b[N][N], c[N][N];
+
+static void init(unsigned seed)
+{
+    int i, j;
+    for (i = 0; i < N; i++) {
+        for (j = 0; j < N; j++) {
+            a[i][j] = (int)(BENCH_RAND(seed) % 19) - 9;
+            b[i][j] = (int)(BENCH_RAND(seed) % 19) - 9;
+        }
+    }
+}
+
+static void multiply_naive(void)
+{
+    int i, j, k;
+    for (i = 0; i < N; i++) {
+        for (j = 0; j < N; j++) {
+            double sum = 0;
+            for (k = 0; k < N; k++)
+                sum += a[i][k] * b[k][j];
+            c[i][j] = sum;
+        }
+    }
+}
+
+static void multiply_rows(void)
+{
+    int i, j, k;
+    for (i = 0; i < N; i++) {
+        double *row = c[i];
+        for (j = 0; j < N; j++)
+            row[j] = 0;
+        for (k = 0; k < N; k++) {
+            double x = a[i][k];
+            const double *brow = b[k];
+            for (j = 0; j < N; j++)
+                row[j] += x * brow[j];
+        }
+    }
+}
+
+static unsigned checksum(void)
+{
+    long long sum = 0;
+    int i, j;
+    for (i = 0; i < N; i++) {
+        for (j = 0; j < N; j++)
+            sum = sum * 31 + (long long)c[i][j];
+    }
+    return (unsigned)(sum ^ (sum >> 32));
+}
+
+unsigned BENCH_FN(matmul)(unsigned work)
+{
+    unsigned result = 0, i;
+    for (i = 0; i < work; i++) {
+        init(i + 1);
+        multiply_naive();
+        result ^= checksum();
+        multiply_rows();
+        result = result * 3 + checksum();
+    }
+    return result;
+}
@@ -0,0 +1,100 @@
+/* quicksort with insertion sort of small ranges, and heapsort */
+#include "bench.h"
+
+#define COUNT 16384
+
+static unsigned data[COUNT];
+
+static void insertion_sort(unsigned *p, int n)
+{
+    int i, j;
+    for (i = 1; i < n; i++) {
+        unsigned x = p[i];
+        for (j = i; j > 0 && p[j - 1] > x; j--)
+            p[j] = p[j - 1];
+        p[j] = x;
+    }
+}
+
+static void quick_sort(unsigned *p, int n)
+{
+    while (n > 16) {
+        unsigned pivot = p[n / 2], t;
+        int i = 0, j = n - 1;
+        while (i <= j) {
+            while (p[i] < pivot)
+                i++;
+            while (p[j] > pivot)
+                j--;
+            if (i <= j) {
+                t = p[i];
+                p[i++] = p[j];
+                p[j--] = t;
+            }
+        }
+        if (j + 1 < n - i) {
+            quick_sort(p, j + 1);
+            p += i;
+            n -= i;
+        } else {
+            quick_sort(p + i, n - i);
+            n = j + 1;
+        }
+    }
+    insertion_sort(p, n);
+}
+
+static void sift_down(unsigned *p, int root, int n)
+{
+    unsigned x = p[root];
+    int child;
+    while ((child = 2 * root + 1) < n) {
+        if (child + 1 < n && p[child + 1] > p[child])
+            child++;
+        if (p[child] <= x)
+            break;
+        p[root] = p[child];
+        root = child;
+    }
+    p[root] = x;
+}
+
+static void heap_sort(unsigned *p, int n)
+{
+    unsigned t;
+    int i;
+    for (i = n / 2 - 1; i >= 0; i--)
+        sift_down(p, i, n);
+    for (i = n - 1; i > 0; i--) {
+        t = p[0];
+        p[0] = p[i];
+        p[i] = t;
+        sift_down(p, 0, i);
+    }
+}
+
+static unsigned checksum(void)
+{
+    unsigned sum = 0;
+    int i;
+    for (i = 0; i < COUNT; i++)
+        sum = sum * 33 + data[i] + (i > 0 && data[i - 1] > data[i]);
+    return sum;
+}
+
+unsigned BENCH_FN(sort)(unsigned work)
+{
+    unsigned seed = 3, result = 0, round;
+    int i;
+    for (round = 0; round < work; round++) {
+        for (i = 0; i < COUNT; i++)
+            data[i] = BENCH_RAND(seed);
+        quick_sort(data, COUNT);
+        result = result * 5 + checksum();
+        for (i = 0; i < COUNT; i++)
+            data[i] = BENCH_RAND(seed) % 1000;
+        heap_sort(data, COUNT);
+        result = result * 5 + checksum();
+    }
+    return result;
+}
@@ -0,0 +1,59 @@
+/* substring search in a text over a small alphabet, naive and Horspool */
+#include "bench.h"
+
+#define TEXT_LEN 65536
+#define PATTERNS 16
+
+static char text[TEXT_LEN + 1];
+static char patterns[PATTERNS][16];
+
+static unsigned count_naive(const char *pattern, int len)
+{
+    unsigned count = 0;
+    int i, j;
+    for (i = 0; i + len <= TEXT_LEN; i++) {
+        for (j = 0; j < len && text[i + j] == pattern[j]; j++)
+            ;
+        if (j == len)
+            count++;
+    }
+    return count;
+}
+
+static unsigned count_horspool(const char *pattern, int len)
+{
+    int shift[256];
+    unsigned count = 0;
+    int i, j;
+    for (i = 0; i < 256; i++)
+        shift[i] = len;
+    for (i = 0; i < len - 1; i++)
+        shift[(unsigned char)pattern[i]] = len - 1 - i;
+    for (i = 0; i + len <= TEXT_LEN; i += shift[(unsigned char)text[i + len - 1]]) {
+        for (j = len - 1; j >= 0 && text[i + j] == pattern[j]; j--)
+            ;
+        if (j < 0)
+            count++;
+    }
+    return count;
+}
+
+unsigned BENCH_FN(strsearch)(unsigned work)
+{
+    unsigned seed = 11, result = 0, round;
+    int i, j, len;
+    for (i = 0; i < TEXT_LEN; i++)
+        text[i] = "acgt"[BENCH_RAND(seed) & 3];
+    text[TEXT_LEN] = 0;
+    for (round = 0; round < work; round++) {
+        for (i = 0; i < PATTERNS; i++) {
+            len = 3 + (i + round) % 12;
+            for (j = 0; j < len; j++)
+                patterns[i][j] = "acgt"[BENCH_RAND(seed) & 3];
+            patterns[i][len] = 0;
+            result = result * 7 + count_naive(patterns[i], len);
+            result = result * 7 + count_horspool(patterns[i], len);
+        }
+    }
+    return result;
+}